@@ -0,0 +1,134 @@
+// Plays a synthetic corpus as fast as possible on a virtual clock and checks every file against
+// the expectations written by extras/midigen.py: channel event and note counts, dispatch order
+// (hash of tick/status/data in the order events reach the sink), the last event tick and its
+// song time. Also prints the time each file took, as a parser/scheduler benchmark on the target.
+// extras/corpuscheck.cpp runs the same check on a PC (part of the host tests, no board needed).
+//
+// Generate the corpus into this sketch's data folder and upload it to LittleFS:
+//   python3 extras/midigen.py examples/CorpusCheck/data/corpus --count 10
+//   python3 extras/midigen.py examples/CorpusCheck/data/corpus/dense.mid --format 0 --density 32 --running-status 1
+//
+// Serial command: run
+
+#include <LittleFS.h>
+#include "ESP32MidiPlayer.h"
+
+const char* CORPUS_DIR = "/corpus";
+
+// Time only moves when the sketch says so: each step jumps straight to the next due event
+class VirtualClock : public MidiTimeSource {
+public:
+  uint64_t now = 0;
+  uint64_t nowMicros() override { return now; }
+};
+
+class CheckSink : public MidiEventSink {
+public:
+  uint32_t events = 0;
+  uint32_t noteOns = 0;
+  uint32_t outOfOrder = 0;
+  uint32_t hash = 0x811C9DC5; // FNV-1a, as in midigen.py
+  uint64_t lastTick = 0;
+  uint64_t lastMicros = 0;
+
+  void onMidiEvent(const MidiEvent& event) override {
+    events++;
+    if (event.command() == 0x90 && event.data2 > 0) noteOns++;
+    if (event.tick < lastTick) outOfOrder++;
+    lastTick = event.tick;
+    lastMicros = event.micros;
+    for (int i = 0; i < 4; ++i) mix((uint8_t)(event.tick >> (8 * i)));
+    mix(event.status);
+    mix(event.data1);
+    mix(event.data2);
+  }
+
+private:
+  void mix(uint8_t byte) { hash = (hash ^ byte) * 0x01000193UL; }
+};
+
+ESP32MidiPlayer midiPlayer(LittleFS);
+VirtualClock virtualClock;
+
+// Reads "key value" lines; returns 0 for missing keys
+uint64_t expected(const String& text, const char* key) {
+  String prefix = String("\n") + key + " ";
+  int at = ("\n" + text).indexOf(prefix);
+  if (at < 0) return 0;
+  return strtoull(text.c_str() + at + prefix.length() - 1, nullptr, 0);
+}
+
+bool checkFile(const String& path) {
+  String expectPath = path.substring(0, path.length() - 4) + ".expect";
+  File expectFile = LittleFS.open(expectPath, FILE_READ);
+  if (!expectFile) {
+    Serial.printf("SKIP %s: no %s\n", path.c_str(), expectPath.c_str());
+    return true;
+  }
+  String expect = expectFile.readString();
+  expectFile.close();
+
+  CheckSink sink;
+  midiPlayer.setDefaultSink(&sink);
+  if (!midiPlayer.load(path.c_str())) {
+    Serial.printf("FAIL %s: load failed\n", path.c_str());
+    return false;
+  }
+
+  uint32_t start = micros();
+  midiPlayer.play();
+  while (midiPlayer.isPlaying()) {
+    midiPlayer.tick();
+    uint32_t wait = midiPlayer.getMicrosUntilNextEvent();
+    virtualClock.now += wait ? wait : 1;
+  }
+  uint32_t elapsed = micros() - start;
+
+  bool ok = sink.events == expected(expect, "channelEvents") && sink.noteOns == expected(expect, "noteOns") &&
+            sink.hash == expected(expect, "orderHash") && sink.outOfOrder == 0 &&
+            sink.lastTick == expected(expect, "lastTick") && sink.lastMicros == expected(expect, "lastMicros");
+  Serial.printf("%s %s: %lu events (expected %lu), hash %08lx (expected %08lx), last tick %llu at %llu us, %lu ms (%.1f us/event)\n",
+                ok ? "PASS" : "FAIL", path.c_str(), (unsigned long)sink.events,
+                (unsigned long)expected(expect, "channelEvents"), (unsigned long)sink.hash,
+                (unsigned long)expected(expect, "orderHash"), sink.lastTick, sink.lastMicros,
+                (unsigned long)(elapsed / 1000), sink.events ? (float)elapsed / sink.events : 0.0f);
+  return ok;
+}
+
+void runCorpus() {
+  File directory = LittleFS.open(CORPUS_DIR);
+  if (!directory || !directory.isDirectory()) {
+    Serial.printf("Corpus directory %s not found in LittleFS!\n", CORPUS_DIR);
+    return;
+  }
+  uint32_t passed = 0, failed = 0;
+  for (File file = directory.openNextFile(); file; file = directory.openNextFile()) {
+    String name = file.name();
+    file.close();
+    if (!name.endsWith(".mid")) continue;
+    if (checkFile(String(CORPUS_DIR) + "/" + name)) passed++;
+    else failed++;
+  }
+  directory.close();
+  midiPlayer.stop();
+  Serial.printf("=== %lu passed, %lu failed ===\n", (unsigned long)passed, (unsigned long)failed);
+}
+
+void setup() {
+  Serial.begin(115200);
+  while (!Serial) delay(10);
+  delay(1000);
+
+  LittleFS.begin();
+  midiPlayer.setTimeSource(&virtualClock);
+  midiPlayer.setLogLevel(MidiLogLevel::WARN);
+  runCorpus();
+}
+
+void loop() {
+  if (Serial.available() > 0) {
+    String command = Serial.readStringUntil('\n');
+    command.trim();
+    if (command.equalsIgnoreCase("run")) runCorpus();
+  }
+}
@@ -0,0 +1,99 @@
+// Synchronized playback across several ESP32 boards on the same WiFi network.
+// Flash one board with IS_LEADER = true and the others with false; every board plays the
+// same file (route the tracks each board should sound in the callbacks or with setPortSink()).
+// Start/pause/seek on the leader and the followers follow within a millisecond or so.
+
+// Serial commands (leader): play, pause, stop
+
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#include <LittleFS.h>
+#include "ESP32MidiPlayer.h"
+#include "MidiClockSync.h"
+
+const bool IS_LEADER = true;
+const char* WIFI_SSID = "your-ssid";
+const char* WIFI_PASSWORD = "your-password";
+const IPAddress LEADER_IP(192, 168, 1, 50);
+const uint16_t SYNC_PORT = 47000;
+
+const char* MIDI_FILE = "/test.mid";
+
+ESP32MidiPlayer midiPlayer(LittleFS);
+MidiClockSync midiSync(midiPlayer);
+WiFiUDP udp;
+IPAddress replyIp;
+uint16_t replyPort = 0;
+
+void sendSyncPacket(const uint8_t* packet, size_t length) {
+  // The leader answers whoever asked, followers always talk to the leader
+  udp.beginPacket(IS_LEADER ? replyIp : LEADER_IP, IS_LEADER ? replyPort : SYNC_PORT);
+  udp.write(packet, length);
+  udp.endPacket();
+}
+
+void pollSyncPackets() {
+  uint8_t packet[MidiClockSync::PACKET_SIZE];
+  while (udp.parsePacket() > 0) {
+    replyIp = udp.remoteIP();
+    replyPort = udp.remotePort();
+    int length = udp.read(packet, sizeof(packet));
+    if (length > 0) midiSync.receive(packet, length);
+  }
+}
+
+void handleNoteOn(uint8_t channel, uint8_t note, uint8_t velocity) {
+  // Send to this board's synth/output here
+}
+
+void setup() {
+  Serial.begin(115200);
+  LittleFS.begin();
+
+  WiFi.mode(WIFI_STA);
+  WiFi.setSleep(false); // Modem sleep adds tens of milliseconds of jitter to every exchange
+  WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+  while (WiFi.status() != WL_CONNECTED) delay(100);
+  Serial.printf("Connected, IP %s\n", WiFi.localIP().toString().c_str());
+
+  midiPlayer.setNoteOnCallback(handleNoteOn);
+  if (!midiPlayer.load(MIDI_FILE)) {
+    Serial.printf("Failed to load MIDI file %s\n", MIDI_FILE);
+    while (true) delay(1000);
+  }
+
+  if (IS_LEADER) {
+    udp.begin(SYNC_PORT);
+    midiSync.beginLeader(sendSyncPacket);
+  } else {
+    udp.begin(SYNC_PORT + 1);
+    midiSync.beginFollower(sendSyncPacket, 100000); // Exchange timestamps every 100 ms
+  }
+}
+
+void handleSerialCommands() {
+  if (!IS_LEADER || Serial.available() == 0) return;
+  String command = Serial.readStringUntil('\n');
+  command.trim();
+  if (command.equalsIgnoreCase("play")) midiPlayer.play();
+  else if (command.equalsIgnoreCase("pause")) midiPlayer.pause();
+  else if (command.equalsIgnoreCase("stop")) { midiPlayer.stop(); midiPlayer.load(MIDI_FILE); }
+}
+
+void printSyncStats() {
+  static uint32_t lastPrint = 0;
+  if (IS_LEADER || millis() - lastPrint < 1000) return;
+  lastPrint = millis();
+  MidiSyncStats stats = midiSync.getStats();
+  Serial.printf("locked=%d error=%ld us offset=%lld us skew=%.1f ppm rtt=%lu us relocations=%lu\n",
+                stats.locked, (long)stats.errorMicros, (long long)stats.offsetMicros, stats.skewPpm,
+                (unsigned long)stats.roundTripMicros, (unsigned long)stats.relocations);
+}
+
+void loop() {
+  midiPlayer.tick();
+  pollSyncPackets();
+  midiSync.update();
+  handleSerialCommands();
+  printSyncStats();
+}
@@ -0,0 +1,107 @@
+// Host version of the CorpusCheck example: plays every .mid file of a corpus generated by
+// midigen.py on a virtual clock and checks it against its .expect file (channel event and note
+// counts, dispatch order hash, last event tick and song time). Built with the host tests:
+//
+//   python3 extras/midigen.py /tmp/corpus --count 10
+//   cmake -S test -B build/test && cmake --build build/test && build/test/corpuscheck /tmp/corpus
+//
+// Exit status is non-zero if any file fails (or none was found).
+
+#include "TestSupport.h" // VirtualClock and playToEnd() from the host tests
+#include <chrono>
+#include <map>
+
+class CheckSink : public MidiEventSink {
+public:
+    uint32_t events = 0;
+    uint32_t noteOns = 0;
+    uint32_t outOfOrder = 0;
+    uint32_t hash = 0x811C9DC5; // FNV-1a, as in midigen.py
+    uint64_t lastTick = 0;
+    uint64_t lastMicros = 0;
+
+    void onMidiEvent(const MidiEvent& event) override {
+        events++;
+        if (event.command() == 0x90 && event.data2 > 0) noteOns++;
+        if (event.tick < lastTick) outOfOrder++;
+        lastTick = event.tick;
+        lastMicros = event.micros;
+        for (int i = 0; i < 4; ++i) mix((uint8_t)(event.tick >> (8 * i)));
+        mix(event.status);
+        mix(event.data1);
+        mix(event.data2);
+    }
+
+private:
+    void mix(uint8_t byte) { hash = (hash ^ byte) * 0x01000193UL; }
+};
+
+// "key value" lines; numbers in decimal or 0x hex
+static std::map<std::string, uint64_t> readExpect(const std::string& path) {
+    std::map<std::string, uint64_t> values;
+    FILE* file = fopen(path.c_str(), "r");
+    if (!file) return values;
+    char key[64], value[64];
+    while (fscanf(file, "%63s %63s", key, value) == 2) values[key] = strtoull(value, nullptr, 0);
+    fclose(file);
+    return values;
+}
+
+static bool checkFile(fs::FS& filesystem, const std::string& directory, const std::string& name) {
+    std::map<std::string, uint64_t> expect = readExpect(directory + "/" + name.substr(0, name.size() - 4) + ".expect");
+    if (expect.empty()) {
+        printf("SKIP %s: no .expect file\n", name.c_str());
+        return true;
+    }
+
+    VirtualClock clock; // Outlives the player, whose destructor still reads the time
+    CheckSink sink;
+    ESP32MidiPlayer player(filesystem);
+    player.setTimeSource(&clock);
+    player.setDefaultSink(&sink);
+    player.setLogLevel(MidiLogLevel::WARN);
+    auto start = std::chrono::steady_clock::now();
+    if (!player.load(("/" + name).c_str())) {
+        printf("FAIL %s: load failed\n", name.c_str());
+        return false;
+    }
+    playToEnd(player, clock);
+    double elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+    bool ok = sink.events == expect["channelEvents"] && sink.noteOns == expect["noteOns"] &&
+              sink.hash == expect["orderHash"] && sink.outOfOrder == 0 && sink.lastTick == expect["lastTick"] &&
+              sink.lastMicros == expect["lastMicros"];
+    printf("%s %s: %u events (expected %llu), %u notes (expected %llu), hash %08x (expected %08llx), "
+           "last tick %llu at %llu us (expected %llu at %llu), %.1f ms (%.2f us/event)\n",
+           ok ? "PASS" : "FAIL", name.c_str(), sink.events, (unsigned long long)expect["channelEvents"], sink.noteOns,
+           (unsigned long long)expect["noteOns"], sink.hash, (unsigned long long)expect["orderHash"],
+           (unsigned long long)sink.lastTick, (unsigned long long)sink.lastMicros,
+           (unsigned long long)expect["lastTick"], (unsigned long long)expect["lastMicros"], elapsed / 1000,
+           sink.events ? elapsed / sink.events : 0.0);
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        printf("usage: corpuscheck <corpus directory>\n");
+        return 2;
+    }
+    std::string directory = argv[1];
+    FS filesystem(directory.c_str());
+    File root = filesystem.open("/");
+    if (!root || !root.isDirectory()) {
+        printf("Corpus directory %s not found\n", directory.c_str());
+        return 2;
+    }
+    uint32_t passed = 0, failed = 0;
+    for (File file = root.openNextFile(); file; file = root.openNextFile()) {
+        String name = file.name();
+        file.close();
+        if (!name.endsWith(".mid")) continue;
+        if (checkFile(filesystem, directory, name.c_str())) passed++;
+        else failed++;
+    }
+    root.close();
+    printf("=== %u passed, %u failed ===\n", passed, failed);
+    return (failed || !passed) ? 1 : 0;
+}
@@ -0,0 +1,235 @@
+#!/usr/bin/env python3
+"""Generates synthetic Standard MIDI Files for stress and performance testing of
+ESP32MidiPlayer. The same seed and options always produce the same bytes.
+
+Next to every file a .expect text file lists what a correct player dispatches:
+channel event and note counts, the last event tick, its song time in microseconds
+and a hash of the channel events in dispatch order (tick, then track, then file
+order). examples/CorpusCheck plays the files on a virtual clock and checks them.
+
+Usage: midigen.py output.mid [--seed 1] [--tracks 8] [--density 4] [--running-status 0.5]
+                  [--tempo-interval 16] [--sysex-rate 0.01] [--meta-rate 0.02] [--beats 256 | --size BYTES]
+       midigen.py corpus_dir --count 20 [same options]   (seeds seed .. seed + count - 1)
+"""
+import argparse
+import os
+import random
+import struct
+import sys
+
+DEFAULT_TEMPO = 500000
+FNV_OFFSET = 0x811C9DC5
+FNV_PRIME = 0x01000193
+
+
+def vlq(value):
+    out = [value & 0x7F]
+    value >>= 7
+    while value:
+        out.append(0x80 | (value & 0x7F))
+        value >>= 7
+    return bytes(reversed(out))
+
+
+def meta(kind, data):
+    return b'\xff' + bytes([kind]) + vlq(len(data)) + data
+
+
+def fnv1a(hash_value, data):
+    for byte in data:
+        hash_value = ((hash_value ^ byte) * FNV_PRIME) & 0xFFFFFFFF
+    return hash_value
+
+
+class Track:
+    """Timed events of one track, kept in insertion order for equal ticks."""
+
+    def __init__(self):
+        self.events = []  # (tick, sequence, kind, payload); kind 'ch' payload = status, data bytes
+
+    def add(self, tick, kind, payload):
+        self.events.append((tick, len(self.events), kind, payload))
+
+    def sorted(self):
+        return sorted(self.events, key=lambda e: (e[0], e[1]))
+
+
+def channel_events(rng, track, channel, ticks, division, density):
+    mean_gap = division / density
+    tick = 0
+    while True:
+        tick += int(rng.expovariate(1.0) * mean_gap)
+        if tick >= ticks:
+            break
+        roll = rng.random()
+        if roll < 0.6:  # Note with its release
+            note = rng.randint(24, 108)
+            track.add(tick, 'ch', bytes([0x90 | channel, note, rng.randint(1, 127)]))
+            end = min(tick + rng.randint(1, division * 2), ticks)
+            off = bytes([0x90 | channel, note, 0]) if rng.random() < 0.5 else bytes([0x80 | channel, note, 64])
+            track.add(end, 'ch', off)
+        elif roll < 0.8:
+            track.add(tick, 'ch', bytes([0xB0 | channel, rng.choice([1, 7, 10, 11, 64, 74, 91]), rng.randint(0, 127)]))
+        elif roll < 0.9:
+            track.add(tick, 'ch', bytes([0xE0 | channel, rng.randint(0, 127), rng.randint(0, 127)]))
+        elif roll < 0.94:
+            track.add(tick, 'ch', bytes([0xD0 | channel, rng.randint(0, 127)]))
+        elif roll < 0.97:
+            track.add(tick, 'ch', bytes([0xA0 | channel, rng.randint(24, 108), rng.randint(0, 127)]))
+        else:
+            track.add(tick, 'ch', bytes([0xC0 | channel, rng.randint(0, 127)]))
+
+
+def extra_events(rng, track, ticks, count_hint, sysex_rate, meta_rate):
+    for _ in range(int(count_hint * sysex_rate + rng.random())):
+        body = bytes(rng.randint(0, 127) for _ in range(rng.randint(2, 48))) + b'\xf7'
+        track.add(rng.randrange(ticks), 'sysex', b'\xf0' + vlq(len(body)) + body)
+    for _ in range(int(count_hint * meta_rate + rng.random())):
+        choice = rng.random()
+        if choice < 0.5:
+            kind = rng.choice([0x01, 0x06, 0x07])  # Text, marker, cue point
+            data = ('m%d' % rng.randint(0, 99999)).encode()
+        elif choice < 0.7:
+            kind, data = 0x59, bytes([rng.randint(0, 14) - 7 & 0xFF, rng.randint(0, 1)])  # Key signature
+        else:
+            kind, data = 0x7F, bytes(rng.randint(0, 255) for _ in range(rng.randint(1, 16)))  # Sequencer specific
+        track.add(rng.randrange(ticks), 'meta', meta(kind, data))
+
+
+def encode(track, running_ratio, rng):
+    out = bytearray()
+    tick = 0
+    running = None
+    for event_tick, _, kind, payload in track.sorted():
+        out += vlq(event_tick - tick)
+        tick = event_tick
+        if kind == 'ch':
+            if payload[0] == running and rng.random() < running_ratio:
+                out += payload[1:]
+            else:
+                out += payload
+            running = payload[0]
+        else:
+            out += payload
+            running = None  # SysEx and meta events cancel running status
+    out += vlq(0) + meta(0x2F, b'')
+    return b'MTrk' + struct.pack('>I', len(out)) + bytes(out)
+
+
+def generate(seed, args, beats):
+    rng = random.Random(seed)
+    division = args.division
+    ticks = beats * division
+    track_count = 1 if args.format == 0 else max(2, args.tracks)
+    tracks = [Track() for _ in range(track_count)]
+
+    # Conductor data (the only track in format 0): time signature and tempo changes
+    conductor = tracks[0]
+    conductor.add(0, 'meta', meta(0x58, bytes([4, 2, 24, 8])))
+    tempos = [(0, DEFAULT_TEMPO)]
+    if args.tempo_interval > 0:
+        tick = 0
+        while True:
+            tick += max(1, int(rng.expovariate(1.0) * args.tempo_interval * division))
+            if tick >= ticks:
+                break
+            tempos.append((tick, rng.randint(250000, 1000000)))
+    for tick, tempo in tempos:
+        conductor.add(tick, 'meta', meta(0x51, tempo.to_bytes(3, 'big')))
+
+    for index, track in enumerate(tracks):
+        if track_count > 1 and index == 0:
+            continue
+        channels = range(16) if track_count == 1 else [(index - 1) % 16]
+        for channel in channels:
+            channel_events(rng, track, channel, ticks, division, args.density / len(channels))
+        extra_events(rng, track, ticks, len(track.events), args.sysex_rate, args.meta_rate)
+
+    chunks = [encode(track, args.running_status, rng) for track in tracks]
+    data = b'MThd' + struct.pack('>IHHH', 6, args.format, track_count, division) + b''.join(chunks)
+
+    # What a player dispatches: channel events merged by (tick, track, file order)
+    merged = []
+    for index, track in enumerate(tracks):
+        for position, (tick, _, kind, payload) in enumerate(track.sorted()):
+            if kind == 'ch':
+                merged.append((tick, index, position, payload))
+    merged.sort(key=lambda e: e[:3])
+    order_hash = FNV_OFFSET
+    for tick, _, _, payload in merged:
+        order_hash = fnv1a(order_hash, struct.pack('<I', tick) + payload + (b'\x00' if len(payload) == 2 else b''))
+    last_tick = merged[-1][0] if merged else 0
+
+    # Song time of the last event: tick lengths summed in us * division units, as the player does
+    units = 0
+    for i, (tick, tempo) in enumerate(tempos):
+        end = min(tempos[i + 1][0] if i + 1 < len(tempos) else last_tick, last_tick)
+        if end > tick:
+            units += (end - tick) * tempo
+
+    expect = {
+        'format': args.format,
+        'tracks': track_count,
+        'division': division,
+        'bytes': len(data),
+        'channelEvents': len(merged),
+        'noteOns': sum(1 for e in merged if e[3][0] & 0xF0 == 0x90 and e[3][2] > 0),
+        'tempoChanges': len(tempos) - 1,
+        'sysex': sum(1 for t in tracks for e in t.events if e[2] == 'sysex'),
+        'metas': sum(1 for t in tracks for e in t.events if e[2] == 'meta'),
+        'lastTick': last_tick,
+        'lastMicros': units // division,
+        'orderHash': '0x%08x' % order_hash,
+    }
+    return data, expect
+
+
+def write(path, seed, args):
+    beats = args.beats
+    data, expect = generate(seed, args, beats)
+    if args.size:
+        for _ in range(4):  # Scale the length until the size is within a few percent
+            if abs(len(data) - args.size) <= args.size // 50:
+                break
+            beats = max(1, beats * args.size // max(len(data), 1))
+            data, expect = generate(seed, args, beats)
+    with open(path, 'wb') as f:
+        f.write(data)
+    with open(os.path.splitext(path)[0] + '.expect', 'w') as f:
+        f.write('seed %d\n' % seed)
+        for key, value in expect.items():
+            f.write('%s %s\n' % (key, value))
+    print('%s: seed %d, %d tracks, %d beats, %d bytes, %d channel events, %d tempo changes' % (
+        path, seed, expect['tracks'], beats, len(data), expect['channelEvents'], expect['tempoChanges']))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('output', help='file to write, or a directory with --count')
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('--count', type=int, default=1, help='number of files (one seed each)')
+    parser.add_argument('--format', type=int, default=1, choices=[0, 1])
+    parser.add_argument('--tracks', type=int, default=8, help='tracks including the conductor track (format 1)')
+    parser.add_argument('--division', type=int, default=480)
+    parser.add_argument('--density', type=float, default=4.0, help='channel events per beat per track (mean)')
+    parser.add_argument('--running-status', type=float, default=0.5, help='share of repeated status bytes omitted')
+    parser.add_argument('--tempo-interval', type=float, default=16.0, help='mean beats between tempo changes (0 = none)')
+    parser.add_argument('--sysex-rate', type=float, default=0.01, help='SysEx events per channel event')
+    parser.add_argument('--meta-rate', type=float, default=0.02, help='text/marker/key/sequencer meta events per channel event')
+    parser.add_argument('--beats', type=int, default=256, help='song length')
+    parser.add_argument('--size', type=int, default=0, help='target file size in bytes (overrides --beats)')
+    args = parser.parse_args()
+
+    if not 1 <= args.division <= 0x7FFF or args.density <= 0 or not 0 <= args.running_status <= 1:
+        sys.exit('division must be 1-32767, density > 0 and running status 0-1')
+
+    if args.count == 1 and not os.path.isdir(args.output):
+        write(args.output, args.seed, args)
+        return
+    os.makedirs(args.output, exist_ok=True)
+    for seed in range(args.seed, args.seed + args.count):
+        write(os.path.join(args.output, 'gen%d.mid' % seed), seed, args)
+
+
+if __name__ == '__main__':
+    main()
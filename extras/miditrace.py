@@ -0,0 +1,160 @@
+#!/usr/bin/env python3
+"""Reads event traces written by MidiTraceSink and compares them.
+
+diff walks two traces (e.g. from the build before and after a change, same song, same
+virtual clock) event by event. It reports the first event whose message, track, port or
+tick differs, with a few events of context, and the song time and clock time deltas of
+the events before it: the largest, the mean and the first one over the tolerance.
+Exit status is 0 when the traces match, 1 when they differ.
+
+Usage: miditrace.py dump trace.trc [--limit 50]
+       miditrace.py diff golden.trc candidate.trc [--tolerance 0] [--context 3]
+"""
+import argparse
+import struct
+import sys
+
+MAGIC = b'MTRC'
+VERSION = 1
+HEADER_SIZE = 12
+FLAG_CLOCK = 0x01
+NAMES = {0x80: 'NoteOff', 0x90: 'NoteOn', 0xA0: 'PolyPressure', 0xB0: 'Control', 0xC0: 'Program',
+         0xD0: 'Pressure', 0xE0: 'PitchBend'}
+
+
+class Event:
+    __slots__ = ('index', 'tick', 'micros', 'clock', 'status', 'data1', 'data2', 'track', 'port')
+
+    def key(self):
+        return (self.tick, self.status, self.data1, self.data2, self.track, self.port)
+
+    def __str__(self):
+        clock = '' if self.clock is None else ' clock %d' % self.clock
+        data2 = '' if self.status & 0xF0 in (0xC0, 0xD0) else ' %3d' % self.data2
+        return '#%d tick %d at %d us%s: %s ch %d %3d%s (track %d, port %d)' % (
+            self.index, self.tick, self.micros, clock, NAMES.get(self.status & 0xF0, '?'),
+            (self.status & 0x0F) + 1, self.data1, data2, self.track, self.port)
+
+
+def read_delta(data, pos):
+    value = shift = 0
+    while True:
+        if pos >= len(data):
+            raise EOFError
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if byte < 0x80:
+            return (value >> 1) ^ -(value & 1), pos
+
+
+def load(path):
+    data = open(path, 'rb').read()
+    if data[:4] != MAGIC or len(data) < HEADER_SIZE:
+        sys.exit('%s: not a MidiTraceSink trace' % path)
+    if data[4] != VERSION:
+        sys.exit('%s: trace version %d, expected %d' % (path, data[4], VERSION))
+    has_clock = bool(data[5] & FLAG_CLOCK)
+    count = struct.unpack_from('<I', data, 8)[0]
+
+    events = []
+    tick = micros = clock = 0
+    pos = HEADER_SIZE
+    try:
+        while pos < len(data):
+            event = Event()
+            delta, pos = read_delta(data, pos)
+            tick += delta
+            delta, pos = read_delta(data, pos)
+            micros += delta
+            if has_clock:
+                delta, pos = read_delta(data, pos)
+                clock += delta
+            event.index, event.tick, event.micros = len(events), tick, micros
+            event.clock = clock if has_clock else None
+            length = 4 if data[pos] & 0xF0 in (0xC0, 0xD0) else 5
+            if pos + length > len(data):
+                raise EOFError
+            record = data[pos:pos + length]
+            pos += length
+            event.status, event.data1 = record[0], record[1]
+            event.data2 = 0 if length == 4 else record[2]
+            event.track, event.port = record[-2], record[-1]
+            events.append(event)
+    except (EOFError, IndexError):
+        print('%s: truncated after %d events' % (path, len(events)), file=sys.stderr)
+    if count != len(events):
+        print('%s: header says %d events, read %d (trace not closed with end()?)' % (path, count, len(events)),
+              file=sys.stderr)
+    return events, has_clock
+
+
+def dump(args):
+    events, _ = load(args.trace)
+    for event in events[:args.limit or None]:
+        print(event)
+    print('%d events' % len(events))
+
+
+def timing(name, pairs, tolerance):
+    deltas = [b - a for a, b in pairs]
+    if not deltas:
+        return None
+    worst = max(range(len(deltas)), key=lambda i: abs(deltas[i]))
+    over = next((i for i, d in enumerate(deltas) if abs(d) > tolerance), None)
+    print('%s deltas: max %+d us at #%d, mean %+.1f us%s' % (
+        name, deltas[worst], worst, sum(deltas) / len(deltas),
+        '' if over is None else ', first over %d us at #%d (%+d us)' % (tolerance, over, deltas[over])))
+    return over
+
+
+def diff(args):
+    golden, golden_clock = load(args.golden)
+    candidate, candidate_clock = load(args.candidate)
+    common = min(len(golden), len(candidate))
+    first = next((i for i in range(common) if golden[i].key() != candidate[i].key()), None)
+    if first is None and len(golden) != len(candidate):
+        first = common
+    matched = common if first is None else first
+
+    print('%s: %d events, %s: %d events' % (args.golden, len(golden), args.candidate, len(candidate)))
+    pairs = [(golden[i].micros, candidate[i].micros) for i in range(matched)]
+    late = timing('song time', pairs, args.tolerance) is not None
+    if golden_clock and candidate_clock:
+        clock = [(golden[i].clock, candidate[i].clock) for i in range(matched)]
+        late = timing('clock time', clock, args.tolerance) is not None or late
+
+    if first is None:
+        print('events identical' + (', timing differs' if late else ''))
+        return 1 if late else 0
+    print('first divergence at event #%d:' % first)
+    for label, events in (('-', golden), ('+', candidate)):
+        for event in events[max(0, first - args.context):first + args.context + 1]:
+            print('%s%s %s' % (label, '>' if event.index == first else ' ', event))
+        if first >= len(events):
+            print('%s> (end of trace)' % label)
+    return 1
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    commands = parser.add_subparsers(dest='command', required=True)
+    dump_parser = commands.add_parser('dump', help='print the events of a trace')
+    dump_parser.add_argument('trace')
+    dump_parser.add_argument('--limit', type=int, default=0, help='events to print (0 = all)')
+    diff_parser = commands.add_parser('diff', help='compare two traces')
+    diff_parser.add_argument('golden')
+    diff_parser.add_argument('candidate')
+    diff_parser.add_argument('--tolerance', type=int, default=0, help='allowed timing delta in microseconds')
+    diff_parser.add_argument('--context', type=int, default=3, help='events shown around the divergence')
+    args = parser.parse_args()
+
+    if args.command == 'dump':
+        dump(args)
+        return 0
+    return diff(args)
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,142 @@
+#!/usr/bin/env python3
+"""Packs a MIDI (.mid/.kar/.rmi) file into the block-compressed MIDZ container
+read by ESP32MidiPlayer::load().
+
+Every block is compressed independently with the heatshrink LZSS bit format so the
+player can decode any block straight into its read-ahead buffer.
+
+Usage: midzpack.py input.mid output.midz [--block-size 1024] [--window-bits 10] [--lookahead-bits 4]
+"""
+import argparse
+import struct
+import sys
+
+MAGIC = b'MIDZ'
+VERSION = 1
+HEADER_SIZE = 16
+
+
+class BitWriter:
+    def __init__(self):
+        self.out = bytearray()
+        self.acc = 0
+        self.bits = 0
+
+    def put(self, value, count):
+        for i in range(count - 1, -1, -1):
+            self.acc = (self.acc << 1) | ((value >> i) & 1)
+            self.bits += 1
+            if self.bits == 8:
+                self.out.append(self.acc)
+                self.acc = 0
+                self.bits = 0
+
+    def finish(self):
+        if self.bits:
+            self.out.append(self.acc << (8 - self.bits))
+        return bytes(self.out)
+
+
+def compress_block(data, window_bits, lookahead_bits):
+    max_distance = 1 << window_bits
+    max_count = 1 << lookahead_bits
+    writer = BitWriter()
+    chains = {}
+    pos = 0
+    while pos < len(data):
+        best_len, best_dist = 0, 0
+        key = data[pos:pos + 2]
+        if len(key) == 2:
+            for candidate in reversed(chains.get(key, [])):
+                distance = pos - candidate
+                if distance > max_distance:
+                    break
+                length = 0
+                while (length < max_count and pos + length < len(data)
+                       and data[candidate + length] == data[pos + length]):
+                    length += 1
+                if length > best_len:
+                    best_len, best_dist = length, distance
+                    if length == max_count:
+                        break
+        # A back-reference costs 1 + window + lookahead bits, a literal 9 bits
+        if best_len * 9 > 1 + window_bits + lookahead_bits:
+            writer.put(0, 1)
+            writer.put(best_dist - 1, window_bits)
+            writer.put(best_len - 1, lookahead_bits)
+            step = best_len
+        else:
+            writer.put(1, 1)
+            writer.put(data[pos], 8)
+            step = 1
+        for p in range(pos, pos + step):
+            chains.setdefault(data[p:p + 2], []).append(p)
+        pos += step
+    return writer.finish()
+
+
+def decompress_block(data, size, window_bits, lookahead_bits):
+    out = bytearray()
+    bit = 0
+
+    def get(count):
+        nonlocal bit
+        value = 0
+        for _ in range(count):
+            value = (value << 1) | ((data[bit >> 3] >> (7 - (bit & 7))) & 1)
+            bit += 1
+        return value
+
+    while len(out) < size:
+        if get(1):
+            out.append(get(8))
+        else:
+            distance = get(window_bits) + 1
+            count = get(lookahead_bits) + 1
+            for _ in range(min(count, size - len(out))):
+                out.append(out[-distance])
+    return bytes(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('input')
+    parser.add_argument('output')
+    parser.add_argument('--block-size', type=int, default=1024, choices=[256, 512, 1024, 2048, 4096])
+    parser.add_argument('--window-bits', type=int, default=10)
+    parser.add_argument('--lookahead-bits', type=int, default=4)
+    args = parser.parse_args()
+
+    if not 8 <= args.window_bits <= 14 or not 3 <= args.lookahead_bits < args.window_bits:
+        sys.exit('window bits must be 8-14 and lookahead bits 3..window bits - 1')
+
+    source = open(args.input, 'rb').read()
+    if source[:4] not in (b'MThd', b'RIFF'):
+        sys.exit('input is neither a Standard MIDI File nor an RMID file')
+
+    block_size = args.block_size
+    blocks = [compress_block(source[i:i + block_size], args.window_bits, args.lookahead_bits)
+              for i in range(0, len(source), block_size)]
+
+    table_size = (len(blocks) + 1) * 4
+    offsets = [HEADER_SIZE + table_size]
+    for block in blocks:
+        offsets.append(offsets[-1] + len(block))
+
+    header = MAGIC + struct.pack('>BBBBII', VERSION, args.window_bits, args.lookahead_bits,
+                                 block_size.bit_length() - 1, len(source), 0)
+    packed = header + b''.join(struct.pack('>I', o) for o in offsets) + b''.join(blocks)
+
+    # Verify before writing anything
+    for index, block in enumerate(blocks):
+        chunk = source[index * block_size:(index + 1) * block_size]
+        if decompress_block(block, len(chunk), args.window_bits, args.lookahead_bits) != chunk:
+            sys.exit('internal error: block %d does not round-trip' % index)
+
+    open(args.output, 'wb').write(packed)
+    print('%s: %d -> %d bytes (%.2fx), %d blocks of %d' % (
+        args.output, len(source), len(packed), len(source) / max(len(packed), 1), len(blocks), block_size))
+
+
+if __name__ == '__main__':
+    main()
@@ -1,5 +1,17 @@
 #include "ESP32MidiPlayer.h" // Include the header first
+#include "MidiBlockCache.h"
+#include "MidiSongCache.h"
 #include <stdio.h>              // For snprintf
+#include <algorithm>            // For std::stable_sort, std::upper_bound
+#if defined(ESP32)
+#include "esp_sleep.h"          // For light sleep in waitForNextEvent()
+#include "esp_timer.h"          // For the 64-bit time source
+#include "freertos/FreeRTOS.h"  // For the prefetch task
+#include "freertos/task.h"
+#elif defined(__linux__)
+#include <errno.h>
+#include <time.h>               // For clock_nanosleep() on host builds
+#endif
 
 // --- Constants ---
 const uint32_t MTHD_CHUNK_TYPE = 0x4D546864; // "MThd"
@@ -9,16 +21,54 @@ const uint8_t META_END_OF_TRACK = 0x2F;
 const uint8_t META_TEMPO = 0x51;
 const uint8_t META_TIME_SIGNATURE = 0x58;
 // Add other meta types if needed
+const uint8_t META_TEXT = 0x01;
 const uint8_t META_TRACK_NAME = 0x03;
+const uint8_t META_LYRIC = 0x05;
+const uint8_t META_CHANNEL_PREFIX = 0x20;
+const uint8_t META_PORT_PREFIX = 0x21;
 const uint8_t SYSEX_START = 0xF0;
 const uint8_t SYSEX_END = 0xF7;
 
+// --- Container Constants ---
+// RIFF MIDI: "RIFF" <size LE> "RMID", then chunks; the SMF lives in the "data" chunk.
+const uint32_t RIFF_CHUNK_TYPE = 0x52494646; // "RIFF"
+const uint32_t RMID_FORM_TYPE = 0x524D4944;  // "RMID"
+const uint32_t DATA_CHUNK_TYPE = 0x64617461; // "data"
+// Compressed container ("MIDZ"), all integers big-endian:
+//   0  "MIDZ"
+//   4  version (1), window bits (8-14), lookahead bits (3..window bits - 1), block size log2 (8-12)
+//   8  uncompressed size
+//   12 reserved (0)
+//   16 block table: (blockCount + 1) file offsets, block i spans [offset[i], offset[i+1])
+// Every block is compressed independently with the heatshrink LZSS bit format, so any
+// block can be decoded straight into a read-ahead window without earlier context.
+const uint32_t MIDZ_CONTAINER_TYPE = 0x4D49445A; // "MIDZ"
+const uint8_t MIDZ_VERSION = 1;
+const uint32_t MIDZ_HEADER_SIZE = 16;
+
+
+// --- Tickless Idle ---
+const uint32_t IDLE_SPIN_MICROS = 1000;         // Final stretch before an event is busy-waited for precision
+const uint32_t LIGHT_SLEEP_MARGIN_MICROS = 500; // Light sleep wakeup latency allowance
+
+// --- MIDI Time Code ---
+const uint32_t MTC_RELOCATE_MICROS = 150000;  // Timecode further off than this is located (seek) instead of trimmed
+const uint32_t MTC_CATCHUP_MICROS = 1000000;  // Smaller errors are trimmed out over roughly this long
+const double MTC_MAX_RATE_TRIM = 0.05;        // Largest rate correction while chasing (+/- 5%)
+const uint32_t MTC_DROPOUT_MICROS = 250000;   // No quarter frame for this long = timecode stopped
 
 // --- Static Variables for One-Time Warnings ---
 // These are declared at file scope (outside the class)
 static bool _divisionWarningLogged = false;
 static bool _tempoWarningLogged = false;
 
+// --- Lyric Timeline Limits ---
+const uint8_t MAX_LYRIC_TEXT_LENGTH = 255;   // Longer text events are truncated
+const uint32_t DEFAULT_TEMPO = 500000;       // 120 BPM
+
+// --- Song Cache ---
+const uint32_t INDEX_ARTIFACT_VERSION = 4;   // Bump when the index structures or their meaning change
+
 // --- Helper Function to Estimate VLQ byte length ---
 // (Not part of the class, just a utility for this file)
 static uint8_t _getVlqLength(uint32_t value) {
@@ -30,15 +80,118 @@ static uint8_t _getVlqLength(uint32_t value) {
     return 5; // Or handle as error? For logging offset, 4 or 5 is usually fine.
 }
 
+static uint32_t _readBE32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint32_t _readLE32(const uint8_t* p) {
+    return ((uint32_t)p[3] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | p[0];
+}
+
+// Cached index sections: element count, element size, raw elements (same build reads them back)
+template <typename T>
+static void _appendSection(std::vector<uint8_t>& artifact, const std::vector<T>& items) {
+    uint32_t header[2] = {(uint32_t)items.size(), (uint32_t)sizeof(T)};
+    const uint8_t* bytes = (const uint8_t*)header;
+    artifact.insert(artifact.end(), bytes, bytes + sizeof(header));
+    bytes = (const uint8_t*)items.data();
+    artifact.insert(artifact.end(), bytes, bytes + items.size() * sizeof(T));
+}
+
+template <typename T>
+static bool _readSection(const std::vector<uint8_t>& artifact, size_t& position, std::vector<T>& items) {
+    uint32_t header[2];
+    if (artifact.size() - position < sizeof(header)) return false;
+    memcpy(header, &artifact[position], sizeof(header));
+    position += sizeof(header);
+    if (header[1] != sizeof(T) || (artifact.size() - position) / sizeof(T) < header[0]) return false;
+    items.resize(header[0]);
+    memcpy((void*)items.data(), &artifact[position], (size_t)header[0] * sizeof(T));
+    position += (size_t)header[0] * sizeof(T);
+    return true;
+}
+
+// --- Heatshrink-compatible LZSS decoder ---
+// Bitstream is MSB first: tag 1 + 8-bit literal, or tag 0 + (index - 1) in windowBits
+// + (count - 1) in lookaheadBits. Back-references point into the already decoded output,
+// which is why blocks are self-contained. Returns the number of bytes produced.
+static uint32_t _lzssDecode(const uint8_t* input, uint32_t inputLength, uint8_t* output, uint32_t outputLength,
+                            uint8_t windowBits, uint8_t lookaheadBits) {
+    uint32_t bitPos = 0;
+    const uint32_t totalBits = inputLength * 8;
+    auto getBits = [&](uint8_t count, uint32_t& value) -> bool {
+        if (bitPos + count > totalBits) return false;
+        value = 0;
+        for (uint8_t i = 0; i < count; ++i, ++bitPos) {
+            value = (value << 1) | ((input[bitPos >> 3] >> (7 - (bitPos & 7))) & 1);
+        }
+        return true;
+    };
+
+    uint32_t produced = 0;
+    uint32_t tag, value, count;
+    while (produced < outputLength && getBits(1, tag)) {
+        if (tag) {
+            if (!getBits(8, value)) break;
+            output[produced++] = (uint8_t)value;
+        } else {
+            if (!getBits(windowBits, value) || !getBits(lookaheadBits, count)) break;
+            uint32_t distance = value + 1;
+            count += 1;
+            if (distance > produced) break; // Corrupt reference
+            for (; count > 0 && produced < outputLength; --count, ++produced) {
+                output[produced] = output[produced - distance];
+            }
+        }
+    }
+    return produced;
+}
+
 ESP32MidiPlayer::ESP32MidiPlayer(FS& filesystem) : _fs(filesystem) {
+    _positionSeq[0].store(0, std::memory_order_relaxed);
+    _positionSeq[1].store(0, std::memory_order_relaxed);
     // Initialize default state
     _resetPlaybackState();
+    _publishPosition();
 }
 
 ESP32MidiPlayer::~ESP32MidiPlayer() {
-    stop(); // Ensure file is closed if open
+    // Only release resources: unlike stop(), no clock message and no position publish, so the
+    // time source and sinks may already be gone
+    _stopPrefetch();
+    _releaseTrackPins();
+    if (_midiFile) _midiFile.close();
+    delete[] _activeNotes;
+    delete[] _routeBatches;
+    delete[] _inputQueue;
+}
+
+// --- Time Source ---
+MidiSystemTimeSource& MidiSystemTimeSource::instance() {
+    static MidiSystemTimeSource source;
+    return source;
+}
+
+uint64_t MidiSystemTimeSource::nowMicros() {
+#if defined(ESP32)
+    return (uint64_t)esp_timer_get_time();
+#else
+    // Callers on other tasks/ISRs (e.g. sendInput()) may pass a slightly older reading: only a
+    // reading more than half the range behind counts as a wrap, and the last value only moves forward
+    uint64_t last = _micros.load(std::memory_order_relaxed);
+    uint64_t value = (last & ~0xFFFFFFFFULL) | micros();
+    if (value + 0x80000000ULL < last) value += 1ULL << 32; // micros() wrapped
+    while (value > last && !_micros.compare_exchange_weak(last, value, std::memory_order_relaxed)) {}
+    return value;
+#endif
+}
+
+void ESP32MidiPlayer::setTimeSource(MidiTimeSource* source) {
+    _timeSource = source ? source : &MidiSystemTimeSource::instance();
 }
 
+MidiTimeSource* ESP32MidiPlayer::getTimeSource() const { return _timeSource; }
+
 // --- Configuration ---
 void ESP32MidiPlayer::setLogCallback(LogCallback callback) { _logCallback = callback; }
 void ESP32MidiPlayer::setLogLevel(MidiLogLevel level) { _currentLogLevel = level; } // Added
@@ -51,6 +204,193 @@ void ESP32MidiPlayer::setTempoChangeCallback(TempoChangeCallback callback) { _te
 void ESP32MidiPlayer::setTimeSignatureCallback(TimeSignatureCallback callback) { _timeSignatureCallback = callback; }
 void ESP32MidiPlayer::setEndOfTrackCallback(EndOfTrackCallback callback) { _endOfTrackCallback = callback; }
 void ESP32MidiPlayer::setPlaybackCompleteCallback(PlaybackCompleteCallback callback) { _playbackCompleteCallback = callback; }
+void ESP32MidiPlayer::setPortSink(uint8_t port, MidiEventSink* sink) {
+    if (port < MIDI_MAX_PORTS) _portSinks[port] = sink;
+    else _log(MidiLogLevel::WARN, "Port %u exceeds MIDI_MAX_PORTS (%u), sink ignored.", port, MIDI_MAX_PORTS);
+}
+void ESP32MidiPlayer::setDefaultSink(MidiEventSink* sink) { _defaultSink = sink; }
+
+void ESP32MidiPlayer::setPrefetch(uint32_t aheadBytes) { _prefetchAhead = aheadBytes; }
+void ESP32MidiPlayer::setReadLatencyMicros(uint32_t micros) { _readLatencyMicros = micros; }
+void ESP32MidiPlayer::setLazyTrackDiscovery(bool enabled) { _lazyTrackDiscovery = enabled; }
+
+void ESP32MidiPlayer::setBlockCache(MidiBlockCache* cache) {
+    _releaseTrackPins();
+    _blockCache = cache;
+}
+
+void ESP32MidiPlayer::setSongCache(MidiSongCache* cache) { _songCache = cache; }
+
+bool ESP32MidiPlayer::addRoute(uint8_t track, uint16_t channelMask, MidiEventSink* sink) {
+    if (!sink || !channelMask) return false;
+    uint8_t index = 0;
+    while (index < MIDI_MAX_ROUTE_SINKS && _routeSinks[index] && _routeSinks[index] != sink) index++;
+    if (index >= MIDI_MAX_ROUTE_SINKS) {
+        _log(MidiLogLevel::WARN, "More than MIDI_MAX_ROUTE_SINKS (%u) sinks routed, route ignored.", MIDI_MAX_ROUTE_SINKS);
+        return false;
+    }
+    _routeSinks[index] = sink;
+    _routeRules.push_back({track, channelMask, index});
+    _compileRoutes();
+    return true;
+}
+
+void ESP32MidiPlayer::removeRoutes(MidiEventSink* sink) {
+    for (uint8_t index = 0; index < MIDI_MAX_ROUTE_SINKS; ++index) {
+        if (!sink || _routeSinks[index] != sink) continue;
+        _flushRouteBatches();
+        _routeSinks[index] = nullptr;
+        _routeRules.erase(std::remove_if(_routeRules.begin(), _routeRules.end(),
+                                         [index](const RouteRule& rule) { return rule.sink == index; }),
+                          _routeRules.end());
+    }
+    _compileRoutes();
+}
+
+void ESP32MidiPlayer::clearRoutes() {
+    _flushRouteBatches();
+    _routeRules.clear();
+    for (uint8_t index = 0; index < MIDI_MAX_ROUTE_SINKS; ++index) _routeSinks[index] = nullptr;
+    _compileRoutes();
+}
+
+void ESP32MidiPlayer::setRouteBatching(bool enabled) {
+    if (enabled && !_routeBatches) {
+        _routeBatches = new RouteBatch[MIDI_MAX_ROUTE_SINKS];
+        for (uint8_t index = 0; index < MIDI_MAX_ROUTE_SINKS; ++index) _routeBatches[index].count = 0;
+    } else if (!enabled && _routeBatches) {
+        _flushRouteBatches();
+        delete[] _routeBatches;
+        _routeBatches = nullptr;
+    }
+}
+
+// Expands the rules into one sink mask per track/channel so dispatch never walks the rules.
+// Live input gets the row after the file's tracks.
+void ESP32MidiPlayer::_compileRoutes() {
+    _routeTable.assign(_routeRules.empty() ? 0 : (_tracks.size() + 1) * 16, 0);
+    for (const RouteRule& rule : _routeRules) {
+        for (size_t track = 0; track <= _tracks.size(); ++track) {
+            uint8_t id = (track == _tracks.size()) ? MIDI_INPUT_TRACK : (uint8_t)track;
+            if (rule.track != 0xFF && rule.track != id) continue;
+            for (uint8_t ch = 0; ch < 16; ++ch) {
+                if (rule.channelMask & (1 << ch)) _routeTable[track * 16 + ch] |= (RouteMask)1 << rule.sink;
+            }
+        }
+    }
+}
+
+void ESP32MidiPlayer::_flushRouteBatches() {
+    if (!_routeBatches) return;
+    for (uint8_t index = 0; index < MIDI_MAX_ROUTE_SINKS; ++index) {
+        RouteBatch& batch = _routeBatches[index];
+        if (batch.count == 0) continue;
+        if (_routeSinks[index]) _routeSinks[index]->onMidiEventBatch(batch.events, batch.count);
+        batch.count = 0;
+    }
+}
+
+void ESP32MidiPlayer::setLiveInputEnabled(bool enabled) {
+    if (enabled && !_inputQueue) {
+        _inputQueue = new InputMessage[MIDI_INPUT_QUEUE_SIZE];
+        _inputHead.store(0, std::memory_order_relaxed);
+        _inputTail.store(0, std::memory_order_relaxed);
+    } else if (!enabled && _inputQueue) {
+        delete[] _inputQueue;
+        _inputQueue = nullptr;
+    }
+}
+
+bool ESP32MidiPlayer::sendInput(uint8_t status, uint8_t data1, uint8_t data2, uint8_t port) {
+    if (!_inputQueue || status < 0x80 || status >= 0xF0) return false;
+    uint32_t head = _inputHead.load(std::memory_order_relaxed);
+    if (head - _inputTail.load(std::memory_order_acquire) >= MIDI_INPUT_QUEUE_SIZE) {
+        _inputOverflows.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    InputMessage& message = _inputQueue[head & (MIDI_INPUT_QUEUE_SIZE - 1)];
+    message.arrivalMicros = _now();
+    message.status = status;
+    message.data1 = data1 & 0x7F;
+    message.data2 = data2 & 0x7F;
+    message.port = port;
+    _inputHead.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+MidiInputStats ESP32MidiPlayer::getInputStats() const {
+    MidiInputStats stats = _inputStats;
+    stats.overflows = _inputOverflows.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void ESP32MidiPlayer::resetInputStats() {
+    _inputStats = MidiInputStats();
+    _inputOverflows.store(0, std::memory_order_relaxed);
+}
+
+// Live messages go out ahead of anything still due from the file, and their batches are flushed
+// right away (what the file already put in them is older, so order per sink is kept).
+void ESP32MidiPlayer::_drainInput() {
+    uint32_t tail = _inputTail.load(std::memory_order_relaxed);
+    uint32_t head = _inputHead.load(std::memory_order_acquire);
+    if (tail == head) return;
+
+    bool playing = _state == PlaybackState::PLAYING;
+    MidiEvent event;
+    event.tick = _currentTick;
+    event.track = MIDI_INPUT_TRACK;
+    for (uint32_t i = tail; i != head; ++i) {
+        const InputMessage& message = _inputQueue[i & (MIDI_INPUT_QUEUE_SIZE - 1)];
+        event.status = message.status;
+        event.data1 = message.data1;
+        event.data2 = message.data2;
+        event.port = message.port;
+        // Song time at arrival: _positionMicros was reached at wall time _lastEventMicros
+        event.micros = _positionMicros;
+        if (playing) {
+            int64_t offset = (int64_t)(message.arrivalMicros - _lastEventMicros);
+            if (_playbackRate != 1.0) offset = (int64_t)(offset * _playbackRate);
+            event.micros = (offset < 0 && (uint64_t)-offset > _positionMicros) ? 0 : _positionMicros + offset;
+        }
+        _dispatchEvent(event);
+    }
+    _flushRouteBatches();
+
+    uint64_t sent = _now();
+    for (uint32_t i = tail; i != head; ++i) {
+        uint64_t latency = sent - _inputQueue[i & (MIDI_INPUT_QUEUE_SIZE - 1)].arrivalMicros;
+        _inputStats.events++;
+        _inputStats.totalLatencyMicros += latency;
+        if (latency > _inputStats.maxLatencyMicros) _inputStats.maxLatencyMicros = (latency > UINT32_MAX) ? UINT32_MAX : (uint32_t)latency;
+    }
+    _inputTail.store(head, std::memory_order_release);
+}
+
+void ESP32MidiPlayer::setLyricIndexEnabled(bool enabled) { _lyricIndexEnabled = enabled; }
+void ESP32MidiPlayer::setNoteIndexEnabled(bool enabled) { _noteIndexEnabled = enabled; }
+void ESP32MidiPlayer::setMeterMapEnabled(bool enabled) { _meterMapEnabled = enabled; }
+
+void ESP32MidiPlayer::setSeekIndexEnabled(bool enabled, uint32_t intervalMicros) {
+    _seekIndexEnabled = enabled;
+    _seekIndexInterval = intervalMicros ? intervalMicros : 5000000;
+}
+
+uint32_t ESP32MidiPlayer::getSeekCheckpointCount() const { return _seekCheckpoints.size(); }
+
+void ESP32MidiPlayer::setActiveNoteTrackingEnabled(bool enabled) {
+    if (enabled && !_activeNotes) {
+        _activeNotes = new MidiActiveNotes[3]();
+        _activeNotesDirty[0] = _activeNotesDirty[1] = 0;
+        _activeNotesChanged = false;
+        _activeNotesSeq[0].store(0, std::memory_order_relaxed);
+        _activeNotesSeq[1].store(0, std::memory_order_relaxed);
+        _activeNotesFront.store(0, std::memory_order_release);
+    } else if (!enabled && _activeNotes) {
+        delete[] _activeNotes;
+        _activeNotes = nullptr;
+    }
+}
 
 
 // --- File Handling & Playback Control ---
@@ -58,16 +398,50 @@ void ESP32MidiPlayer::setPlaybackCompleteCallback(PlaybackCompleteCallback callb
 void ESP32MidiPlayer::_resetPlaybackState() {
     _state = PlaybackState::STOPPED;
     _currentTick = 0;
-    _microsecondsPerQuarterNote = 500000; // Reset tempo to 120 BPM
+    _microsecondsPerQuarterNote = DEFAULT_TEMPO; // Reset tempo to 120 BPM
+    _fileTempo = DEFAULT_TEMPO;
     _playbackStartMicros = 0;
     _lastEventMicros = 0;
+    _lastEventRemainder = 0;
+    _positionRemainder = 0;
     _pauseStartMicros = 0;
+    _positionMicros = 0;
     _tracks.clear();
+    _container = MidiContainer::SMF;
+    _sourceSize = 0;
+    _dataOffset = 0;
+    _dataSize = 0;
+    _blockCount = 0;
+    for (auto& window : _windows) window = ReadWindow();
+    _windowData.clear();
+    _windowData.shrink_to_fit();
+    _compressedBlock.clear();
+    _compressedBlock.shrink_to_fit();
     _finishedTracks = 0;
     _format = 0;
     _trackCount = 0;
+    _tracksFound = 0;
+    _nextChunkOffset = 0;
     _division = 96; // Default TPQN
 
+    // Drop load-time indexes, keeping a single default tempo entry so conversions always work
+    _tempoMap.clear();
+    _tempoMap.push_back({0, 0, DEFAULT_TEMPO});
+    _lyricSyllables.clear();
+    _lyricLines.clear();
+    _lyricPool.clear();
+    _noteIntervals.clear();
+    _noteMaxEnd.clear();
+    _meterMap.clear();
+    _meterMap.push_back({0, 0, 4, 2});
+    _seekCheckpoints.clear();
+    _seekTrackStates.clear();
+    _seekChasePool.clear();
+    _quantizedActionCount = 0;
+    _currentPattern = -1;
+    _patternQueueCount = 0;
+    memset(_droppedKeys, 0, sizeof(_droppedKeys));
+
     // Reset track-specific info
     for (auto& track : _tracks) {
         track.currentOffset = track.startOffset;
@@ -79,6 +453,7 @@ void ESP32MidiPlayer::_resetPlaybackState() {
 
 bool ESP32MidiPlayer::load(const char* filename) {
     stop(); // Stop any current playback and close the file
+    _tempoPoints.clear(); // Automation ticks belong to the previous file
 
     _filename = filename;
     _midiFile = _fs.open(filename, FILE_READ);
@@ -88,6 +463,13 @@ bool ESP32MidiPlayer::load(const char* filename) {
         return false;
     }
     _log(MidiLogLevel::INFO, "Opened MIDI file: %s (Size: %u)", filename, _midiFile.size());
+    _cacheFileId = MidiBlockCache::fileIdFor(filename, _midiFile.size());
+
+    if (!_openContainer()) {
+        _log(MidiLogLevel::ERROR, "Unsupported or corrupt MIDI container.");
+        stop(); // Close file
+        return false;
+    }
 
     if (!_parseFileHeader()) {
         _log(MidiLogLevel::ERROR, "Invalid MIDI file header.");
@@ -101,7 +483,27 @@ bool ESP32MidiPlayer::load(const char* filename) {
         return false;
     }
 
-    _log(MidiLogLevel::INFO, "MIDI File Loaded: Format %u, Tracks %u, TPQN %u", _format, _trackCount, _division);
+    // The load-time indexes, the prefetch rings and format 2 patterns need the whole track table
+    bool needAllTracks = _lyricIndexEnabled || _noteIndexEnabled || _meterMapEnabled || _seekIndexEnabled ||
+                         _prefetchAhead > 0 || _format == 2;
+    if (needAllTracks && !_discoverTracks(_trackCount)) {
+        _log(MidiLogLevel::ERROR, "Failed to find or parse track chunks.");
+        stop(); // Close file
+        return false;
+    }
+
+    if (!_buildLoadIndexes()) {
+        _log(MidiLogLevel::ERROR, "Failed to build load-time indexes.");
+        stop(); // Close file
+        return false;
+    }
+    _compileRoutes(); // Routes may name tracks of the new file
+
+    if (_prefetchAhead > 0 && !_startPrefetch()) {
+        _log(MidiLogLevel::WARN, "Prefetch unavailable, reading synchronously.");
+    }
+
+    _log(MidiLogLevel::INFO, "MIDI File Loaded: Format %u, Tracks %u (%u located), TPQN %u", _format, _trackCount, _tracksFound, _division);
     _state = PlaybackState::STOPPED; // Ready to play
     return true;
 }
@@ -112,26 +514,29 @@ void ESP32MidiPlayer::play() {
         return;
     }
 
-    uint64_t now = micros();
+    uint64_t now = _now();
 
     if (_state == PlaybackState::STOPPED) {
-        _log(MidiLogLevel::DEBUG, "Starting playback from beginning.");
-        _currentTick = 0;
-        _finishedTracks = 0;
-        // Reset track positions and next event times
-        for (size_t i = 0; i < _tracks.size(); ++i) {
-             auto& track = _tracks[i];
-             track.currentOffset = track.startOffset;
-             track.lastStatusByte = 0;
-             track.endOfTrackReached = false;
-             // Read the first delta time for this track
-             uint32_t initialDeltaOffset = track.currentOffset;
-             track.nextEventTick = _readVariableLengthQuantity(track.currentOffset);
-             _log(MidiLogLevel::DEBUG, "T%d Initial delta %llu (read at offset %u, next offset %u)", i, track.nextEventTick, initialDeltaOffset, track.currentOffset);
+        if (_tracksPrimed) {
+            _log(MidiLogLevel::DEBUG, "Starting playback from tick %llu.", _currentTick);
+        } else {
+            _log(MidiLogLevel::DEBUG, "Starting playback from beginning.");
+            _rewindTracks();
+            if (!_midiFile) return; // Reading the first deltas failed
         }
+        _tracksPrimed = false;
         _playbackStartMicros = now;
         _lastEventMicros = now;
+        _lastEventRemainder = 0;
         _state = PlaybackState::PLAYING;
+        _resyncMtcOutput();
+        _resyncMidiClock();
+        if (_currentTick == 0) {
+            _sendMidiClock(0xFA); // Start
+        } else {
+            _sendSongPosition();
+            _sendMidiClock(0xFB); // Continue
+        }
         _log(MidiLogLevel::INFO, "Playback started.");
     } else if (_state == PlaybackState::PAUSED) {
         // Adjust timing based on pause duration
@@ -139,103 +544,1563 @@ void ESP32MidiPlayer::play() {
         _playbackStartMicros += pausedDuration; // Effectively shift start time forward
         _lastEventMicros += pausedDuration;     // Shift last event time forward too
         _state = PlaybackState::PLAYING;
+        _resyncMtcOutput();
+        _sendMidiClock(0xFB); // Continue
         _log(MidiLogLevel::INFO, "Playback resumed after %llu us pause.", pausedDuration);
     } else if (_state == PlaybackState::PLAYING) {
         _log(MidiLogLevel::WARN, "Play command received while already playing.");
     }
+    _publishPosition();
+}
+
+void ESP32MidiPlayer::pause() {
+    if (_state == PlaybackState::PLAYING) {
+        _state = PlaybackState::PAUSED;
+        _pauseStartMicros = _now();
+        _sendMidiClock(0xFC); // Stop
+        _publishPosition();
+        _log(MidiLogLevel::INFO, "Playback paused at tick %lu.", (uint32_t)_currentTick);
+        // Optional: Send All Notes Off / All Sound Off CC messages if desired
+        // for (uint8_t ch = 0; ch < 16; ++ch) {
+        //     if (_controlChangeCallback) _controlChangeCallback(ch, 123, 0); // All notes off
+        //     if (_controlChangeCallback) _controlChangeCallback(ch, 120, 0); // All sound off
+        // }
+    } else {
+         _log(MidiLogLevel::WARN, "Pause command received but not playing.");
+    }
+}
+
+void ESP32MidiPlayer::resume() {
+    if (_state == PlaybackState::PAUSED) {
+        play(); // Same logic for resuming as starting from paused state
+    } else {
+         _log(MidiLogLevel::WARN, "Resume command received but not paused.");
+    }
+}
+
+void ESP32MidiPlayer::stop() {
+    bool wasPlaying = (_state != PlaybackState::STOPPED);
+    if (_state == PlaybackState::PLAYING) _sendMidiClock(0xFC); // Stop
+    _stopPrefetch();
+    _releaseTrackPins();
+    if (_midiFile) {
+        _midiFile.close();
+        if (wasPlaying) _log(MidiLogLevel::INFO, "MIDI file closed due to stop.");
+        else _log(MidiLogLevel::DEBUG, "MIDI file closed."); // Might be closed during load error etc.
+    }
+    _filename = "";
+    _resetPlaybackState(); // Resets state to STOPPED among other things
+    _tracksPrimed = false;
+    _mtcRxRunning = false;
+    _previewStartMicros = 0; // The preview window and fade go together
+    _previewEndMicros = 0;
+    _previewFadeMicros = 0;
+    _publishPosition();
+    if (_activeNotes) {
+        // Readers should see every key released
+        for (uint8_t ch = 0; ch < 16; ++ch) _clearActiveNotes(ch);
+        _publishActiveNotes();
+    }
+
+     if (wasPlaying) {
+        _log(MidiLogLevel::INFO, "Playback stopped.");
+        // Optional: Send All Notes Off / All Sound Off CC messages
+        // for (uint8_t ch = 0; ch < 16; ++ch) {
+        //     if (_controlChangeCallback) _controlChangeCallback(ch, 123, 0); // All notes off
+        //     if (_controlChangeCallback) _controlChangeCallback(ch, 120, 0); // All sound off
+        // }
+     }
+}
+
+// --- Main Loop Update ---
+
+void ESP32MidiPlayer::tick() {
+    if (_state != PlaybackState::PLAYING) {
+        _lastTickCallMicros = 0;
+        if (_inputQueue) { // Thru keeps working while stopped or paused
+            _drainInput();
+            if (_activeNotes) _publishActiveNotes();
+        }
+        return; // Only process if playing
+    }
+
+    // Account wall time between calls for the duty cycle statistics
+    uint64_t callMicros = _now();
+    if (_lastTickCallMicros != 0) _idleStats.wallMicros += (uint32_t)(callMicros - _lastTickCallMicros);
+    _lastTickCallMicros = callMicros;
+
+    // Timecode we are chasing has stopped: stop with it
+    if (_mtcFollow && _mtcRxRunning && callMicros - _mtcRxLastMicros > MTC_DROPOUT_MICROS) {
+        _mtcRxRunning = false;
+        _log(MidiLogLevel::INFO, "MTC stopped, pausing.");
+        pause();
+        return;
+    }
+
+    // Lazy load: keep completing the track table before dispatching
+    if (_tracksFound < _trackCount && !_discoverTracks(MIDI_DISCOVERY_CHUNKS_PER_TICK)) {
+        _log(MidiLogLevel::ERROR, "Failed to find track chunk %u, stopping.", _tracksFound);
+        stop();
+        return;
+    }
+
+    // 1. Advance Tick Time based on the time source. Until _lastEventMicros is more than the
+    //    threshold behind, nothing can be that late and the lateness check is skipped.
+    _dropLateNotes = false;
+    if (callMicros > _lastEventMicros + _maxLateMicros) _handleLateness(callMicros);
+    _advanceTickTime();
+    if (_previewEndMicros && _positionMicros >= _previewEndMicros) {
+        _silenceOutput(); // Preview over: cut the held notes too
+        _finishPlayback();
+        return;
+    }
+    _serviceMtcOutput();
+    if (_midiClockCallback) {
+        while (_clockNextPulse * _division <= _currentTick * 24) {
+            _sendMidiClock(0xF8);
+            _clockNextPulse++;
+        }
+    }
+
+    // 2. Process all events (and quantized actions) scheduled up to the current tick, in tick order
+    uint32_t events = 0;
+    while (true) {
+        if (_inputQueue) _drainInput(); // Live input never waits behind a burst of file events
+        int nextTrackIdx = _findTrackWithNextEvent();
+
+        // An action runs ahead of the events on its boundary
+        if (_quantizedActionCount > 0 && _quantizedActions[0].tick <= _currentTick &&
+            (nextTrackIdx < 0 || _quantizedActions[0].tick <= _tracks[nextTrackIdx].nextEventTick)) {
+            _runQuantizedAction();
+            if (_state != PlaybackState::PLAYING) break; // The action paused or stopped playback
+            continue;
+        }
+
+        // If no track has an event ready (or all tracks finished)
+        if (nextTrackIdx < 0) {
+            _log(MidiLogLevel::VERBOSE, "Tick %llu: No tracks ready.", _currentTick); // Usually too noisy
+            if (_trackCount > 0 && _finishedTracks >= _trackCount) _finishPlayback(); // e.g. seeked past the end
+            break; // No tracks have events scheduled
+        }
+
+        // Check if the *earliest* event is actually due yet
+        if (_tracks[nextTrackIdx].nextEventTick > _currentTick) {
+            // _log(MidiLogLevel::VERBOSE, "Tick %llu: Earliest event on T%d is at tick %llu, not due yet.", _currentTick, nextTrackIdx, _tracks[nextTrackIdx].nextEventTick);
+            break; // No more events ready at this exact moment
+        }
+
+        // Process the event from the chosen track
+        // _log(MidiLogLevel::DEBUG, "Tick %llu: Processing event for T%d scheduled at tick %llu", _currentTick, nextTrackIdx, _tracks[nextTrackIdx].nextEventTick);
+        _processNextEvent(); // This function finds the track internally again
+        if (_blockCache) _updateTrackPin(_tracks[nextTrackIdx]);
+
+         // Check if all tracks are finished AFTER processing an event (format 2: chain the next pattern)
+        if (_finishedTracks >= _trackCount && !(_format == 2 && _midiFile && _nextPattern(_tracks[_currentPattern].nextEventTick))) {
+             _finishPlayback();
+             break; // Exit the while loop
+        }
+
+        // Out of budget: leave the rest for the next call (it stays due, nothing is skipped)
+        events++;
+        if ((_tickBudgetEvents && events >= _tickBudgetEvents) ||
+            (_tickBudgetMicros && _now() - callMicros >= _tickBudgetMicros)) {
+            int pending = _findTrackWithNextEvent();
+            if (pending >= 0 && _tracks[pending].nextEventTick <= _currentTick) {
+                uint64_t units = _tempoUnits(_tracks[pending].nextEventTick, _currentTick);
+                if (_playbackRate != 1.0) units = (uint64_t)(units / _playbackRate);
+                uint64_t backlog = _now() - _lastEventMicros + units / _division;
+                _tickStats.budgetHits++;
+                if (backlog > _tickStats.maxBacklogMicros) _tickStats.maxBacklogMicros = (backlog > UINT32_MAX) ? UINT32_MAX : (uint32_t)backlog;
+            }
+            break;
+        }
+    }
+
+    // 3. Hand batched events to their sinks, let other cores see the key state as of this tick
+    _flushRouteBatches();
+    if (_activeNotes) _publishActiveNotes();
+    if (_state == PlaybackState::PLAYING) _publishPosition(); // Otherwise stop()/pause() already did
+
+    uint32_t tickMicros = (uint32_t)(_now() - callMicros);
+    _tickStats.ticks++;
+    if (tickMicros > _tickStats.maxTickMicros) _tickStats.maxTickMicros = tickMicros;
+    if (events > _tickStats.maxEventsPerTick) _tickStats.maxEventsPerTick = events;
+}
+
+void ESP32MidiPlayer::_finishPlayback() {
+    _flushRouteBatches();
+    _log(MidiLogLevel::INFO, "All tracks finished.");
+    if (_playbackCompleteCallback) {
+        _playbackCompleteCallback();
+    }
+    stop(); // Stop playback automatically
+}
+
+// Resets every track to its first event (used when starting from the beginning and for backward seeks)
+void ESP32MidiPlayer::_rewindTracks() {
+    _currentTick = 0;
+    _positionMicros = 0;
+    _positionRemainder = 0;
+    _finishedTracks = 0;
+    _fileTempo = DEFAULT_TEMPO;
+    _updateTempo();
+    // Reset track positions and next event times
+    for (size_t i = 0; i < _tracks.size(); ++i) {
+         auto& track = _tracks[i];
+         if (i >= _tracksFound) {
+             track.endOfTrackReached = true; // Joins in when tick() locates it
+             continue;
+         }
+         track.currentOffset = track.startOffset;
+         if (_prefetchRings) _resetPrefetchRing(i, track.startOffset);
+         track.lastStatusByte = 0;
+         track.endOfTrackReached = false;
+         track.port = 0;
+         track.channelPrefix = 0xFF;
+         // Read the first delta time for this track
+         uint32_t initialDeltaOffset = track.currentOffset;
+         track.nextEventTick = _readVariableLengthQuantity(track.currentOffset);
+         if (!_midiFile) return;
+         if (_blockCache) _updateTrackPin(track);
+         _log(MidiLogLevel::DEBUG, "T%d Initial delta %llu (read at offset %u, next offset %u)", i, track.nextEventTick, initialDeltaOffset, track.currentOffset);
+    }
+
+    if (_format == 2 && !_tracks.empty()) { // One pattern at a time: the others wait as if ended
+        _meterMap.assign(1, {0, 0, 4, 2}); // Rebuilt from the patterns as they play
+        for (auto& track : _tracks) track.endOfTrackReached = true;
+        _finishedTracks = _trackCount;
+        _currentPattern = -1;
+        uint16_t first = 0;
+        if (_patternQueueCount > 0) {
+            first = _patternQueue[0];
+            _patternQueueCount--;
+            memmove(_patternQueue, _patternQueue + 1, _patternQueueCount * sizeof(_patternQueue[0]));
+        }
+        _startPattern(first, 0, false);
+    }
+}
+
+// --- Format 2 Patterns ---
+
+uint16_t ESP32MidiPlayer::getPatternCount() const { return (_format == 2) ? _trackCount : 0; }
+int32_t ESP32MidiPlayer::getCurrentPattern() const { return (_format == 2) ? _currentPattern : -1; }
+
+bool ESP32MidiPlayer::queuePattern(uint16_t pattern) {
+    if (_format != 2 || pattern >= _trackCount || _patternQueueCount >= MIDI_MAX_QUEUED_PATTERNS) return false;
+    _patternQueue[_patternQueueCount++] = pattern;
+    return true;
+}
+
+void ESP32MidiPlayer::clearPatternQueue() { _patternQueueCount = 0; }
+void ESP32MidiPlayer::setPatternLoop(bool enabled) { _patternLoop = enabled; }
+
+uint64_t ESP32MidiPlayer::switchPattern(uint16_t pattern, MidiQuantize quantize) {
+    if (_format != 2 || pattern >= _trackCount) return UINT64_MAX;
+    return _scheduleQuantized(quantize, nullptr, pattern);
+}
+
+bool ESP32MidiPlayer::_startPattern(uint16_t pattern, uint64_t tick, bool cut) {
+    if (_currentPattern >= 0) {
+        TrackInfo& current = _tracks[_currentPattern];
+        if (!current.endOfTrackReached) {
+            current.endOfTrackReached = true;
+            _finishedTracks++;
+        }
+        if (cut) _silenceOutput(); // Its held notes would never get their Note Offs
+    }
+    TrackInfo& track = _tracks[pattern];
+    track.currentOffset = track.startOffset;
+    if (_prefetchRings) _resetPrefetchRing(pattern, track.startOffset);
+    track.lastStatusByte = 0;
+    track.port = 0;
+    track.channelPrefix = 0xFF;
+    track.endOfTrackReached = false;
+    _finishedTracks--;
+    track.nextEventTick = tick + _readVariableLengthQuantity(track.currentOffset);
+    if (!_midiFile) return false;
+    if (_blockCache) _updateTrackPin(track);
+    _currentPattern = pattern;
+    _patternStartTick = tick;
+    _log(MidiLogLevel::INFO, "Pattern %u starts at tick %llu.", pattern, tick);
+    return true;
+}
+
+bool ESP32MidiPlayer::_nextPattern(uint64_t tick) {
+    uint16_t next;
+    if (_patternQueueCount > 0) {
+        next = _patternQueue[0];
+        _patternQueueCount--;
+        memmove(_patternQueue, _patternQueue + 1, _patternQueueCount * sizeof(_patternQueue[0]));
+    } else if (_patternLoop && tick > _patternStartTick) { // An empty pattern would loop without time passing
+        next = (uint16_t)_currentPattern;
+    } else if (_currentPattern + 1 < (int32_t)_trackCount) {
+        next = (uint16_t)(_currentPattern + 1);
+    } else {
+        return false;
+    }
+    return _startPattern(next, tick, false);
+}
+
+// --- Seeking ---
+
+bool ESP32MidiPlayer::seekTick(uint64_t tick) { return _seek(tick, false); }
+bool ESP32MidiPlayer::seekMicros(uint64_t micros) { return _seek(micros, true); }
+
+void ESP32MidiPlayer::setPlaybackRate(float rate) {
+    if (rate < 0.1f) rate = 0.1f;
+    if (rate > 10.0f) rate = 10.0f;
+    if (_state == PlaybackState::PLAYING) _advanceTickTime(); // Time so far runs at the old rate
+    _playbackRate = rate;
+}
+
+float ESP32MidiPlayer::getPlaybackRate() const { return (float)_playbackRate; }
+
+void ESP32MidiPlayer::setLatePolicy(MidiLatePolicy policy, uint32_t maxLateMicros) {
+    _latePolicy = policy;
+    _maxLateMicros = maxLateMicros;
+}
+
+MidiLateStats ESP32MidiPlayer::getLateStats() const { return _lateStats; }
+void ESP32MidiPlayer::resetLateStats() { _lateStats = MidiLateStats(); }
+
+void ESP32MidiPlayer::setTickBudget(uint32_t maxMicros, uint16_t maxEvents) {
+    _tickBudgetMicros = maxMicros;
+    _tickBudgetEvents = maxEvents;
+}
+
+MidiTickStats ESP32MidiPlayer::getTickStats() const { return _tickStats; }
+void ESP32MidiPlayer::resetTickStats() { _tickStats = MidiTickStats(); }
+
+// Fast-forwards the tracks to 'target' without sounding notes, then sends the chased state.
+// Backward seeks rewind to the start first; forward seeks continue from the current position.
+bool ESP32MidiPlayer::_seek(uint64_t target, bool targetIsMicros) {
+    if (!_midiFile) {
+        _log(MidiLogLevel::ERROR, "No MIDI file loaded, cannot seek.");
+        return false;
+    }
+    if (_format == 2) {
+        _log(MidiLogLevel::WARN, "Format 2 plays by pattern and cannot seek; use queuePattern() / switchPattern().");
+        return false;
+    }
+    uint32_t seekStart = _now();
+    bool primed = (_state != PlaybackState::STOPPED) || _tracksPrimed;
+    if (primed) _silenceOutput();
+
+    // Chasing needs every track; tracks found just now start from their beginning, so rewind
+    bool complete = (_tracksFound == _trackCount);
+    if (!complete && !_discoverTracks(_trackCount)) {
+        _log(MidiLogLevel::ERROR, "Failed to find track chunk %u, cannot seek.", _tracksFound);
+        stop();
+        return false;
+    }
+
+    uint64_t current = targetIsMicros ? _positionMicros : _currentTick;
+    bool rewind = !primed || !complete || target < current;
+    _chase.clear();
+    if (!_restoreCheckpoint(target, targetIsMicros, current, rewind) && rewind) {
+        _rewindTracks();
+        if (!_midiFile) return false;
+    }
+
+    uint64_t tick = _currentTick;
+    uint64_t position = _positionMicros;
+    uint32_t remainder = _positionRemainder;
+    _chasing = true;
+    bool chased = _chaseTo(target, targetIsMicros, tick, position, remainder);
+    _chasing = false;
+    if (!chased) return false;
+    if (_prefetchRings) _syncPrefetchRings();
+
+    // Land exactly on the target; events at the target itself are left for tick()
+    if (targetIsMicros) {
+        uint64_t usedUnits;
+        tick += _walkTempo(tick, (target - position) * _division - remainder, usedUnits);
+        position = target;
+        remainder = 0;
+    } else {
+        uint64_t units = _tempoUnits(tick, target) + remainder;
+        position += units / _division;
+        remainder = units % _division;
+        tick = target;
+    }
+    _currentTick = tick;
+    _positionMicros = position;
+    _updateTempo();
+
+    _emitChaseState(tick);
+    _flushRouteBatches();
+    if (_blockCache) {
+        for (auto& track : _tracks) _updateTrackPin(track);
+    }
+    if (_tempoChangeCallback) _tempoChangeCallback(_microsecondsPerQuarterNote);
+
+    uint64_t now = _now();
+    _lastEventMicros = now;
+    _lastEventRemainder = 0;
+    _positionRemainder = remainder;
+    if (_state == PlaybackState::PAUSED) _pauseStartMicros = now;
+    if (_state == PlaybackState::STOPPED) _tracksPrimed = true;
+    if (_state == PlaybackState::PLAYING) {
+        _resyncMtcOutput();
+        _sendMidiClock(0xFC); // Receivers only accept a song position while stopped
+    }
+    _resyncMidiClock();
+    _sendSongPosition();
+    if (_state == PlaybackState::PLAYING) _sendMidiClock(0xFB);
+    memset(_droppedKeys, 0, sizeof(_droppedKeys)); // Their Note Offs were skipped over
+    _publishPosition();
+
+    _log(MidiLogLevel::INFO, "Seeked to tick %llu (%llu us) in %lu us.", tick, position, (uint32_t)_now() - seekStart);
+    return true;
+}
+
+// Processes events (with _chasing set, so nothing sounds) until the next one is at or past 'target'.
+// tick and position (plus its remainder in 1/division us) follow the last event processed.
+bool ESP32MidiPlayer::_chaseTo(uint64_t target, bool targetIsMicros, uint64_t& tick, uint64_t& position, uint32_t& remainder) {
+    while (true) {
+        int trackIdx = _findTrackWithNextEvent();
+        if (trackIdx < 0) return true; // Every track ended before the target
+        uint64_t eventTick = _tracks[trackIdx].nextEventTick;
+        uint64_t units = _tempoUnits(tick, eventTick) + remainder;
+        uint64_t eventMicros = position + units / _division;
+        if (targetIsMicros ? (eventMicros >= target) : (eventTick >= target)) return true;
+        tick = eventTick;
+        position = eventMicros;
+        remainder = units % _division;
+        _currentTick = tick;
+        _processNextEvent(); // May change the tempo for the next step
+        if (!_midiFile) return false;
+    }
+}
+
+// --- Seek Index ---
+
+// Chases through the whole song once, keeping the state reached at every interval boundary
+bool ESP32MidiPlayer::_buildSeekIndex() {
+    uint32_t events = _ioStats.events;
+    _rewindTracks();
+    if (!_midiFile) return false;
+    uint64_t tick = 0;
+    uint64_t position = 0;
+    uint32_t remainder = 0;
+    bool ok = true;
+    _chase.clear();
+    _chasing = true;
+    for (uint64_t boundary = _seekIndexInterval; boundary <= UINT32_MAX; boundary += _seekIndexInterval) {
+        if (!_chaseTo(boundary, true, tick, position, remainder)) {
+            ok = false;
+            break;
+        }
+        if (_findTrackWithNextEvent() < 0) break; // Song over
+        _saveCheckpoint((uint32_t)boundary, tick, position, remainder);
+    }
+    _chasing = false;
+    _chase.clear();
+    _chase.shrink_to_fit();
+    _ioStats.events = events; // Not playback
+    if (!ok) return false;
+
+    _seekCheckpoints.shrink_to_fit();
+    _seekTrackStates.shrink_to_fit();
+    _seekChasePool.shrink_to_fit();
+    _rewindTracks(); // Leave the tracks where load() normally does
+    return _midiFile;
+}
+
+// Chase state is packed per channel that has any: index (2 bytes), track, reset flag, program,
+// pressure, bend LSB, bend MSB, controller count, then controller/value pairs.
+void ESP32MidiPlayer::_saveCheckpoint(uint32_t boundaryMicros, uint64_t tick, uint64_t position, uint32_t remainder) {
+    SeekCheckpoint checkpoint;
+    checkpoint.boundaryMicros = boundaryMicros;
+    checkpoint.tick = (uint32_t)tick;
+    checkpoint.micros = (uint32_t)position;
+    checkpoint.remainder = (uint16_t)remainder;
+    checkpoint.fileTempo = _fileTempo;
+    checkpoint.chaseOffset = _seekChasePool.size();
+    checkpoint.finishedTracks = _finishedTracks;
+    _seekCheckpoints.push_back(checkpoint);
+
+    for (const TrackInfo& track : _tracks) {
+        _seekTrackStates.push_back({track.currentOffset, (uint32_t)track.nextEventTick, track.lastStatusByte,
+                                    track.port, track.channelPrefix, track.endOfTrackReached});
+    }
+
+    std::vector<uint8_t>& pool = _seekChasePool;
+    size_t countAt = pool.size();
+    uint16_t channels = 0;
+    pool.resize(countAt + 2);
+    for (size_t index = 0; index < _chase.size(); ++index) {
+        const ChannelChase& chase = _chase[index];
+        uint8_t controllers = 0;
+        for (uint8_t cc = 0; cc < 120; ++cc) controllers += (chase.ccSeen[cc >> 5] >> (cc & 31)) & 1;
+        if (!controllers && !chase.resetControllers && chase.program == 0xFF && chase.pressure == 0xFF && chase.bendLsb == 0xFF) continue;
+        uint8_t header[9] = {(uint8_t)index, (uint8_t)(index >> 8), chase.track, chase.resetControllers, chase.program,
+                             chase.pressure, chase.bendLsb, chase.bendMsb, controllers};
+        pool.insert(pool.end(), header, header + sizeof(header));
+        for (uint8_t cc = 0; cc < 120; ++cc) {
+            if ((chase.ccSeen[cc >> 5] >> (cc & 31)) & 1) {
+                pool.push_back(cc);
+                pool.push_back(chase.cc[cc]);
+            }
+        }
+        channels++;
+    }
+    pool[countAt] = (uint8_t)channels;
+    pool[countAt + 1] = (uint8_t)(channels >> 8);
+}
+
+// Moves the tracks to the last checkpoint whose chased events all lie before 'target', if that
+// is further along than where the chase would otherwise start.
+bool ESP32MidiPlayer::_restoreCheckpoint(uint64_t target, bool targetIsMicros, uint64_t current, bool rewinding) {
+    if (_seekCheckpoints.empty() || !_tempoPoints.empty()) return false; // Automation moves song time off the index
+    auto it = std::upper_bound(_seekCheckpoints.begin(), _seekCheckpoints.end(), target,
+                               [targetIsMicros](uint64_t value, const SeekCheckpoint& checkpoint) {
+                                   return targetIsMicros ? value < checkpoint.boundaryMicros : value <= checkpoint.tick;
+                               });
+    if (it == _seekCheckpoints.begin()) return false;
+    const SeekCheckpoint& checkpoint = *(it - 1);
+    if (!rewinding && (targetIsMicros ? checkpoint.micros : checkpoint.tick) <= current) return false;
+
+    const SeekTrackState* states = &_seekTrackStates[(size_t)(it - 1 - _seekCheckpoints.begin()) * _tracks.size()];
+    for (size_t i = 0; i < _tracks.size(); ++i) {
+        TrackInfo& track = _tracks[i];
+        track.currentOffset = states[i].offset;
+        track.nextEventTick = states[i].nextEventTick;
+        track.lastStatusByte = states[i].lastStatusByte;
+        track.port = states[i].port;
+        track.channelPrefix = states[i].channelPrefix;
+        track.endOfTrackReached = states[i].ended;
+        if (_prefetchRings) _resetPrefetchRing(i, track.currentOffset);
+    }
+    _currentTick = checkpoint.tick;
+    _positionMicros = checkpoint.micros;
+    _positionRemainder = checkpoint.remainder;
+    _finishedTracks = checkpoint.finishedTracks;
+    _fileTempo = checkpoint.fileTempo;
+    _updateTempo();
+
+    const uint8_t* packed = &_seekChasePool[checkpoint.chaseOffset];
+    uint16_t channels = packed[0] | (packed[1] << 8);
+    packed += 2;
+    for (uint16_t c = 0; c < channels; ++c) {
+        uint16_t index = packed[0] | (packed[1] << 8);
+        if (index >= _chase.size()) _chase.resize((index / 16 + 1) * 16);
+        ChannelChase& chase = _chase[index];
+        chase.track = packed[2];
+        chase.resetControllers = packed[3];
+        chase.program = packed[4];
+        chase.pressure = packed[5];
+        chase.bendLsb = packed[6];
+        chase.bendMsb = packed[7];
+        uint8_t controllers = packed[8];
+        packed += 9;
+        for (uint8_t i = 0; i < controllers; ++i, packed += 2) {
+            chase.cc[packed[0]] = packed[1];
+            chase.ccSeen[packed[0] >> 5] |= 1UL << (packed[0] & 31);
+        }
+    }
+    _log(MidiLogLevel::DEBUG, "Seek continues from checkpoint at %lu us (tick %lu).", checkpoint.micros, checkpoint.tick);
+    return true;
+}
+
+// --- Preview ---
+
+bool ESP32MidiPlayer::preview(const char* filename, uint64_t startMicros, uint32_t durationMicros, uint32_t fadeMicros) {
+    if (!load(filename)) return false;
+    if (startMicros > 0 && !seekMicros(startMicros)) return false;
+    _previewStartMicros = startMicros;
+    _previewEndMicros = startMicros + (durationMicros ? durationMicros : 1);
+    _previewFadeMicros = fadeMicros;
+    play();
+    return _state == PlaybackState::PLAYING;
+}
+
+// Note On velocity scaled by the preview fade: linear in over the first fade, out over the last
+uint8_t ESP32MidiPlayer::_previewVelocity(uint8_t velocity) const {
+    if (_previewFadeMicros == 0) return velocity;
+    uint64_t fromStart = _positionMicros > _previewStartMicros ? _positionMicros - _previewStartMicros : 0;
+    uint64_t toEnd = _previewEndMicros > _positionMicros ? _previewEndMicros - _positionMicros : 0;
+    uint64_t distance = fromStart < toEnd ? fromStart : toEnd;
+    if (distance >= _previewFadeMicros) return velocity;
+    uint8_t scaled = (uint8_t)((uint64_t)velocity * distance / _previewFadeMicros);
+    return scaled ? scaled : 1; // Velocity 0 would turn the Note On into a Note Off
+}
+
+// Keeps the latest value of every piece of channel state crossed while seeking
+void ESP32MidiPlayer::_recordChase(const MidiEvent& event) {
+    size_t index = event.globalChannel();
+    if (index >= _chase.size()) {
+        if (event.port >= MIDI_MAX_PORTS) return;
+        _chase.resize((event.port + 1) * 16);
+    }
+    ChannelChase& chase = _chase[index];
+    chase.track = event.track;
+    switch (event.command()) {
+        case 0xB0:
+            if (event.data1 == 121) { // Reset All Controllers
+                memset(chase.ccSeen, 0, sizeof(chase.ccSeen));
+                chase.resetControllers = true;
+                chase.bendLsb = 0xFF;
+                chase.pressure = 0xFF;
+            } else if (event.data1 < 120) { // Channel mode messages are not state worth replaying
+                chase.cc[event.data1] = event.data2;
+                chase.ccSeen[event.data1 >> 5] |= 1UL << (event.data1 & 31);
+            }
+            break;
+        case 0xC0: chase.program = event.data1; break;
+        case 0xD0: chase.pressure = event.data1; break;
+        case 0xE0: chase.bendLsb = event.data1; chase.bendMsb = event.data2; break;
+        default: break; // Notes and poly pressure are not chased
+    }
+}
+
+// Sends the chased state: controller reset, bank select, program, remaining controllers, pitch bend, pressure
+void ESP32MidiPlayer::_emitChaseState(uint64_t tick) {
+    MidiEvent event;
+    event.tick = tick;
+    event.micros = _positionMicros;
+    for (size_t index = 0; index < _chase.size(); ++index) {
+        const ChannelChase& chase = _chase[index];
+        event.port = index / 16;
+        event.track = chase.track;
+        uint8_t channel = index % 16;
+        auto seen = [&chase](uint8_t cc) { return (chase.ccSeen[cc >> 5] >> (cc & 31)) & 1; };
+        auto send = [&](uint8_t command, uint8_t data1, uint8_t data2) {
+            event.status = command | channel;
+            event.data1 = data1;
+            event.data2 = data2;
+            _dispatchEvent(event);
+        };
+
+        if (chase.resetControllers) send(0xB0, 121, 0);
+        if (seen(0)) send(0xB0, 0, chase.cc[0]);    // Bank select must precede the program change
+        if (seen(32)) send(0xB0, 32, chase.cc[32]);
+        if (chase.program != 0xFF) send(0xC0, chase.program, 0);
+        for (uint8_t cc = 1; cc < 120; ++cc) {
+            if (cc != 32 && seen(cc)) send(0xB0, cc, chase.cc[cc]);
+        }
+        if (chase.bendLsb != 0xFF) send(0xE0, chase.bendLsb, chase.bendMsb);
+        if (chase.pressure != 0xFF) send(0xD0, chase.pressure, 0);
+    }
+    _chase.clear();
+    _chase.shrink_to_fit();
+}
+
+// All Notes Off on all 16 channels of every port in use, so nothing hangs across a jump
+void ESP32MidiPlayer::_silenceOutput() {
+    uint32_t portsDone = 0;
+    MidiEvent event;
+    event.tick = _currentTick;
+    event.micros = _positionMicros;
+    for (size_t i = 0; i < _tracks.size(); ++i) {
+        uint8_t port = _tracks[i].port;
+        if (port < 32) {
+            if (portsDone & (1UL << port)) continue;
+            portsDone |= 1UL << port;
+        }
+        event.port = port;
+        event.track = i;
+        for (uint8_t ch = 0; ch < 16; ++ch) {
+            event.status = 0xB0 | ch;
+            event.data1 = 123;
+            event.data2 = 0;
+            _dispatchEvent(event);
+        }
+    }
+}
+
+// --- MIDI Time Code ---
+
+// Frame rate as a fraction (frames per second = num / den)
+static void _mtcRateFraction(MtcFrameRate rate, uint32_t& num, uint32_t& den) {
+    switch (rate) {
+        case MtcFrameRate::FPS_24: num = 24; den = 1; break;
+        case MtcFrameRate::FPS_2997_DROP: num = 30000; den = 1001; break;
+        case MtcFrameRate::FPS_30: num = 30; den = 1; break;
+        default: num = 25; den = 1; break;
+    }
+}
+
+// Frame count since 00:00:00:00 -> hours, minutes, seconds, frames (drop-frame aware)
+static void _mtcFrameToTimecode(uint64_t frame, MtcFrameRate rate, uint8_t tc[4]) {
+    uint32_t fps = (rate == MtcFrameRate::FPS_24) ? 24 : (rate == MtcFrameRate::FPS_25) ? 25 : 30;
+    if (rate == MtcFrameRate::FPS_2997_DROP) {
+        // Frame numbers 0 and 1 are skipped every minute except every tenth
+        uint64_t tenMinutes = frame / 17982;
+        uint64_t rest = frame % 17982;
+        frame += 18 * tenMinutes + ((rest > 1) ? 2 * ((rest - 2) / 1798) : 0);
+    }
+    tc[3] = frame % fps;
+    tc[2] = (frame / fps) % 60;
+    tc[1] = (frame / (fps * 60)) % 60;
+    tc[0] = (frame / (fps * 3600)) % 24;
+}
+
+static uint64_t _mtcTimecodeToFrame(const uint8_t tc[4], MtcFrameRate rate) {
+    uint32_t fps = (rate == MtcFrameRate::FPS_24) ? 24 : (rate == MtcFrameRate::FPS_25) ? 25 : 30;
+    uint64_t totalMinutes = (uint64_t)tc[0] * 60 + tc[1];
+    uint64_t frame = ((totalMinutes * 60) + tc[2]) * fps + tc[3];
+    if (rate == MtcFrameRate::FPS_2997_DROP) frame -= 2 * (totalMinutes - totalMinutes / 10);
+    return frame;
+}
+
+void ESP32MidiPlayer::setMtcFrameRate(MtcFrameRate rate) { _mtcRate = rate; _resyncMtcOutput(); }
+void ESP32MidiPlayer::setMtcOffsetMicros(uint64_t micros) { _mtcOffsetMicros = micros; _resyncMtcOutput(); }
+void ESP32MidiPlayer::setMtcQuarterFrameCallback(MtcQuarterFrameCallback callback) { _mtcQuarterFrameCallback = callback; _resyncMtcOutput(); }
+void ESP32MidiPlayer::setMtcFullFrameCallback(MtcFullFrameCallback callback) { _mtcFullFrameCallback = callback; }
+void ESP32MidiPlayer::setMtcFollowEnabled(bool enabled) {
+    _mtcFollow = enabled;
+    _mtcRxMask = 0;
+    _mtcRxRunning = false;
+    if (!enabled) setPlaybackRate(1.0f);
+}
+
+// Sends every quarter frame that became due. Quarter frame n is due at n * 250000 * den / num us
+// of timecode, so scheduling is one multiply and compare per frame.
+void ESP32MidiPlayer::_serviceMtcOutput() {
+    if (!_mtcQuarterFrameCallback || _state != PlaybackState::PLAYING) return;
+    uint32_t num, den;
+    _mtcRateFraction(_mtcRate, num, den);
+    uint64_t timecode = _positionMicros + _mtcOffsetMicros;
+    uint64_t due = timecode * num / (250000ULL * den); // Last quarter frame at or before now
+    if (due >= _mtcNextQuarterFrame + 8) {
+        _resyncMtcOutput(); // tick() was late by more than two frames: locate instead of bursting
+        return;
+    }
+    while (_mtcNextQuarterFrame <= due) {
+        _sendMtcQuarterFrame(_mtcNextQuarterFrame++);
+    }
+}
+
+// Sends a full frame message for the current position and restarts quarter frames from there
+void ESP32MidiPlayer::_resyncMtcOutput() {
+    uint32_t num, den;
+    _mtcRateFraction(_mtcRate, num, den);
+    uint64_t timecode = _positionMicros + _mtcOffsetMicros;
+    _mtcNextQuarterFrame = (timecode * num + 250000ULL * den - 1) / (250000ULL * den);
+    if (!_mtcFullFrameCallback || _state == PlaybackState::STOPPED) return;
+
+    uint8_t tc[4];
+    _mtcFrameToTimecode(timecode * num / (1000000ULL * den), _mtcRate, tc);
+    uint8_t sysex[10] = {0xF0, 0x7F, 0x7F, 0x01, 0x01,
+                         (uint8_t)(((uint8_t)_mtcRate << 5) | tc[0]), tc[1], tc[2], tc[3], 0xF7};
+    _mtcFullFrameCallback(sysex, sizeof(sysex));
+}
+
+// Pieces 0-7 carry the timecode of the frame in which piece 0 was sent, two frames per cycle
+void ESP32MidiPlayer::_sendMtcQuarterFrame(uint64_t index) {
+    uint8_t piece = index & 7;
+    uint8_t tc[4];
+    _mtcFrameToTimecode((index >> 3) * 2, _mtcRate, tc);
+    uint8_t nibble;
+    switch (piece) {
+        case 0: nibble = tc[3] & 0x0F; break;
+        case 1: nibble = tc[3] >> 4; break;
+        case 2: nibble = tc[2] & 0x0F; break;
+        case 3: nibble = tc[2] >> 4; break;
+        case 4: nibble = tc[1] & 0x0F; break;
+        case 5: nibble = tc[1] >> 4; break;
+        case 6: nibble = tc[0] & 0x0F; break;
+        default: nibble = (((uint8_t)_mtcRate << 1) | (tc[0] >> 4)) & 0x0F; break;
+    }
+    _mtcQuarterFrameCallback((piece << 4) | nibble);
+}
+
+void ESP32MidiPlayer::receiveMtcQuarterFrame(uint8_t data) {
+    if (!_mtcFollow) return;
+    uint8_t piece = (data >> 4) & 0x07;
+    _mtcRxLastMicros = _now();
+    if (piece == 0) _mtcRxMask = 0; // A new two-frame cycle starts
+    _mtcRxNibbles[piece] = data & 0x0F;
+    _mtcRxMask |= 1 << piece;
+    if (piece != 7 || _mtcRxMask != 0xFF) return;
+
+    MtcFrameRate rate = (MtcFrameRate)((_mtcRxNibbles[7] >> 1) & 0x03);
+    uint8_t tc[4] = {(uint8_t)(_mtcRxNibbles[6] | ((_mtcRxNibbles[7] & 0x01) << 4)),
+                     (uint8_t)(_mtcRxNibbles[4] | (_mtcRxNibbles[5] << 4)),
+                     (uint8_t)(_mtcRxNibbles[2] | (_mtcRxNibbles[3] << 4)),
+                     (uint8_t)(_mtcRxNibbles[0] | (_mtcRxNibbles[1] << 4))};
+    uint32_t num, den;
+    _mtcRateFraction(rate, num, den);
+    // The cycle described the frame of piece 0; piece 7 arrives 7 quarter frames later
+    uint64_t quarterFrames = _mtcTimecodeToFrame(tc, rate) * 4 + 7;
+    _mtcRxRunning = true;
+    _followMtc(quarterFrames * 250000ULL * den / num);
+}
+
+void ESP32MidiPlayer::receiveMtcFullFrame(const uint8_t* sysex, uint8_t length) {
+    if (!_mtcFollow || !sysex || length < 10) return;
+    if (sysex[0] != 0xF0 || sysex[1] != 0x7F || sysex[3] != 0x01 || sysex[4] != 0x01) return;
+    MtcFrameRate rate = (MtcFrameRate)((sysex[5] >> 5) & 0x03);
+    uint8_t tc[4] = {(uint8_t)(sysex[5] & 0x1F), sysex[6], sysex[7], sysex[8]};
+    uint32_t num, den;
+    _mtcRateFraction(rate, num, den);
+    uint64_t timecode = _mtcTimecodeToFrame(tc, rate) * 1000000ULL * den / num;
+    // A full frame is a locate: jump there, keep the transport as it is
+    seekMicros(timecode > _mtcOffsetMicros ? timecode - _mtcOffsetMicros : 0);
+}
+
+// Locates when far off, otherwise trims the playback rate so the error closes smoothly
+void ESP32MidiPlayer::_followMtc(uint64_t timecodeMicros) {
+    if (!_midiFile) return;
+    uint64_t target = timecodeMicros > _mtcOffsetMicros ? timecodeMicros - _mtcOffsetMicros : 0;
+
+    if (_state != PlaybackState::PLAYING) {
+        seekMicros(target);
+        setPlaybackRate(1.0f);
+        play();
+        return;
+    }
+
+    _advanceTickTime();
+    int64_t error = (int64_t)target - (int64_t)_positionMicros;
+    if (error > (int64_t)MTC_RELOCATE_MICROS || error < -(int64_t)MTC_RELOCATE_MICROS) {
+        _log(MidiLogLevel::DEBUG, "MTC off by %lld us, locating.", error);
+        seekMicros(target);
+        setPlaybackRate(1.0f);
+        return;
+    }
+    double trim = (double)error / MTC_CATCHUP_MICROS;
+    if (trim > MTC_MAX_RATE_TRIM) trim = MTC_MAX_RATE_TRIM;
+    if (trim < -MTC_MAX_RATE_TRIM) trim = -MTC_MAX_RATE_TRIM;
+    setPlaybackRate((float)(1.0 + trim));
+}
+
+// --- Tempo Automation ---
+
+void ESP32MidiPlayer::setTempoOverride(uint32_t microsPerQuarterNote) {
+    if (_state == PlaybackState::PLAYING) _advanceTickTime(); // Time so far runs at the old tempo
+    scheduleTempoOverride(_currentTick, microsPerQuarterNote);
+}
+
+void ESP32MidiPlayer::scheduleTempoOverride(uint64_t tick, uint32_t microsPerQuarterNote) {
+    _insertTempoPoint(tick, microsPerQuarterNote, false);
+    _updateTempo();
+}
+
+void ESP32MidiPlayer::scheduleTempoRamp(uint64_t startTick, uint64_t endTick, uint32_t startTempo, uint32_t endTempo,
+                                        TempoRampShape shape) {
+    if (startTempo == 0 || endTempo == 0 || endTick <= startTick || endTick - startTick > UINT32_MAX) {
+        _log(MidiLogLevel::WARN, "Invalid tempo ramp ignored.");
+        return;
+    }
+    // Points inside the ramp would cut it short
+    _tempoPoints.erase(std::remove_if(_tempoPoints.begin(), _tempoPoints.end(),
+                                      [startTick, endTick](const TempoPoint& point) {
+                                          return point.tick > startTick && point.tick < endTick;
+                                      }),
+                       _tempoPoints.end());
+    _insertTempoPoint(startTick, startTempo, false);
+    if (shape == TempoRampShape::EXPONENTIAL) {
+        // Geometric steps between 16 linear pieces; only this setup uses floating point
+        const uint8_t pieces = 16;
+        double ratio = (double)endTempo / startTempo;
+        for (uint8_t i = 1; i < pieces; ++i) {
+            uint64_t tick = startTick + (endTick - startTick) * i / pieces;
+            if (tick <= startTick) continue;
+            _insertTempoPoint(tick, (uint32_t)(startTempo * pow(ratio, (double)i / pieces) + 0.5), true);
+        }
+    }
+    _insertTempoPoint(endTick, endTempo, true);
+    _updateTempo();
+}
+
+void ESP32MidiPlayer::clearTempoAutomation() {
+    _tempoPoints.clear();
+    _updateTempo();
+}
+
+void ESP32MidiPlayer::_insertTempoPoint(uint64_t tick, uint32_t tempo, bool ramp) {
+    auto it = std::lower_bound(_tempoPoints.begin(), _tempoPoints.end(), tick,
+                               [](const TempoPoint& point, uint64_t value) { return point.tick < value; });
+    if (it != _tempoPoints.end() && it->tick == tick) {
+        it->tempo = tempo;
+        it->ramp = ramp;
+    } else {
+        _tempoPoints.insert(it, {tick, tempo, ramp});
+    }
+}
+
+// Tempo at 'tick', and the first tick after it where the constant or linear piece ends
+uint32_t ESP32MidiPlayer::_tempoSegment(uint64_t tick, uint64_t& segmentEnd, bool& ramp) const {
+    auto next = std::upper_bound(_tempoPoints.begin(), _tempoPoints.end(), tick,
+                                 [](uint64_t value, const TempoPoint& point) { return value < point.tick; });
+    segmentEnd = (next == _tempoPoints.end()) ? UINT64_MAX : next->tick;
+    ramp = false;
+    if (next == _tempoPoints.begin()) return _fileTempo;
+    const TempoPoint& from = *(next - 1);
+    uint32_t tempo = from.tempo ? from.tempo : _fileTempo;
+    if (next != _tempoPoints.end() && next->ramp && next->tempo) {
+        ramp = true;
+        int64_t change = (int64_t)next->tempo - (int64_t)tempo;
+        return (uint32_t)(tempo + change * (int64_t)(tick - from.tick) / (int64_t)(next->tick - from.tick));
+    }
+    return tempo;
+}
+
+// Sum of floor((a * i + b) / m) for i in [0, n), in O(log m). Needs n, m < 2^32 and a, b < 2^64
+// once reduced below m, which holds for ramps shorter than 2^32 ticks.
+static uint64_t _floorSum(uint64_t n, uint64_t m, uint64_t a, uint64_t b) {
+    uint64_t sum = 0;
+    while (true) {
+        if (a >= m) {
+            sum += (n * (n - 1) / 2) * (a / m);
+            a %= m;
+        }
+        if (b >= m) {
+            sum += n * (b / m);
+            b %= m;
+        }
+        uint64_t yMax = a * n + b;
+        if (yMax < m) return sum;
+        n = yMax / m;
+        b = yMax % m;
+        std::swap(m, a);
+    }
+}
+
+// Sum of the per-tick tempos _tempoSegment() gives for 'count' ticks from 'tick', all on one linear
+// ramp, in closed form rather than tick by tick
+uint64_t ESP32MidiPlayer::_rampUnits(uint64_t tick, uint64_t count) const {
+    auto next = std::upper_bound(_tempoPoints.begin(), _tempoPoints.end(), tick,
+                                 [](uint64_t value, const TempoPoint& point) { return value < point.tick; });
+    const TempoPoint& from = *(next - 1);
+    uint32_t tempo = from.tempo ? from.tempo : _fileTempo;
+    int64_t change = (int64_t)next->tempo - (int64_t)tempo;
+    uint64_t slope = (change < 0) ? (uint64_t)-change : (uint64_t)change;
+    // The division in _tempoSegment() truncates towards zero, so a falling ramp rounds its steps up
+    uint64_t steps = _floorSum(count, next->tick - from.tick, slope, slope * (tick - from.tick));
+    return count * tempo + ((change < 0) ? (uint64_t)0 - steps : steps);
+}
+
+uint64_t ESP32MidiPlayer::_tempoUnits(uint64_t fromTick, uint64_t toTick) const {
+    uint64_t units = 0;
+    uint64_t tick = fromTick;
+    while (tick < toTick) {
+        uint64_t segmentEnd;
+        bool ramp;
+        uint32_t tempo = _tempoSegment(tick, segmentEnd, ramp);
+        uint64_t end = (segmentEnd < toTick) ? segmentEnd : toTick;
+        units += ramp ? _rampUnits(tick, end - tick) : (end - tick) * tempo;
+        tick = end;
+    }
+    return units;
+}
+
+uint64_t ESP32MidiPlayer::_walkTempo(uint64_t fromTick, uint64_t maxUnits, uint64_t& usedUnits) const {
+    uint64_t tick = fromTick;
+    usedUnits = 0;
+    while (true) {
+        uint64_t segmentEnd;
+        bool ramp;
+        uint32_t tempo = _tempoSegment(tick, segmentEnd, ramp);
+        if (tempo == 0) break;
+        if (ramp) {
+            // Tempos are positive, so the sum grows with the tick count: binary search the ticks that fit
+            uint64_t budget = maxUnits - usedUnits;
+            uint64_t whole = _rampUnits(tick, segmentEnd - tick);
+            if (whole <= budget) {
+                usedUnits += whole;
+                tick = segmentEnd;
+                continue;
+            }
+            uint64_t low = 0, high = segmentEnd - tick; // _rampUnits(low) fits, _rampUnits(high) does not
+            while (high - low > 1) {
+                uint64_t middle = low + (high - low) / 2;
+                if (_rampUnits(tick, middle) <= budget) low = middle;
+                else high = middle;
+            }
+            usedUnits += _rampUnits(tick, low);
+            tick += low;
+            break;
+        }
+        uint64_t fit = (maxUnits - usedUnits) / tempo;
+        if (fit < segmentEnd - tick) {
+            tick += fit;
+            usedUnits += fit * tempo;
+            break;
+        }
+        usedUnits += (segmentEnd - tick) * tempo;
+        tick = segmentEnd;
+    }
+    return tick - fromTick;
+}
+
+void ESP32MidiPlayer::_updateTempo() {
+    uint64_t segmentEnd;
+    bool ramp;
+    _microsecondsPerQuarterNote = _tempoSegment(_currentTick, segmentEnd, ramp);
+}
+
+// --- MIDI Clock Output ---
+
+void ESP32MidiPlayer::setMidiClockCallback(MidiClockCallback callback) {
+    _midiClockCallback = callback;
+    _resyncMidiClock();
+}
+
+void ESP32MidiPlayer::_sendMidiClock(uint8_t status) {
+    if (_midiClockCallback) _midiClockCallback(&status, 1);
+}
+
+// Song position pointer: sixteenth notes since the start of the song
+void ESP32MidiPlayer::_sendSongPosition() {
+    if (!_midiClockCallback || _division == 0) return;
+    uint64_t sixteenths = _currentTick * 4 / _division;
+    if (sixteenths > 0x3FFF) sixteenths = 0x3FFF;
+    uint8_t message[3] = {0xF2, (uint8_t)(sixteenths & 0x7F), (uint8_t)(sixteenths >> 7)};
+    _midiClockCallback(message, sizeof(message));
+}
+
+void ESP32MidiPlayer::_resyncMidiClock() {
+    if (_division == 0) return;
+    _clockNextPulse = (_currentTick * 24 + _division - 1) / _division; // First pulse at or after the current tick
+}
+
+// --- Background Prefetch ---
+
+bool ESP32MidiPlayer::_startPrefetch() {
+    if (_blockCount > 0 || _tracks.empty()) return false; // Compressed blocks are decoded on demand instead
+    _prefetchFile = _fs.open(_filename.c_str(), FILE_READ);
+    if (!_prefetchFile) return false;
+
+    uint32_t capacity = 64;
+    while (capacity < _prefetchAhead * 2) capacity <<= 1; // Room for aheadBytes plus a refill in flight
+    _prefetchRings = new PrefetchRing[_tracks.size()];
+    for (size_t i = 0; i < _tracks.size(); ++i) {
+        _prefetchRings[i].data = new uint8_t[capacity];
+        _prefetchRings[i].capacity = capacity;
+        _prefetchRings[i].base = _tracks[i].startOffset;
+        _prefetchRings[i].requestBase = _tracks[i].startOffset;
+    }
+
+    _prefetchRunning = true;
+    _prefetchActive = true;
+#if defined(ESP32)
+    if (xTaskCreatePinnedToCore(_prefetchTask, "midi_prefetch", 3072, this, 2, nullptr, tskNO_AFFINITY) != pdPASS) {
+        _prefetchActive = false;
+    }
+#elif defined(__linux__)
+    _prefetchThread = std::thread(_prefetchTask, this);
+#else
+    _prefetchActive = false; // No task support on this platform
+#endif
+    if (!_prefetchActive) {
+        _prefetchRunning = false;
+        _stopPrefetch();
+        return false;
+    }
+    _log(MidiLogLevel::DEBUG, "Prefetch started: %u tracks, %u byte rings.", _tracks.size(), capacity);
+    return true;
+}
+
+void ESP32MidiPlayer::_stopPrefetch() {
+    _prefetchRunning = false;
+#if defined(ESP32)
+    while (_prefetchActive) vTaskDelay(1);
+#elif defined(__linux__)
+    if (_prefetchThread.joinable()) _prefetchThread.join();
+#endif
+    if (_prefetchRings) {
+        for (size_t i = 0; i < _tracks.size(); ++i) delete[] _prefetchRings[i].data;
+        delete[] _prefetchRings;
+        _prefetchRings = nullptr;
+    }
+    if (_prefetchFile) _prefetchFile.close();
+}
+
+void ESP32MidiPlayer::_prefetchTask(void* player) {
+    ESP32MidiPlayer* self = static_cast<ESP32MidiPlayer*>(player);
+    self->_prefetchLoop();
+    self->_prefetchActive = false;
+#if defined(ESP32)
+    vTaskDelete(nullptr);
+#endif
+}
+
+// Tops up every ring, oldest data first; sleeps a little when all rings are full
+void ESP32MidiPlayer::_prefetchLoop() {
+    const uint32_t maxChunk = 512;
+    while (_prefetchRunning) {
+        bool busy = false;
+        for (size_t i = 0; i < _tracks.size() && _prefetchRunning; ++i) {
+            PrefetchRing& ring = _prefetchRings[i];
+            uint32_t generation = ring.requestGeneration.load(std::memory_order_acquire);
+            if (generation != ring.ackGeneration.load(std::memory_order_relaxed)) {
+                // tick() moved the track (rewind, seek or a starved read): restart the ring there
+                ring.base = ring.requestBase;
+                ring.head.store(0, std::memory_order_relaxed);
+                ring.ackGeneration.store(generation, std::memory_order_release);
+            }
+            uint32_t head = ring.head.load(std::memory_order_relaxed);
+            uint32_t tail = ring.tail.load(std::memory_order_acquire);
+            uint32_t used = head - tail;
+            uint32_t trackEnd = _tracks[i].endOffset;
+            uint32_t position = ring.base + head;
+            if (used > ring.capacity || position >= trackEnd) continue;
+
+            uint32_t space = ring.capacity - used;
+            uint32_t contiguous = ring.capacity - (head & (ring.capacity - 1));
+            uint32_t length = space < contiguous ? space : contiguous;
+            if (length > trackEnd - position) length = trackEnd - position;
+            if (length > maxChunk) length = maxChunk;
+            if (length == 0) continue;
+
+            uint8_t* target = ring.data + (head & (ring.capacity - 1));
+            uint32_t got;
+            if (_readLatencyMicros) delayMicroseconds(_readLatencyMicros);
+            if (_blockCache) {
+                got = _blockCache->read(_prefetchFile, _cacheFileId, _dataOffset + position, target, length);
+            } else {
+                got = _prefetchFile.seek(_dataOffset + position) ? _prefetchFile.read(target, length) : 0;
+            }
+            if (got == 0) continue;
+            // A reset requested meanwhile makes these bytes stale; the next pass handles it
+            if (ring.requestGeneration.load(std::memory_order_acquire) != generation) continue;
+            ring.head.store(head + got, std::memory_order_release);
+            _prefetchBytes.fetch_add(got, std::memory_order_relaxed);
+            busy = true;
+        }
+        if (!busy) {
+#if defined(ESP32)
+            vTaskDelay(1);
+#elif defined(__linux__)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+#endif
+        }
+    }
+}
+
+// Copies buffered track bytes; a read past what the task has buffered counts as a starvation and
+// moves the ring to where the track continues after the synchronous read.
+bool ESP32MidiPlayer::_prefetchRead(uint32_t offset, uint8_t* buffer, uint32_t length) {
+    for (size_t i = 0; i < _tracks.size(); ++i) {
+        const TrackInfo& track = _tracks[i];
+        if (offset < track.startOffset || offset >= track.endOffset) continue;
+        PrefetchRing& ring = _prefetchRings[i];
+        uint32_t generation = ring.requestGeneration.load(std::memory_order_relaxed);
+        if (ring.ackGeneration.load(std::memory_order_acquire) != generation) return false; // Reset pending
+        uint32_t head = ring.head.load(std::memory_order_acquire);
+        uint32_t tail = ring.tail.load(std::memory_order_relaxed);
+        if (offset < ring.base + tail) return false; // Behind the ring (re-read), not a starvation
+        if (offset + length > ring.base + head) {
+            if (_chasing) return false; // A seek scans faster than the task reads; _syncPrefetchRings() follows
+            _ioStats.prefetchStarvations++;
+            _resetPrefetchRing(i, offset + length);
+            return false;
+        }
+        uint32_t start = offset - ring.base;
+        for (uint32_t copied = 0; copied < length;) {
+            uint32_t index = (start + copied) & (ring.capacity - 1);
+            uint32_t chunk = ring.capacity - index;
+            if (chunk > length - copied) chunk = length - copied;
+            memcpy(buffer + copied, ring.data + index, chunk);
+            copied += chunk;
+        }
+        ring.tail.store(start + length, std::memory_order_release); // Frees the bytes for the task
+        return true;
+    }
+    return false;
+}
+
+// After a seek's chase: restarts the rings of tracks that were read past (or reset) meanwhile
+void ESP32MidiPlayer::_syncPrefetchRings() {
+    for (size_t i = 0; i < _tracks.size(); ++i) {
+        PrefetchRing& ring = _prefetchRings[i];
+        uint32_t offset = _tracks[i].currentOffset;
+        bool pending = ring.ackGeneration.load(std::memory_order_acquire) != ring.requestGeneration.load(std::memory_order_relaxed);
+        uint32_t head = ring.head.load(std::memory_order_acquire);
+        uint32_t tail = ring.tail.load(std::memory_order_relaxed);
+        if (pending || offset < ring.base + tail || offset > ring.base + head) _resetPrefetchRing(i, offset);
+    }
+}
+
+void ESP32MidiPlayer::_resetPrefetchRing(size_t trackIndex, uint32_t offset) {
+    PrefetchRing& ring = _prefetchRings[trackIndex];
+    ring.requestBase = offset;
+    ring.tail.store(0, std::memory_order_relaxed);
+    ring.requestGeneration.fetch_add(1, std::memory_order_release);
+}
+
+// --- Tickless Idle ---
+
+uint32_t ESP32MidiPlayer::getMicrosUntilNextEvent() const {
+    if (_inputQueue && _inputHead.load(std::memory_order_acquire) != _inputTail.load(std::memory_order_relaxed)) return 0;
+    if (_state != PlaybackState::PLAYING) return UINT32_MAX;
+    if (_tracksFound < _trackCount) return 0; // tick() is still locating tracks
+    int nextTrackIdx = _findTrackWithNextEvent();
+    if (nextTrackIdx < 0) return 0; // Nothing left; let tick() wrap up
+    uint64_t nextTick = _tracks[nextTrackIdx].nextEventTick;
+    if (_quantizedActionCount > 0 && _quantizedActions[0].tick < nextTick) nextTick = _quantizedActions[0].tick;
+    if (nextTick <= _currentTick || _division == 0) return 0;
+
+    uint64_t dueMicros = _dueMicros(nextTick);
+    uint64_t now = _now();
+    if (dueMicros <= now) return 0;
+    uint64_t remaining = dueMicros - now;
+    return (remaining > UINT32_MAX) ? UINT32_MAX : (uint32_t)remaining;
+}
+
+uint32_t ESP32MidiPlayer::waitForNextEvent(uint32_t maxWaitMicros) {
+    uint32_t waitMicros = getMicrosUntilNextEvent();
+    if (waitMicros > maxWaitMicros) waitMicros = maxWaitMicros;
+    if (waitMicros == 0) return 0;
+
+    uint32_t start = _now();
+#if defined(ESP32)
+    if (_idleMode == MidiIdleMode::LIGHT_SLEEP && waitMicros > IDLE_SPIN_MICROS + LIGHT_SLEEP_MARGIN_MICROS) {
+        esp_sleep_enable_timer_wakeup(waitMicros - IDLE_SPIN_MICROS - LIGHT_SLEEP_MARGIN_MICROS);
+        esp_light_sleep_start();
+    } else if (waitMicros > IDLE_SPIN_MICROS + portTICK_PERIOD_MS * 1000) {
+        // vTaskDelay(n) may return up to one RTOS tick early, never late
+        vTaskDelay((waitMicros - IDLE_SPIN_MICROS) / (portTICK_PERIOD_MS * 1000));
+    }
+#elif defined(__linux__)
+    if (waitMicros > IDLE_SPIN_MICROS) {
+        // Absolute deadline, so an interrupted sleep resumes instead of starting over
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        uint64_t nanos = (uint64_t)deadline.tv_nsec + (uint64_t)(waitMicros - IDLE_SPIN_MICROS) * 1000;
+        deadline.tv_sec += nanos / 1000000000;
+        deadline.tv_nsec = (long)(nanos % 1000000000);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) == EINTR) {}
+    }
+#else
+    if (waitMicros > IDLE_SPIN_MICROS + 1000) delay((waitMicros - IDLE_SPIN_MICROS) / 1000);
+#endif
+    uint32_t slept = _now() - start;
+    if (_state == PlaybackState::PLAYING) { // Idle time while stopped/paused is not playback duty
+        _idleStats.sleptMicros += slept;
+        _idleStats.waits++;
+    }
+
+    // Spin out the remainder so the event is dispatched on time (counted as awake)
+    if (slept < waitMicros) delayMicroseconds(waitMicros - slept);
+    return _now() - start;
+}
+
+void ESP32MidiPlayer::setIdleMode(MidiIdleMode mode) { _idleMode = mode; }
+MidiIdleStats ESP32MidiPlayer::getIdleStats() const { return _idleStats; }
+void ESP32MidiPlayer::resetIdleStats() { _idleStats = MidiIdleStats(); }
+
+// --- Status Queries ---
+void ESP32MidiPlayer::getPositionSnapshot(MidiPositionSnapshot& snapshot) const {
+    while (true) {
+        uint8_t front = _positionFront.load(std::memory_order_acquire);
+        uint32_t seq = _positionSeq[front].load(std::memory_order_acquire);
+        if (seq & 1) continue; // Writer lapped us and is refilling this buffer; take the other one
+        snapshot = _positionSnapshots[front];
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // A buffer refilled before the flip is newer than the front one; returning it would let the
+        // next read go backwards, so only the front buffer counts
+        if (_positionSeq[front].load(std::memory_order_relaxed) == seq &&
+            _positionFront.load(std::memory_order_relaxed) == front) return;
+    }
+}
+
+// Fills the buffer readers are not using, then flips readers over to it
+void ESP32MidiPlayer::_publishPosition() {
+    uint8_t back = _positionFront.load(std::memory_order_relaxed) ^ 1;
+    MidiPositionSnapshot& target = _positionSnapshots[back];
+
+    uint32_t seq = _positionSeq[back].load(std::memory_order_relaxed);
+    _positionSeq[back].store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    target.state = _state;
+    target.tick = _currentTick;
+    target.micros = _positionMicros;
+    target.tempo = _microsecondsPerQuarterNote;
+    target.playbackRate = (float)_playbackRate;
+    target.barBeat = tickToBarBeat(_currentTick);
+    target.publishedMicros = _now();
+    target.sequence = ++_positionPublishCount;
+
+    _positionSeq[back].store(seq + 2, std::memory_order_release);
+    _positionFront.store(back, std::memory_order_release);
+}
+
+PlaybackState ESP32MidiPlayer::getState() const { return _state; }
+bool ESP32MidiPlayer::isPlaying() const { return _state == PlaybackState::PLAYING; }
+bool ESP32MidiPlayer::isPaused() const { return _state == PlaybackState::PAUSED; }
+uint32_t ESP32MidiPlayer::getCurrentTick() const { return (uint32_t)_currentTick; } // Cast for typical usage
+uint32_t ESP32MidiPlayer::getTempo() const { return _microsecondsPerQuarterNote; }
+uint32_t ESP32MidiPlayer::getFileTempo() const { return _fileTempo; }
+uint64_t ESP32MidiPlayer::getCurrentMicros() const {
+    if (_state != PlaybackState::PLAYING) return _positionMicros;
+    // Between ticks, interpolate from the start of the current tick so the position is smooth
+    uint64_t now = _now();
+    if (now <= _lastEventMicros) return _positionMicros;
+    return _positionMicros + (uint64_t)((now - _lastEventMicros) * _playbackRate);
+}
+MidiContainer ESP32MidiPlayer::getContainer() const { return _container; }
+MidiIoStats ESP32MidiPlayer::getIoStats() const {
+    MidiIoStats stats = _ioStats;
+    stats.prefetchBytes = _prefetchBytes.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void ESP32MidiPlayer::resetIoStats() {
+    _ioStats = MidiIoStats();
+    _prefetchBytes = 0;
+}
+
+uint64_t ESP32MidiPlayer::tickToMicros(uint64_t tick) const {
+    // Find the last tempo entry at or before 'tick'
+    auto it = std::upper_bound(_tempoMap.begin(), _tempoMap.end(), tick,
+                               [](uint64_t t, const TempoMapEntry& e) { return t < e.tick; });
+    const TempoMapEntry& entry = *(it - 1); // First entry is always at tick 0
+    uint16_t division = _division ? _division : 96;
+    return entry.micros + (tick - entry.tick) * entry.tempo / division;
+}
+
+uint64_t ESP32MidiPlayer::microsToTick(uint64_t micros) const {
+    auto it = std::upper_bound(_tempoMap.begin(), _tempoMap.end(), micros,
+                               [](uint64_t m, const TempoMapEntry& e) { return m < e.micros; });
+    const TempoMapEntry& entry = *(it - 1);
+    uint16_t division = _division ? _division : 96;
+    return entry.tick + (micros - entry.micros) * division / entry.tempo;
+}
+
+// --- Lyric Timeline ---
+uint16_t ESP32MidiPlayer::getLyricLineCount() const { return (uint16_t)_lyricLines.size(); }
+uint16_t ESP32MidiPlayer::getLyricSyllableCount() const { return (uint16_t)_lyricSyllables.size(); }
+
+bool ESP32MidiPlayer::getLyricLine(uint16_t index, MidiLyricLine& line) const {
+    if (index >= _lyricLines.size()) return false;
+    _fillLyricLine(index, line);
+    return true;
+}
+
+bool ESP32MidiPlayer::getLyricSyllable(uint16_t index, MidiLyricSyllable& syllable) const {
+    if (index >= _lyricSyllables.size()) return false;
+    syllable = _lyricSyllables[index];
+    return true;
+}
+
+int32_t ESP32MidiPlayer::findLyricSyllable(uint64_t micros) const {
+    auto it = std::upper_bound(_lyricSyllables.begin(), _lyricSyllables.end(), micros,
+                               [](uint64_t m, const MidiLyricSyllable& s) { return m < s.micros; });
+    return (int32_t)(it - _lyricSyllables.begin()) - 1;
+}
+
+uint16_t ESP32MidiPlayer::getLyricLinesAt(uint64_t micros, MidiLyricLine* lines, uint16_t maxLines) const {
+    if (!lines || _lyricLines.empty()) return 0;
+    int32_t syllable = findLyricSyllable(micros);
+    uint16_t lineIndex = (syllable < 0) ? 0 : _lyricSyllables[syllable].line; // Before the first syllable: show what comes first
+    uint16_t count = 0;
+    while (count < maxLines && lineIndex < _lyricLines.size()) {
+        _fillLyricLine(lineIndex++, lines[count++]);
+    }
+    return count;
+}
+
+uint16_t ESP32MidiPlayer::getLyricLines(MidiLyricLine* lines, uint16_t maxLines, uint32_t lookaheadMicros) const {
+    // The timeline is in file time; under tempo automation the played time differs, the tick does not
+    uint64_t micros = _tempoPoints.empty() ? _positionMicros : tickToMicros(_currentTick);
+    return getLyricLinesAt(micros + lookaheadMicros, lines, maxLines);
 }
 
-void ESP32MidiPlayer::pause() {
-    if (_state == PlaybackState::PLAYING) {
-        _state = PlaybackState::PAUSED;
-        _pauseStartMicros = micros();
-        _log(MidiLogLevel::INFO, "Playback paused at tick %lu.", (uint32_t)_currentTick);
-        // Optional: Send All Notes Off / All Sound Off CC messages if desired
-        // for (uint8_t ch = 0; ch < 16; ++ch) {
-        //     if (_controlChangeCallback) _controlChangeCallback(ch, 123, 0); // All notes off
-        //     if (_controlChangeCallback) _controlChangeCallback(ch, 120, 0); // All sound off
-        // }
-    } else {
-         _log(MidiLogLevel::WARN, "Pause command received but not playing.");
+// --- Active Note Snapshot ---
+const MidiActiveNotes* ESP32MidiPlayer::beginActiveNotesRead(uint32_t& token) const {
+    if (!_activeNotes) return nullptr;
+    while (true) {
+        uint8_t front = _activeNotesFront.load(std::memory_order_acquire);
+        uint32_t seq = _activeNotesSeq[front].load(std::memory_order_acquire);
+        if (seq & 1) continue; // Writer lapped us and is refilling this buffer; take the other one
+        token = (seq << 1) | front;
+        return &_activeNotes[1 + front];
     }
 }
 
-void ESP32MidiPlayer::resume() {
-    if (_state == PlaybackState::PAUSED) {
-        play(); // Same logic for resuming as starting from paused state
+bool ESP32MidiPlayer::endActiveNotesRead(uint32_t token) const {
+    if (!_activeNotes) return false;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return ((_activeNotesSeq[token & 1].load(std::memory_order_relaxed) << 1) | (token & 1)) == token;
+}
+
+void ESP32MidiPlayer::_trackActiveNote(uint8_t channel, uint8_t note, uint8_t velocity) {
+    MidiActiveNotes& live = _activeNotes[0];
+    note &= 0x7F;
+    if (live.velocity[channel][note] == velocity) return;
+    live.velocity[channel][note] = velocity;
+    uint32_t bit = 1UL << (note & 31);
+    if (velocity) {
+        live.keyBits[channel][note >> 5] |= bit;
+        live.channelMask |= (1 << channel);
     } else {
-         _log(MidiLogLevel::WARN, "Resume command received but not paused.");
+        live.keyBits[channel][note >> 5] &= ~bit;
+        const uint32_t* bits = live.keyBits[channel];
+        if (!(bits[0] | bits[1] | bits[2] | bits[3])) live.channelMask &= ~(1 << channel);
     }
+    _activeNotesDirty[0] |= (1 << channel);
+    _activeNotesDirty[1] |= (1 << channel);
+    _activeNotesChanged = true;
 }
 
-void ESP32MidiPlayer::stop() {
-    bool wasPlaying = (_state != PlaybackState::STOPPED);
-    if (_midiFile) {
-        _midiFile.close();
-        if (wasPlaying) _log(MidiLogLevel::INFO, "MIDI file closed due to stop.");
-        else _log(MidiLogLevel::DEBUG, "MIDI file closed."); // Might be closed during load error etc.
+void ESP32MidiPlayer::_clearActiveNotes(uint8_t channel) {
+    MidiActiveNotes& live = _activeNotes[0];
+    if (!(live.channelMask & (1 << channel))) return;
+    memset(live.velocity[channel], 0, sizeof(live.velocity[channel]));
+    memset(live.keyBits[channel], 0, sizeof(live.keyBits[channel]));
+    live.channelMask &= ~(1 << channel);
+    _activeNotesDirty[0] |= (1 << channel);
+    _activeNotesDirty[1] |= (1 << channel);
+    _activeNotesChanged = true;
+}
+
+// Copies the channels that changed into the back buffer, then makes it the front buffer.
+// Each published buffer remembers which channels it is missing, so only those are copied.
+void ESP32MidiPlayer::_publishActiveNotes() {
+    if (!_activeNotesChanged) return;
+    uint8_t back = _activeNotesFront.load(std::memory_order_relaxed) ^ 1;
+    MidiActiveNotes& live = _activeNotes[0];
+    MidiActiveNotes& target = _activeNotes[1 + back];
+
+    uint32_t seq = _activeNotesSeq[back].load(std::memory_order_relaxed);
+    _activeNotesSeq[back].store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    uint16_t dirty = _activeNotesDirty[back];
+    for (uint8_t ch = 0; dirty; ++ch, dirty >>= 1) {
+        if (!(dirty & 1)) continue;
+        memcpy(target.velocity[ch], live.velocity[ch], sizeof(live.velocity[ch]));
+        memcpy(target.keyBits[ch], live.keyBits[ch], sizeof(live.keyBits[ch]));
     }
-    _filename = "";
-    _resetPlaybackState(); // Resets state to STOPPED among other things
+    target.channelMask = live.channelMask;
+    target.tick = (uint32_t)_currentTick;
 
-     if (wasPlaying) {
-        _log(MidiLogLevel::INFO, "Playback stopped.");
-        // Optional: Send All Notes Off / All Sound Off CC messages
-        // for (uint8_t ch = 0; ch < 16; ++ch) {
-        //     if (_controlChangeCallback) _controlChangeCallback(ch, 123, 0); // All notes off
-        //     if (_controlChangeCallback) _controlChangeCallback(ch, 120, 0); // All sound off
-        // }
-     }
+    _activeNotesSeq[back].store(seq + 2, std::memory_order_release);
+    _activeNotesFront.store(back, std::memory_order_release);
+    _activeNotesDirty[back] = 0;
+    _activeNotesChanged = false;
 }
 
-// --- Main Loop Update ---
+// --- Note Interval Index ---
+uint32_t ESP32MidiPlayer::getNoteIntervalCount() const { return _noteIntervals.size(); }
 
-void ESP32MidiPlayer::tick() {
-    if (_state != PlaybackState::PLAYING) {
-        return; // Only process if playing
+bool ESP32MidiPlayer::getNoteInterval(uint32_t index, MidiNoteInterval& note) const {
+    if (index >= _noteIntervals.size()) return false;
+    note = _noteIntervals[index];
+    return true;
+}
+
+uint32_t ESP32MidiPlayer::queryNotes(uint64_t startMicros, uint64_t endMicros, NoteIntervalCallback callback) const {
+    if (startMicros >= endMicros || _noteIntervals.empty()) return 0;
+    // Every note before 'first' ended at or before startMicros (the running max end says so),
+    // and every note from 'last' on starts at or after endMicros.
+    size_t first = std::upper_bound(_noteMaxEnd.begin(), _noteMaxEnd.end(), startMicros,
+                                    [](uint64_t m, uint32_t end) { return m < end; }) - _noteMaxEnd.begin();
+    size_t last = std::lower_bound(_noteIntervals.begin(), _noteIntervals.end(), endMicros,
+                                   [](const MidiNoteInterval& n, uint64_t m) { return n.startMicros < m; }) - _noteIntervals.begin();
+    uint32_t count = 0;
+    for (size_t i = first; i < last; ++i) {
+        const MidiNoteInterval& note = _noteIntervals[i];
+        if (note.endMicros <= startMicros) continue; // Shorter note overlapped by a longer earlier one
+        if (callback) callback(note);
+        count++;
     }
+    return count;
+}
 
-    // 1. Advance Tick Time based on micros()
-    _advanceTickTime();
+// --- Meter Map ---
+const ESP32MidiPlayer::MeterMapEntry& ESP32MidiPlayer::_meterAt(uint64_t tick) const {
+    auto it = std::upper_bound(_meterMap.begin(), _meterMap.end(), tick,
+                               [](uint64_t t, const MeterMapEntry& e) { return t < e.tick; });
+    return *(it - 1); // First entry is always at tick 0
+}
 
-    // 2. Process all events scheduled up to the current tick
-    while (true) {
-        int nextTrackIdx = _findTrackWithNextEvent();
+uint32_t ESP32MidiPlayer::_ticksPerBeat(const MeterMapEntry& meter) const {
+    uint32_t ticks = ((uint32_t)(_division ? _division : 96) * 4) >> meter.denominatorPow2;
+    return ticks ? ticks : 1;
+}
 
-        // If no track has an event ready (or all tracks finished)
-        if (nextTrackIdx < 0) {
-            _log(MidiLogLevel::VERBOSE, "Tick %llu: No tracks ready.", _currentTick); // Usually too noisy
-            break; // No tracks have events scheduled
-        }
+MidiBarBeat ESP32MidiPlayer::tickToBarBeat(uint64_t tick) const {
+    const MeterMapEntry& meter = _meterAt(tick);
+    uint32_t ticksPerBeat = _ticksPerBeat(meter);
+    uint64_t ticksPerBar = (uint64_t)ticksPerBeat * meter.numerator;
+    uint64_t offset = tick - meter.tick;
+    uint64_t inBar = offset % ticksPerBar;
+    MidiBarBeat position;
+    position.bar = meter.bar + (uint32_t)(offset / ticksPerBar) + 1;
+    position.beat = (uint16_t)(inBar / ticksPerBeat) + 1;
+    position.tick = (uint32_t)(inBar % ticksPerBeat);
+    return position;
+}
 
-        // Check if the *earliest* event is actually due yet
-        if (_tracks[nextTrackIdx].nextEventTick > _currentTick) {
-            // _log(MidiLogLevel::VERBOSE, "Tick %llu: Earliest event on T%d is at tick %llu, not due yet.", _currentTick, nextTrackIdx, _tracks[nextTrackIdx].nextEventTick);
-            break; // No more events ready at this exact moment
-        }
+uint64_t ESP32MidiPlayer::barBeatToTick(uint32_t bar, uint16_t beat, uint32_t tick) const {
+    uint32_t barIndex = bar ? bar - 1 : 0;
+    auto it = std::upper_bound(_meterMap.begin(), _meterMap.end(), barIndex,
+                               [](uint32_t b, const MeterMapEntry& e) { return b < e.bar; });
+    const MeterMapEntry& meter = *(it - 1);
+    uint32_t ticksPerBeat = _ticksPerBeat(meter);
+    return meter.tick + (uint64_t)(barIndex - meter.bar) * ticksPerBeat * meter.numerator +
+           (uint64_t)(beat ? beat - 1 : 0) * ticksPerBeat + tick;
+}
 
-        // Process the event from the chosen track
-        // _log(MidiLogLevel::DEBUG, "Tick %llu: Processing event for T%d scheduled at tick %llu", _currentTick, nextTrackIdx, _tracks[nextTrackIdx].nextEventTick);
-        _processNextEvent(); // This function finds the track internally again
+MidiBarBeat ESP32MidiPlayer::getCurrentBarBeat() const { return tickToBarBeat(_currentTick); }
 
-         // Check if all tracks are finished AFTER processing an event
-        if (_finishedTracks >= _trackCount) {
-             _log(MidiLogLevel::INFO, "All tracks finished.");
-             if (_playbackCompleteCallback) {
-                 _playbackCompleteCallback();
-             }
-             stop(); // Stop playback automatically
-             break; // Exit the while loop
-        }
+void ESP32MidiPlayer::getTimeSignatureAt(uint64_t tick, uint8_t& numerator, uint8_t& denominator) const {
+    const MeterMapEntry& meter = _meterAt(tick);
+    numerator = meter.numerator;
+    denominator = (uint8_t)(1 << meter.denominatorPow2);
+}
+
+uint64_t ESP32MidiPlayer::scheduleQuantizedAction(MidiQuantize quantize, QuantizedActionCallback action, uint16_t actionId) {
+    if (!action) return UINT64_MAX;
+    return _scheduleQuantized(quantize, action, actionId);
+}
+
+uint64_t ESP32MidiPlayer::_scheduleQuantized(MidiQuantize quantize, QuantizedActionCallback action, uint16_t id) {
+    if (_quantizedActionCount >= MIDI_MAX_QUANTIZED_ACTIONS) return UINT64_MAX;
+
+    // Once started, the events at the current tick are already out: the boundary has to come after it
+    uint64_t from = _currentTick + (_state == PlaybackState::STOPPED ? 0 : 1);
+    const MeterMapEntry& meter = _meterAt(from);
+    uint64_t step = _ticksPerBeat(meter);
+    if (quantize == MidiQuantize::BAR) step *= meter.numerator;
+    uint64_t boundary = meter.tick + (from - meter.tick + step - 1) / step * step;
+    size_t next = (&meter - _meterMap.data()) + 1;
+    if (next < _meterMap.size() && _meterMap[next].tick < boundary) boundary = _meterMap[next].tick; // New signature, new bar
+
+    // Keep the queue sorted; actions on the same boundary run in the order they were scheduled
+    uint8_t index = _quantizedActionCount;
+    while (index > 0 && _quantizedActions[index - 1].tick > boundary) {
+        _quantizedActions[index] = _quantizedActions[index - 1];
+        index--;
     }
+    _quantizedActions[index] = {boundary, action, id};
+    _quantizedActionCount++;
+    return boundary;
 }
 
-// --- Status Queries ---
-PlaybackState ESP32MidiPlayer::getState() const { return _state; }
-bool ESP32MidiPlayer::isPlaying() const { return _state == PlaybackState::PLAYING; }
-bool ESP32MidiPlayer::isPaused() const { return _state == PlaybackState::PAUSED; }
-uint32_t ESP32MidiPlayer::getCurrentTick() const { return (uint32_t)_currentTick; } // Cast for typical usage
-uint32_t ESP32MidiPlayer::getTempo() const { return _microsecondsPerQuarterNote; }
+void ESP32MidiPlayer::cancelQuantizedActions() { _quantizedActionCount = 0; }
+
+void ESP32MidiPlayer::_runQuantizedAction() {
+    QuantizedAction due = _quantizedActions[0];
+    _quantizedActionCount--;
+    for (uint8_t i = 0; i < _quantizedActionCount; ++i) _quantizedActions[i] = _quantizedActions[i + 1];
+    _flushRouteBatches(); // Everything before the boundary reaches the sinks first
+    if (due.action) {
+        due.action(due.id, due.tick);
+    } else if (_format == 2 && due.id < _trackCount) {
+        _startPattern(due.id, due.tick, true);
+    }
+}
+
+void ESP32MidiPlayer::_fillLyricLine(uint16_t index, MidiLyricLine& line) const {
+    const LyricLineInfo& info = _lyricLines[index];
+    line.text = &_lyricPool[info.textOffset];
+    line.firstSyllable = info.firstSyllable;
+    line.syllableCount = info.syllableCount;
+    line.newPage = info.newPage;
+    line.startMicros = _lyricSyllables[info.firstSyllable].micros;
+    if ((size_t)index + 1 < _lyricLines.size()) {
+        line.endMicros = _lyricSyllables[_lyricLines[index + 1].firstSyllable].micros;
+    } else {
+        line.endMicros = _lyricSyllables[info.firstSyllable + info.syllableCount - 1].micros;
+    }
+}
 
 // --- Private Helper Methods Implementation ---
 
@@ -276,50 +2141,204 @@ uint8_t ESP32MidiPlayer::_readUint8(uint32_t& offset) {
 }
 
 
-// Reads bytes directly from file - basic implementation
+// Reads SMF data bytes; offsets are relative to the start of the SMF data (MThd)
 uint32_t ESP32MidiPlayer::_readBytes(uint32_t offset, uint8_t* buffer, uint32_t length) {
     if (!_midiFile) {
         _log(MidiLogLevel::ERROR, "Read attempt failed: File not open (offset %u)", offset);
         return 0;
     }
-    if (!_midiFile.seek(offset)) {
-        _log(MidiLogLevel::ERROR, "Seek failed to offset %u", offset);
-        // Consider stopping playback on seek fail? Maybe file closed unexpectedly.
-        stop();
-        return 0;
+    if (_prefetchRings && length && _prefetchRead(offset, buffer, length)) return length;
+    uint32_t requested = length;
+    if (offset >= _dataSize) {
+        length = 0;
+    } else if (length > _dataSize - offset) {
+        length = _dataSize - offset; // Never read past the SMF data (e.g. into trailing RIFF chunks)
     }
-    size_t bytesRead = _midiFile.read(buffer, length);
-    if (bytesRead != length) {
+    uint32_t bytesRead = length ? _readSource(_dataOffset + offset, buffer, length) : 0;
+    if (bytesRead != requested) {
         // This might happen legitimately if near EOF for some reads (like VLQ),
         // but can be an error for others (like fixed-size reads). The calling function should check.
-         _log(MidiLogLevel::WARN, "Read incomplete at offset %u. Requested %u, got %u. EOF?", offset, length, bytesRead);
+         _log(MidiLogLevel::WARN, "Read incomplete at offset %u. Requested %u, got %u. EOF?", offset, requested, bytesRead);
          // Should we stop? Depends if the caller expected exactly 'length' bytes.
          // For now, just return what was read. The caller must handle potential errors.
     }
     return bytesRead;
 }
-// Peeks bytes directly from file (reads without changing file position)
+// Peeks bytes. Reads are offset based and never move a shared file position, so this is a plain read.
 uint32_t ESP32MidiPlayer::_peekBytes(uint32_t offset, uint8_t* buffer, uint32_t length) {
-     if (!_midiFile) {
-        _log(MidiLogLevel::ERROR, "Peek attempt failed: File not open (offset %u)", offset);
-        return 0;
+    return _readBytes(offset, buffer, length);
+}
+
+// Reads (decompressed) source bytes through the read-ahead windows
+uint32_t ESP32MidiPlayer::_readSource(uint32_t sourceOffset, uint8_t* buffer, uint32_t length) {
+    uint32_t copied = 0;
+    while (copied < length) {
+        uint32_t available = 0;
+        const uint8_t* data = _fetchWindow(sourceOffset + copied, available);
+        if (!data) break;
+        uint32_t chunk = (available < length - copied) ? available : length - copied;
+        memcpy(buffer + copied, data, chunk);
+        copied += chunk;
+    }
+    return copied;
+}
+
+// Returns a pointer to the buffered byte at sourceOffset (and how many bytes follow it
+// in the same window), refilling the least recently used window on a miss.
+const uint8_t* ESP32MidiPlayer::_fetchWindow(uint32_t sourceOffset, uint32_t& available) {
+    if (sourceOffset >= _sourceSize || _windowData.empty()) return nullptr;
+
+    int victim = 0;
+    for (int i = 0; i < MIDI_READ_BUFFER_COUNT; ++i) {
+        ReadWindow& window = _windows[i];
+        if (window.length > 0 && sourceOffset >= window.start && sourceOffset - window.start < window.length) {
+            window.lastUse = ++_windowUseCounter;
+            _ioStats.bufferHits++;
+            available = window.length - (sourceOffset - window.start);
+            return &_windowData[i * _windowSize] + (sourceOffset - window.start);
+        }
+        if (window.lastUse < _windows[victim].lastUse) victim = i;
+    }
+
+    _ioStats.bufferMisses++;
+    ReadWindow& window = _windows[victim];
+    uint8_t* data = &_windowData[victim * _windowSize];
+    uint32_t start = sourceOffset - (sourceOffset % _windowSize);
+    uint32_t length = (_sourceSize - start < _windowSize) ? _sourceSize - start : _windowSize;
+    window.length = 0;
+    if (_blockCount > 0) {
+        if (!_decodeBlock(start / _windowSize, data, length)) return nullptr;
+    } else if (_readRaw(start, data, length) != length) {
+        return nullptr;
     }
-    size_t currentPos = _midiFile.position(); // Get current position
-    if (!_midiFile.seek(offset)) {
-         _log(MidiLogLevel::ERROR, "Peek seek failed to offset %u", offset);
-        // Don't try to restore position if seek failed
+    window.start = start;
+    window.length = length;
+    window.lastUse = ++_windowUseCounter;
+    available = length - (sourceOffset - start);
+    return data + (sourceOffset - start);
+}
+
+// Reads raw bytes from the file (the only place that touches the file handle during playback)
+uint32_t ESP32MidiPlayer::_readRaw(uint32_t fileOffset, uint8_t* buffer, uint32_t length) {
+    if (_readLatencyMicros) delayMicroseconds(_readLatencyMicros);
+    if (_blockCache) return _blockCache->read(_midiFile, _cacheFileId, fileOffset, buffer, length);
+    if (!_midiFile.seek(fileOffset)) {
+        _log(MidiLogLevel::ERROR, "Seek failed to offset %u", fileOffset);
+        // Consider stopping playback on seek fail? Maybe file closed unexpectedly.
+        stop();
         return 0;
     }
     size_t bytesRead = _midiFile.read(buffer, length);
-    if (!_midiFile.seek(currentPos)) { // Attempt to restore position
-         _log(MidiLogLevel::ERROR, "Peek failed to restore file position to %u after reading at %u", currentPos, offset);
-         stop(); // If we can't restore position, state is likely corrupted
+    _ioStats.fileReads++;
+    _ioStats.fileBytesRead += bytesRead;
+    return bytesRead;
+}
+
+// Keeps the cache block holding the track's next bytes resident while the track plays through it.
+// Compressed files are skipped: their read position does not map to a file offset.
+void ESP32MidiPlayer::_updateTrackPin(TrackInfo& track) {
+    uint32_t block = UINT32_MAX;
+    if (_blockCount == 0 && !track.endOfTrackReached) {
+        block = (_dataOffset + track.currentOffset) / _blockCache->getBlockSize();
+    }
+    if (block == track.pinnedBlock) return;
+    if (track.pinnedBlock != UINT32_MAX) _blockCache->unpin(_cacheFileId, track.pinnedBlock);
+    track.pinnedBlock = (block != UINT32_MAX && _blockCache->pin(_cacheFileId, block)) ? block : UINT32_MAX;
+}
+
+void ESP32MidiPlayer::_releaseTrackPins() {
+    for (auto& track : _tracks) {
+        if (_blockCache && track.pinnedBlock != UINT32_MAX) _blockCache->unpin(_cacheFileId, track.pinnedBlock);
+        track.pinnedBlock = UINT32_MAX;
     }
-     if (bytesRead != length) {
-        _log(MidiLogLevel::WARN, "Peek incomplete at offset %u. Requested %u, got %u. EOF?", offset, length, bytesRead);
-        // Return actual bytes read
+}
+
+// Decompresses one block of a MIDZ container
+bool ESP32MidiPlayer::_decodeBlock(uint32_t blockIndex, uint8_t* output, uint32_t outputLength) {
+    if (blockIndex >= _blockCount) return false;
+    uint8_t entry[8];
+    if (_readRaw(MIDZ_HEADER_SIZE + blockIndex * 4, entry, 8) != 8) return false;
+    uint32_t blockStart = _readBE32(entry);
+    uint32_t blockEnd = _readBE32(entry + 4);
+    if (blockEnd < blockStart || blockEnd > _midiFile.size()) {
+        _log(MidiLogLevel::ERROR, "Corrupt block table entry %u (%u..%u)", blockIndex, blockStart, blockEnd);
+        return false;
     }
-    return bytesRead;
+    uint32_t compressedLength = blockEnd - blockStart;
+    if (_compressedBlock.size() < compressedLength) _compressedBlock.resize(compressedLength);
+    if (_readRaw(blockStart, _compressedBlock.data(), compressedLength) != compressedLength) return false;
+
+    uint32_t decodeStart = _now();
+    uint32_t produced = _lzssDecode(_compressedBlock.data(), compressedLength, output, outputLength,
+                                    _lzWindowBits, _lzLookaheadBits);
+    _ioStats.decodeMicros += _now() - decodeStart;
+    _ioStats.decodedBytes += produced;
+    if (produced != outputLength) {
+        _log(MidiLogLevel::ERROR, "Block %u decoded to %u bytes, expected %u", blockIndex, produced, outputLength);
+        return false;
+    }
+    return true;
+}
+
+// Detects the container, sizes the read-ahead buffer and locates the SMF data
+bool ESP32MidiPlayer::_openContainer() {
+    _container = MidiContainer::SMF;
+    _sourceSize = _midiFile.size();
+    _windowSize = MIDI_READ_BUFFER_SIZE;
+    _blockCount = 0;
+
+    uint8_t header[MIDZ_HEADER_SIZE];
+    uint32_t headerLength = _readRaw(0, header, MIDZ_HEADER_SIZE);
+    if (!_midiFile) return false;
+    if (headerLength == MIDZ_HEADER_SIZE && _readBE32(header) == MIDZ_CONTAINER_TYPE) {
+        uint8_t version = header[4];
+        _lzWindowBits = header[5];
+        _lzLookaheadBits = header[6];
+        uint8_t blockSizeLog2 = header[7];
+        if (version != MIDZ_VERSION || _lzWindowBits < 8 || _lzWindowBits > 14 || _lzLookaheadBits < 3 ||
+            _lzLookaheadBits >= _lzWindowBits || blockSizeLog2 < 8 || blockSizeLog2 > 12) {
+            _log(MidiLogLevel::ERROR, "Unsupported compressed container (v%u, w%u, l%u, block 2^%u)",
+                 version, _lzWindowBits, _lzLookaheadBits, blockSizeLog2);
+            return false;
+        }
+        _container = MidiContainer::COMPRESSED;
+        _sourceSize = _readBE32(header + 8);
+        _windowSize = 1UL << blockSizeLog2;
+        _blockCount = (_sourceSize + _windowSize - 1) / _windowSize;
+        _log(MidiLogLevel::INFO, "Compressed container: %u -> %u bytes, %u blocks of %u",
+             (uint32_t)_midiFile.size(), _sourceSize, _blockCount, _windowSize);
+    }
+
+    _windowData.assign((size_t)_windowSize * MIDI_READ_BUFFER_COUNT, 0);
+    for (auto& window : _windows) window = ReadWindow();
+    _dataOffset = 0;
+    _dataSize = _sourceSize;
+
+    // RIFF MIDI (possibly inside the compressed container): find the 'data' chunk
+    uint8_t riff[12];
+    if (_readSource(0, riff, 12) == 12 && _readBE32(riff) == RIFF_CHUNK_TYPE) {
+        if (_readBE32(riff + 8) != RMID_FORM_TYPE) {
+            _log(MidiLogLevel::ERROR, "RIFF file is not an RMID form.");
+            return false;
+        }
+        uint32_t offset = 12;
+        while (offset + 8 <= _sourceSize) {
+            uint8_t chunk[8];
+            if (_readSource(offset, chunk, 8) != 8) return false;
+            uint32_t chunkSize = _readLE32(chunk + 4);
+            if (_readBE32(chunk) == DATA_CHUNK_TYPE) {
+                _dataOffset = offset + 8;
+                _dataSize = (chunkSize < _sourceSize - _dataOffset) ? chunkSize : _sourceSize - _dataOffset;
+                if (_container == MidiContainer::SMF) _container = MidiContainer::RMID;
+                _log(MidiLogLevel::INFO, "RMID container: SMF data at offset %u (%u bytes)", _dataOffset, _dataSize);
+                return true;
+            }
+            offset += 8 + chunkSize + (chunkSize & 1); // RIFF chunks are padded to even sizes
+        }
+        _log(MidiLogLevel::ERROR, "RMID file has no 'data' chunk.");
+        return false;
+    }
+    return true;
 }
 
 
@@ -352,12 +2371,15 @@ uint32_t ESP32MidiPlayer::_readVariableLengthQuantity(uint32_t& offset) {
 
 
 bool ESP32MidiPlayer::_parseFileHeader() {
-    uint32_t currentOffset = 0;
-    // Read MThd chunk header
-    uint32_t chunkType = _readUint32BE(currentOffset); // Offset advanced inside
-    if (!_midiFile) return false; // Check if readUint32BE stopped playback
-    uint32_t headerLength = _readUint32BE(currentOffset); // Offset advanced inside
-    if (!_midiFile) return false;
+    // MThd ID, length and the three fields in one read (the read-ahead window also picks up
+    // what follows, usually the first track chunk header)
+    uint8_t header[14];
+    if (_readBytes(0, header, sizeof(header)) != sizeof(header)) {
+        _log(MidiLogLevel::ERROR, "File too short for an MThd header.");
+        return false;
+    }
+    uint32_t chunkType = _readBE32(header);
+    uint32_t headerLength = _readBE32(header + 4);
 
     if (chunkType != MTHD_CHUNK_TYPE) {
         _log(MidiLogLevel::ERROR, "Invalid MThd chunk type (Expected 0x%08X, Got 0x%08X)", MTHD_CHUNK_TYPE, chunkType);
@@ -368,13 +2390,9 @@ bool ESP32MidiPlayer::_parseFileHeader() {
         return false;
     }
 
-    _format = _readUint16BE(currentOffset); // Offset advanced inside
-     if (!_midiFile) return false;
-    _trackCount = _readUint16BE(currentOffset); // Offset advanced inside
-     if (!_midiFile) return false;
-    _division = _readUint16BE(currentOffset); // Offset advanced inside
-     if (!_midiFile) return false;
-
+    _format = ((uint16_t)header[8] << 8) | header[9];
+    _trackCount = ((uint16_t)header[10] << 8) | header[11];
+    _division = ((uint16_t)header[12] << 8) | header[13];
 
     // We only reliably support TPQN timing for now
     if (_division & 0x8000) {
@@ -391,15 +2409,14 @@ bool ESP32MidiPlayer::_parseFileHeader() {
     }
 
     // Skip any extra header data beyond the standard 6 bytes
-    uint32_t extraData = headerLength - 6;
-    if (extraData > 0) {
-         _log(MidiLogLevel::DEBUG, "Skipping %u extra bytes in MThd header.", extraData);
-         currentOffset += extraData;
-         if (!_midiFile.seek(currentOffset)) {
-             _log(MidiLogLevel::ERROR,"Failed to seek past extra MThd header data.");
+    if (headerLength > 6) {
+         _log(MidiLogLevel::DEBUG, "Skipping %u extra bytes in MThd header.", headerLength - 6);
+         if (headerLength > _dataSize - 8) {
+             _log(MidiLogLevel::ERROR,"MThd header length exceeds file size.");
              return false;
          }
     }
+    _nextChunkOffset = 8 + headerLength; // Track chunks are searched from here
 
     return true;
 }
@@ -409,94 +2426,473 @@ bool ESP32MidiPlayer::_prepareTracks() {
         _log(MidiLogLevel::ERROR, "MIDI file header indicates 0 tracks.");
         return false;
     }
+    if (_trackCount > MIDI_MAX_TRACKS) {
+        _log(MidiLogLevel::ERROR, "MIDI file has %u tracks, at most MIDI_MAX_TRACKS (%u) are supported.", _trackCount, MIDI_MAX_TRACKS);
+        return false;
+    }
     _tracks.resize(_trackCount); // Allocate space for track info
-    uint32_t currentOffset = 6 + 8; // Start searching after MThd ID(4)+Length(4)+Data(6)
+    for (auto& track : _tracks) track.endOfTrackReached = true; // Not located yet
+    _tracksFound = 0;
+    return _discoverTracks(_lazyTrackDiscovery ? 1 : _trackCount);
+}
+
+// Walks chunk headers from _nextChunkOffset until 'count' more MTrk chunks are found, skipping
+// unknown chunks. Tracks found while the playback positions are live read their first delta
+// right away so they join the running song.
+bool ESP32MidiPlayer::_discoverTracks(uint16_t count) {
+    uint32_t fileSize = _dataSize;
+    while (count > 0 && _tracksFound < _trackCount) {
+        // Need at least 8 bytes for ID + Length
+        if (_nextChunkOffset + 8 > fileSize) {
+            _log(MidiLogLevel::ERROR, "Reached EOF while searching for MTrk header for track %u (offset %u)", _tracksFound, _nextChunkOffset);
+            return false;
+        }
+        uint8_t header[8];
+        if (_readBytes(_nextChunkOffset, header, sizeof(header)) != sizeof(header)) return false;
+        uint32_t chunkType = _readBE32(header);
+        uint32_t chunkLength = _readBE32(header + 4);
+        uint32_t dataOffset = _nextChunkOffset + 8;
+        if (chunkLength > fileSize - dataOffset) {
+            _log(MidiLogLevel::ERROR, "Chunk length (%u) at offset %u exceeds file size (%u)", chunkLength, _nextChunkOffset, fileSize);
+            return false;
+        }
+        _nextChunkOffset = dataOffset + chunkLength; // Always advances, so corrupt lengths cannot loop
+
+        if (chunkType != MTRK_CHUNK_TYPE) {
+            // Handle potential non-MTrk chunks between MThd and MTrk, or between MTrk chunks
+            char chunkTypeStr[5];
+            chunkTypeStr[0] = (chunkType >> 24) & 0xFF;
+            chunkTypeStr[1] = (chunkType >> 16) & 0xFF;
+            chunkTypeStr[2] = (chunkType >> 8) & 0xFF;
+            chunkTypeStr[3] = chunkType & 0xFF;
+            chunkTypeStr[4] = '\0';
+            _log(MidiLogLevel::WARN, "Skipping unexpected chunk type '%s' (0x%08X) at offset %u, length %u", chunkTypeStr, chunkType, dataOffset - 8, chunkLength);
+            continue;
+        }
+
+        TrackInfo& track = _tracks[_tracksFound];
+        _log(MidiLogLevel::INFO, "Found Track %u header at offset %u, data length %u", _tracksFound, dataOffset - 8, chunkLength);
+        track.startOffset = dataOffset; // Start of track *data*
+        track.currentOffset = dataOffset; // Initially same
+        track.endOffset = _nextChunkOffset;
+        track.nextEventTick = 0; // Will be read on play()
+        track.endOfTrackReached = false;
+        track.lastStatusByte = 0;
+        if (_state != PlaybackState::STOPPED || _tracksPrimed) {
+            track.nextEventTick = _readVariableLengthQuantity(track.currentOffset);
+            if (!_midiFile) return false;
+            if (_blockCache) _updateTrackPin(track);
+        }
+        _tracksFound++;
+        count--;
+    }
+    return true;
+}
+
+// --- Load-Time Indexes ---
+
+// Walks every track once without touching the playback positions and builds the
+// tempo map plus whichever optional indexes were enabled before load().
+bool ESP32MidiPlayer::_buildLoadIndexes() {
+    if (!_lyricIndexEnabled && !_noteIndexEnabled && !_meterMapEnabled && !_seekIndexEnabled) {
+        return true; // Nothing requested, keep load() as cheap as before; the tempo map stays at 120 BPM
+    }
+    if (_format == 2) {
+        _log(MidiLogLevel::INFO, "Format 2: patterns share no timeline, load-time indexes skipped.");
+        return true;
+    }
+
+    uint32_t startMillis = millis();
+
+    // Same content indexed before: restore instead of scanning every track
+    uint32_t contentKey = 0;
+    uint32_t kind = (INDEX_ARTIFACT_VERSION << 24) | (_lyricIndexEnabled ? 1 : 0) | (_noteIndexEnabled ? 2 : 0) |
+                    (_meterMapEnabled ? 8 : 0);
+    if (_seekIndexEnabled) kind |= 4 | ((_seekIndexInterval / 1000) << 4 & 0xFFFFF0); // Interval in ms
+    if (_songCache) {
+        contentKey = _songCache->checksum(_midiFile);
+        std::vector<uint8_t> artifact;
+        if (_songCache->get(contentKey, kind, artifact) && _restoreIndexes(artifact)) {
+            _log(MidiLogLevel::INFO, "Restored %u tempo changes, %u lyric lines, %u notes from the song cache in %lu ms",
+                 (unsigned)_tempoMap.size(), (unsigned)_lyricLines.size(), (unsigned)_noteIntervals.size(), millis() - startMillis);
+            return true;
+        }
+    }
 
+    LoadScanState scan;
+    if (_noteIndexEnabled) {
+        scan.openHead.assign(16 * 128, -1);
+        scan.openTail.assign(16 * 128, -1);
+    }
     for (uint16_t i = 0; i < _trackCount; ++i) {
-        bool trackFound = false;
-        // Protect against infinite loop if file is corrupt
-        uint32_t searchStartOffset = currentOffset;
-        uint32_t fileSize = _midiFile.size();
-
-        while (currentOffset < fileSize) {
-             // Need at least 8 bytes for ID + Length
-            if (currentOffset + 8 > fileSize) {
-                 _log(MidiLogLevel::ERROR, "Reached EOF while searching for MTrk header for track %u (offset %u)", i, currentOffset);
-                 return false;
-            }
+        if (!_scanTrack(i, scan)) return false;
+    }
 
-            uint32_t chunkType = _readUint32BE(currentOffset);
-            if (!_midiFile) return false; // Read error check
-            uint32_t chunkLength = _readUint32BE(currentOffset);
-             if (!_midiFile) return false; // Read error check
-
-
-            if (chunkType == MTRK_CHUNK_TYPE) {
-                 _log(MidiLogLevel::INFO, "Found Track %u header at offset %u, data length %u", i, currentOffset - 8, chunkLength);
-                _tracks[i].startOffset = currentOffset; // Start of track *data*
-                _tracks[i].currentOffset = currentOffset; // Initially same
-                _tracks[i].nextEventTick = 0; // Will be read on play()
-                _tracks[i].endOfTrackReached = false;
-                _tracks[i].lastStatusByte = 0;
-
-                // Skip over this track's data to find the next one
-                currentOffset += chunkLength;
-                 // Basic sanity check for chunk length
-                 if (currentOffset > fileSize) {
-                      _log(MidiLogLevel::ERROR, "Track %u chunk length (%u) exceeds file size (%u) from offset %u", i, chunkLength, fileSize, _tracks[i].startOffset);
-                      return false;
-                 }
-                trackFound = true;
-                break; // Found track i, move to next outer loop iteration
+    _buildTempoMap(scan);
+    if (_meterMapEnabled) _buildMeterMap(scan);
+    if (_lyricIndexEnabled) _buildLyricTimeline(scan);
+    if (_noteIndexEnabled) _buildNoteIndex(scan);
+    if (_seekIndexEnabled && !_buildSeekIndex()) return false;
+
+    _log(MidiLogLevel::INFO, "Indexed %u tempo changes, %u time signatures, %u lyric lines (%u syllables), %u notes in %lu ms",
+         (unsigned)_tempoMap.size(), (unsigned)_meterMap.size(), (unsigned)_lyricLines.size(),
+         (unsigned)_lyricSyllables.size(), (unsigned)_noteIntervals.size(), millis() - startMillis);
+
+    if (_songCache) {
+        std::vector<uint8_t> artifact;
+        _saveIndexes(artifact);
+        if (!_songCache->put(contentKey, kind, artifact.data(), artifact.size())) {
+            _log(MidiLogLevel::WARN, "Could not store %u bytes of indexes in the song cache.", (unsigned)artifact.size());
+        }
+    }
+    return true;
+}
+
+void ESP32MidiPlayer::_saveIndexes(std::vector<uint8_t>& artifact) const {
+    _appendSection(artifact, _tempoMap);
+    _appendSection(artifact, _lyricSyllables);
+    _appendSection(artifact, _lyricLines);
+    _appendSection(artifact, _lyricPool);
+    _appendSection(artifact, _noteIntervals);
+    _appendSection(artifact, _noteMaxEnd);
+    _appendSection(artifact, _meterMap);
+    _appendSection(artifact, _seekCheckpoints);
+    _appendSection(artifact, _seekTrackStates);
+    _appendSection(artifact, _seekChasePool);
+}
+
+bool ESP32MidiPlayer::_restoreIndexes(const std::vector<uint8_t>& artifact) {
+    size_t position = 0;
+    bool valid = _readSection(artifact, position, _tempoMap) && !_tempoMap.empty() &&
+                 _readSection(artifact, position, _lyricSyllables) &&
+                 _readSection(artifact, position, _lyricLines) &&
+                 _readSection(artifact, position, _lyricPool) &&
+                 _readSection(artifact, position, _noteIntervals) &&
+                 _readSection(artifact, position, _noteMaxEnd) &&
+                 _noteMaxEnd.size() == _noteIntervals.size() &&
+                 _readSection(artifact, position, _meterMap) && !_meterMap.empty() &&
+                 _readSection(artifact, position, _seekCheckpoints) &&
+                 _readSection(artifact, position, _seekTrackStates) &&
+                 _readSection(artifact, position, _seekChasePool) &&
+                 _seekTrackStates.size() == _seekCheckpoints.size() * _tracks.size() && position == artifact.size();
+    if (!valid) {
+        // Built by a different build (struct layout): fall back to scanning
+        _tempoMap.clear();
+        _tempoMap.push_back({0, 0, DEFAULT_TEMPO});
+        _lyricSyllables.clear();
+        _lyricLines.clear();
+        _lyricPool.clear();
+        _noteIntervals.clear();
+        _noteMaxEnd.clear();
+        _meterMap.clear();
+        _meterMap.push_back({0, 0, 4, 2});
+        _seekCheckpoints.clear();
+        _seekTrackStates.clear();
+        _seekChasePool.clear();
+    }
+    return valid;
+}
+
+// Parses one track from start to end, collecting the events the indexes need.
+bool ESP32MidiPlayer::_scanTrack(uint16_t trackIndex, LoadScanState& scan) {
+    const TrackInfo& track = _tracks[trackIndex];
+    uint32_t offset = track.startOffset;
+    uint64_t tick = 0;
+    uint8_t runningStatus = 0;
+
+    while (offset < track.endOffset) {
+        tick += _readVariableLengthQuantity(offset);
+        if (!_midiFile) return false;
+        uint8_t statusByte = _readUint8(offset);
+        if (!_midiFile) return false;
+
+        if (statusByte < 0xF0) { // Channel Voice/Mode message, possibly using running status
+            uint8_t data1;
+            if (statusByte < 0x80) {
+                if (runningStatus == 0) {
+                    _log(MidiLogLevel::WARN, "Index scan T%u: data byte without running status at offset %u, ignoring rest of track.", trackIndex, offset - 1);
+                    break; // Playback reports the same problem; don't fail the load over it
+                }
+                data1 = statusByte; // The byte we read was data1
+                statusByte = runningStatus;
             } else {
-                // Handle potential non-MTrk chunks between MThd and MTrk, or between MTrk chunks
-                char chunkTypeStr[5];
-                chunkTypeStr[0] = (chunkType >> 24) & 0xFF;
-                chunkTypeStr[1] = (chunkType >> 16) & 0xFF;
-                chunkTypeStr[2] = (chunkType >> 8) & 0xFF;
-                chunkTypeStr[3] = chunkType & 0xFF;
-                chunkTypeStr[4] = '\0';
-                 _log(MidiLogLevel::WARN, "Skipping unexpected chunk type '%s' (0x%08X) at offset %u, length %u", chunkTypeStr, chunkType, currentOffset - 8, chunkLength);
-                 currentOffset += chunkLength; // Skip over this unknown chunk
-                 // Sanity check
-                  if (currentOffset > fileSize) {
-                      _log(MidiLogLevel::ERROR, "Unexpected chunk '%s' length (%u) exceeds file size (%u) from offset %u", chunkTypeStr, chunkLength, fileSize, currentOffset - chunkLength - 8);
-                      return false;
-                 }
+                runningStatus = statusByte;
+                data1 = _readUint8(offset);
+                if (!_midiFile) return false;
             }
-
-            // Prevent infinite loop on corrupt files where offset doesn't advance
-            if(currentOffset <= searchStartOffset && chunkLength == 0 && chunkType != MTRK_CHUNK_TYPE){
-                _log(MidiLogLevel::ERROR, "Detected potential infinite loop parsing chunks near offset %u. Aborting.", currentOffset);
-                return false;
+            uint8_t command = statusByte & 0xF0;
+            if (command == 0xC0 || command == 0xD0) continue; // Single data byte
+            uint8_t data2 = _readUint8(offset);
+            if (!_midiFile) return false;
+            if (_noteIndexEnabled && (command == 0x80 || command == 0x90)) {
+                _indexNote(scan, trackIndex, (uint32_t)tick, statusByte & 0x0F, data1, (command == 0x90) ? data2 : 0);
+            }
+        } else if (statusByte == META_EVENT) {
+            uint8_t metaType = _readUint8(offset);
+            if (!_midiFile) return false;
+            uint32_t length = _readVariableLengthQuantity(offset);
+            if (!_midiFile) return false;
+
+            if (metaType == META_END_OF_TRACK) {
+                break;
+            } else if (metaType == META_TEMPO && length == 3) {
+                uint8_t buffer[3];
+                if (_readBytes(offset, buffer, 3) == 3) {
+                    uint32_t tempo = ((uint32_t)buffer[0] << 16) | ((uint32_t)buffer[1] << 8) | buffer[2];
+                    if (tempo > 0) scan.tempos.push_back({(uint32_t)tick, tempo, metaType, 0, trackIndex});
+                }
+            } else if (_meterMapEnabled && metaType == META_TIME_SIGNATURE && length >= 2) {
+                uint8_t buffer[2];
+                if (_readBytes(offset, buffer, 2) == 2 && buffer[0] > 0 && buffer[1] <= 6) { // Up to 64th-note beats
+                    scan.meters.push_back({(uint32_t)tick, (uint32_t)buffer[0] | ((uint32_t)buffer[1] << 8), metaType, 0, trackIndex});
+                }
+            } else if (_lyricIndexEnabled && (metaType == META_LYRIC || metaType == META_TEXT) && length > 0) {
+                uint8_t textLength = (length > MAX_LYRIC_TEXT_LENGTH) ? MAX_LYRIC_TEXT_LENGTH : (uint8_t)length;
+                uint32_t textOffset = scan.text.size();
+                scan.text.resize(textOffset + textLength);
+                if (_readBytes(offset, (uint8_t*)&scan.text[textOffset], textLength) != textLength) {
+                    scan.text.resize(textOffset);
+                } else if (metaType == META_TEXT && scan.text[textOffset] == '@') {
+                    // .kar header (@K marker, @T title, @L language, ...), not a syllable
+                    if (textLength > 1 && scan.text[textOffset + 1] == 'K') scan.hasKaraokeMarker = true;
+                    scan.text.resize(textOffset);
+                } else {
+                    if (metaType == META_LYRIC) scan.hasLyricEvents = true;
+                    scan.texts.push_back({(uint32_t)tick, textOffset, metaType, textLength, trackIndex});
+                }
             }
-            searchStartOffset = currentOffset; // Update for next iteration check
+            offset += length;
+        } else if (statusByte == SYSEX_START || statusByte == SYSEX_END) {
+            uint32_t length = _readVariableLengthQuantity(offset);
+            if (!_midiFile) return false;
+            offset += length;
+            runningStatus = 0;
+        } else {
+            runningStatus = 0; // Other system messages carry no data in files
         }
-        if (!trackFound) {
-             _log(MidiLogLevel::ERROR, "Could not find MTrk chunk for track %u after offset %u", i, searchStartOffset);
-             return false;
+    }
+
+    if (_noteIndexEnabled) {
+        // Notes still held at the end of the track end there
+        for (size_t key = 0; key < scan.openHead.size(); ++key) {
+            for (int32_t i = scan.openHead[key]; i >= 0; i = scan.nextOpen[i]) {
+                _noteIntervals[i].endMicros = (uint32_t)tick;
+            }
+            scan.openHead[key] = -1;
+            scan.openTail[key] = -1;
         }
     }
     return true;
 }
 
-// Calculate elapsed ticks based on micros()
-void ESP32MidiPlayer::_advanceTickTime() {
-    uint64_t now = micros();
-
-    // Handle potential micros() rollover (every ~71 minutes)
-    // A simple check: if 'now' is less than 'last', assume rollover.
-    // Note: This isn't perfectly robust if loop iterations are very long,
-    // but usually sufficient for Arduino.
-    uint64_t deltaMicros;
-    if (now >= _lastEventMicros) {
-        deltaMicros = now - _lastEventMicros;
-    } else {
-        // Rollover occurred
-        deltaMicros = (UINT64_MAX - _lastEventMicros) + 1 + now;
-        _log(MidiLogLevel::DEBUG, "micros() rollover detected.");
+// Pairs Note On/Off per track, channel and key. Overlapping Note Ons of the same key are
+// closed first-in first-out. Times are kept in ticks here and converted in _buildNoteIndex().
+void ESP32MidiPlayer::_indexNote(LoadScanState& scan, uint16_t trackIndex, uint32_t tick, uint8_t channel, uint8_t note, uint8_t velocity) {
+    size_t key = (size_t)channel * 128 + (note & 0x7F);
+    if (velocity > 0) {
+        MidiNoteInterval interval;
+        interval.startMicros = tick;
+        interval.endMicros = UINT32_MAX;
+        interval.channel = channel;
+        interval.note = note;
+        interval.velocity = velocity;
+        interval.track = (uint8_t)trackIndex;
+        int32_t index = (int32_t)_noteIntervals.size();
+        _noteIntervals.push_back(interval);
+        scan.nextOpen.push_back(-1);
+        if (scan.openTail[key] >= 0) scan.nextOpen[scan.openTail[key]] = index;
+        else scan.openHead[key] = index;
+        scan.openTail[key] = index;
+    } else if (scan.openHead[key] >= 0) {
+        int32_t index = scan.openHead[key];
+        _noteIntervals[index].endMicros = tick;
+        scan.openHead[key] = scan.nextOpen[index];
+        if (scan.openHead[key] < 0) scan.openTail[key] = -1;
+    }
+}
+
+// Converts the paired notes from ticks to song time, sorts them and builds the running max end
+void ESP32MidiPlayer::_buildNoteIndex(LoadScanState& scan) {
+    scan.nextOpen.clear();
+    scan.nextOpen.shrink_to_fit();
+    for (MidiNoteInterval& note : _noteIntervals) {
+        note.startMicros = (uint32_t)tickToMicros(note.startMicros);
+        note.endMicros = (uint32_t)tickToMicros(note.endMicros);
+        if (note.endMicros <= note.startMicros) note.endMicros = note.startMicros + 1;
+    }
+    std::stable_sort(_noteIntervals.begin(), _noteIntervals.end(),
+                     [](const MidiNoteInterval& a, const MidiNoteInterval& b) { return a.startMicros < b.startMicros; });
+    _noteIntervals.shrink_to_fit();
+
+    _noteMaxEnd.resize(_noteIntervals.size());
+    uint32_t maxEnd = 0;
+    for (size_t i = 0; i < _noteIntervals.size(); ++i) {
+        if (_noteIntervals[i].endMicros > maxEnd) maxEnd = _noteIntervals[i].endMicros;
+        _noteMaxEnd[i] = maxEnd;
+    }
+}
+
+void ESP32MidiPlayer::_buildTempoMap(LoadScanState& scan) {
+    // Tempo events may live on any track; order them by tick (track order breaks ties)
+    std::stable_sort(scan.tempos.begin(), scan.tempos.end(),
+                     [](const LoadScanEvent& a, const LoadScanEvent& b) { return a.tick < b.tick; });
+
+    _tempoMap.clear();
+    _tempoMap.push_back({0, 0, DEFAULT_TEMPO});
+    for (const LoadScanEvent& e : scan.tempos) {
+        TempoMapEntry& last = _tempoMap.back();
+        if (e.tick == last.tick) {
+            last.tempo = e.value; // Later change at the same tick wins
+            continue;
+        }
+        uint64_t micros = last.micros + (uint64_t)(e.tick - last.tick) * last.tempo / _division;
+        _tempoMap.push_back({e.tick, micros, e.value});
+    }
+}
+
+// Time signatures may live on any track too. A change in the middle of a bar cuts that bar short
+// and starts a new one, which is how sequencers count bars around odd signature placements.
+void ESP32MidiPlayer::_buildMeterMap(LoadScanState& scan) {
+    std::stable_sort(scan.meters.begin(), scan.meters.end(),
+                     [](const LoadScanEvent& a, const LoadScanEvent& b) { return a.tick < b.tick; });
+
+    _meterMap.clear();
+    _meterMap.push_back({0, 0, 4, 2});
+    for (const LoadScanEvent& e : scan.meters) _appendMeter(e.tick, (uint8_t)e.value, (uint8_t)(e.value >> 8));
+}
+
+void ESP32MidiPlayer::_appendMeter(uint64_t tick, uint8_t numerator, uint8_t denominatorPow2) {
+    MeterMapEntry& last = _meterMap.back();
+    if (tick == last.tick) {
+        last.numerator = numerator; // Later change at the same tick wins
+        last.denominatorPow2 = denominatorPow2;
+        return;
+    }
+    uint64_t ticksPerBar = (uint64_t)_ticksPerBeat(last) * last.numerator;
+    uint64_t span = tick - last.tick;
+    if (numerator == last.numerator && denominatorPow2 == last.denominatorPow2 && span % ticksPerBar == 0) return; // Restated
+    _meterMap.push_back({tick, last.bar + (uint32_t)((span + ticksPerBar - 1) / ticksPerBar), numerator, denominatorPow2});
+}
+
+// Turns collected text events into syllables grouped into lines, using the .kar conventions:
+// a leading '\' starts a new page, a leading '/' starts a new line, and a trailing CR/LF ends the line.
+void ESP32MidiPlayer::_buildLyricTimeline(LoadScanState& scan) {
+    // Prefer real Lyric events; fall back to Text events only for karaoke (.kar) files
+    uint8_t sourceType = scan.hasLyricEvents ? META_LYRIC : (scan.hasKaraokeMarker ? META_TEXT : 0);
+    if (sourceType == 0) return;
+
+    std::stable_sort(scan.texts.begin(), scan.texts.end(),
+                     [](const LoadScanEvent& a, const LoadScanEvent& b) { return a.tick < b.tick; });
+
+    bool breakPending = true;  // The first syllable always opens a line
+    bool pagePending = true;
+    for (const LoadScanEvent& e : scan.texts) {
+        if (e.type != sourceType) continue;
+        const char* text = &scan.text[e.value];
+        uint8_t length = e.length;
+
+        // Leading break markers
+        while (length > 0 && (*text == '\\' || *text == '/')) {
+            breakPending = true;
+            if (*text == '\\') pagePending = true;
+            text++;
+            length--;
+        }
+        // Trailing line ends apply to the next syllable
+        bool breakAfter = false;
+        while (length > 0 && (text[length - 1] == '\r' || text[length - 1] == '\n')) {
+            breakAfter = true;
+            length--;
+        }
+
+        if (length > 0) {
+            if (breakPending || _lyricLines.empty()) {
+                if (!_lyricLines.empty()) _lyricPool.push_back('\0'); // Terminate previous line
+                _lyricLines.push_back({(uint32_t)_lyricPool.size(), (uint16_t)_lyricSyllables.size(), 0, pagePending});
+                breakPending = false;
+                pagePending = false;
+            }
+            LyricLineInfo& line = _lyricLines.back();
+            MidiLyricSyllable syllable;
+            syllable.tick = e.tick;
+            syllable.micros = (uint32_t)tickToMicros(e.tick);
+            syllable.line = (uint16_t)(_lyricLines.size() - 1);
+            syllable.textOffset = (uint16_t)(_lyricPool.size() - line.textOffset);
+            syllable.length = length;
+            _lyricSyllables.push_back(syllable);
+            line.syllableCount++;
+            _lyricPool.insert(_lyricPool.end(), text, text + length);
+        }
+        if (breakAfter) breakPending = true;
+    }
+    if (!_lyricLines.empty()) _lyricPool.push_back('\0');
+
+    // Timelines are built once; give back the slack
+    _lyricSyllables.shrink_to_fit();
+    _lyricLines.shrink_to_fit();
+    _lyricPool.shrink_to_fit();
+}
+
+uint64_t ESP32MidiPlayer::_dueMicros(uint64_t tick) const {
+    // _lastEventMicros (plus the remainder) is the wall time at which _currentTick started
+    uint64_t units = _tempoUnits(_currentTick, tick);
+    if (_playbackRate != 1.0) units = (uint64_t)(units / _playbackRate + 0.5);
+    uint16_t division = _division ? _division : 96;
+    return _lastEventMicros + (units + _lastEventRemainder + division - 1) / division;
+}
+
+// loop() stalled: measure how overdue the earliest event is and apply the late policy
+void ESP32MidiPlayer::_handleLateness(uint64_t now) {
+    int nextTrackIdx = _findTrackWithNextEvent();
+    if (nextTrackIdx < 0 || _division == 0) return;
+    uint64_t nextTick = _tracks[nextTrackIdx].nextEventTick;
+    if (nextTick < _currentTick) nextTick = _currentTick;
+    uint64_t due = _dueMicros(nextTick);
+    if (now <= due + _maxLateMicros) return;
+
+    uint64_t late = now - due;
+    _lateStats.lateTicks++;
+    if (late > _lateStats.maxLateMicros) _lateStats.maxLateMicros = (late > UINT32_MAX) ? UINT32_MAX : (uint32_t)late;
+
+    if (_latePolicy == MidiLatePolicy::SHIFT) {
+        // As if playback had been paused for the stall: the first overdue event becomes due now
+        _lastEventMicros += late;
+        _playbackStartMicros += late;
+        _lateStats.shifts++;
+        _lateStats.shiftedMicros += late;
+        _log(MidiLogLevel::DEBUG, "Stall of %llu us absorbed by shifting the timeline.", late);
+    } else if (_latePolicy == MidiLatePolicy::DROP_NOTES) {
+        // Last tick that was due more than the threshold ago
+        uint64_t units = (now - _maxLateMicros - _lastEventMicros) * _division;
+        units = (units > _lastEventRemainder) ? units - _lastEventRemainder : 0;
+        if (_playbackRate != 1.0) units = (uint64_t)(units * _playbackRate);
+        uint64_t usedUnits;
+        _lateDropTick = _currentTick + _walkTempo(_currentTick, units, usedUnits);
+        _dropLateNotes = true;
+    }
+}
+
+bool ESP32MidiPlayer::_dropLateNote(const MidiEvent& event) {
+    uint8_t command = event.command();
+    if (command != 0x80 && command != 0x90) return false;
+    uint32_t& keys = _droppedKeys[event.channel()][(event.data1 >> 5) & 3];
+    uint32_t bit = 1UL << (event.data1 & 31);
+    if (command == 0x90 && event.data2 > 0) {
+        if (!_dropLateNotes || event.tick > _lateDropTick) return false;
+        keys |= bit;
+        _lateStats.droppedNotes++;
+        return true;
     }
+    if (!(keys & bit)) return false;
+    keys &= ~bit; // Note Off of a skipped note
+    return true;
+}
 
+// Calculate elapsed ticks based on the time source (64-bit and monotonic, so no rollover handling)
+void ESP32MidiPlayer::_advanceTickTime() {
+    uint64_t now = _now();
+    if (now <= _lastEventMicros) return;
+    uint64_t deltaMicros = now - _lastEventMicros;
 
     // Calculate microseconds per tick
     // Avoid division by zero if division is somehow invalid
@@ -507,32 +2903,36 @@ void ESP32MidiPlayer::_advanceTickTime() {
          }
         _division = 96;
     }
-    // Use double for precision in calculation, especially for high TPQN or slow tempos
-    double microsPerTick = (double)_microsecondsPerQuarterNote / _division;
-
-    if (microsPerTick > 0) {
-        // Calculate how many ticks should have passed
-        uint64_t ticksElapsed = (uint64_t)(deltaMicros / microsPerTick);
-
-        if (ticksElapsed > 0) {
-            _currentTick += ticksElapsed;
-            // Adjust _lastEventMicros precisely, avoiding drift accumulation
-            // Use the calculated microsPerTick for the adjustment
-            _lastEventMicros += (uint64_t)(ticksElapsed * microsPerTick);
-
-            // Minor adjustment: If rollover occurred, _lastEventMicros might now be
-            // slightly off due to calculation order. Re-syncing is complex.
-            // The current approach minimizes drift but might have tiny jumps near rollover.
-             // _log(MidiLogLevel::VERBOSE, "Advanced %llu ticks based on %llu us. New tick: %llu", ticksElapsed, deltaMicros, _currentTick);
-        }
-    }
-     // Optional: Log if microsPerTick is zero (should only happen if tempo is 0, which is invalid MIDI)
-     else if (_microsecondsPerQuarterNote == 0) {
-         if (!_tempoWarningLogged) { // Log only once
+    if (_microsecondsPerQuarterNote == 0) { // Should only happen if tempo is 0, which is invalid MIDI
+        if (!_tempoWarningLogged) { // Log only once
             _log(MidiLogLevel::WARN, "Tempo is zero (usPerQN = 0), timing stalled.");
             _tempoWarningLogged = true;
-         }
-     }
+        }
+        return;
+    }
+
+    // Integer clock: time is counted in us * division units, so a tick is exactly 'tempo' units
+    // and nothing is lost to rounding between calls. The parts of a microsecond already consumed
+    // (wall) or not yet reported (song position) are carried in the remainders.
+    uint64_t wallUnits = deltaMicros * _division;
+    if (wallUnits <= _lastEventRemainder) return;
+    wallUnits -= _lastEventRemainder;
+    uint64_t songUnits = (_playbackRate == 1.0) ? wallUnits : (uint64_t)(wallUnits * _playbackRate);
+
+    // Constant tempo is one division; on tempo ramps every tick has its own length
+    uint64_t usedUnits;
+    uint64_t ticksElapsed = _walkTempo(_currentTick, songUnits, usedUnits);
+    if (ticksElapsed == 0) return;
+    _currentTick += ticksElapsed;
+
+    uint64_t usedWallUnits = (_playbackRate == 1.0) ? usedUnits : (uint64_t)(usedUnits / _playbackRate + 0.5);
+    usedWallUnits += _lastEventRemainder;
+    _lastEventMicros += usedWallUnits / _division;
+    _lastEventRemainder = usedWallUnits % _division;
+    uint64_t positionUnits = usedUnits + _positionRemainder;
+    _positionMicros += positionUnits / _division; // Song time ignores the rate
+    _positionRemainder = positionUnits % _division;
+    if (!_tempoPoints.empty()) _updateTempo();
 }
 
 // Find the track with the smallest nextEventTick that hasn't ended
@@ -540,12 +2940,12 @@ int ESP32MidiPlayer::_findTrackWithNextEvent() const {
     int nextTrack = -1;
     uint64_t earliestTick = UINT64_MAX;
 
-    for (int i = 0; i < _tracks.size(); ++i) {
+    for (size_t i = 0; i < _tracks.size(); ++i) {
         if (!_tracks[i].endOfTrackReached) {
              // If multiple tracks have the same earliest tick, prefer lower track index (standard practice)
             if (_tracks[i].nextEventTick < earliestTick) {
                 earliestTick = _tracks[i].nextEventTick;
-                nextTrack = i;
+                nextTrack = (int)i;
             }
         }
     }
@@ -568,6 +2968,7 @@ void ESP32MidiPlayer::_processNextEvent() {
 
     // Log the offset *before* reading anything for this event
     uint32_t eventStartOffset = track.currentOffset;
+    _ioStats.events++;
 
     // Read the first byte (status or data1)
     uint8_t firstByte = _readUint8(track.currentOffset);
@@ -671,7 +3072,6 @@ void ESP32MidiPlayer::_handleMidiEvent(uint8_t trackIndex, uint8_t statusByte, u
     uint8_t channel = statusByte & 0x0F;
     uint8_t data1 = data1_val; // Use value passed if running status was used
     uint8_t data2 = 0;
-    uint32_t offsetBeforeDataRead = trackOffset; // For logging
 
     _log(MidiLogLevel::DEBUG, "_handleMidiEvent T%d: Status=0x%02X, Ch=%u, Cmd=0x%02X, Running=%s, Offset=%u",
          trackIndex, statusByte, channel, command, runningStatusUsed ? "true" : "false", trackOffset);
@@ -721,13 +3121,42 @@ void ESP32MidiPlayer::_handleMidiEvent(uint8_t trackIndex, uint8_t statusByte, u
           trackIndex, data1, data1, data2, data2, trackOffset);
 
 
+    // --- Hand the event to callbacks and sinks ---
+    TrackInfo& track = _tracks[trackIndex];
+    track.channelPrefix = 0xFF; // A channel message ends the scope of a Channel Prefix
+    MidiEvent event;
+    event.tick = track.nextEventTick; // Still the tick of the event being processed
+    event.micros = _positionMicros;
+    event.status = statusByte;
+    event.data1 = data1;
+    event.data2 = data2;
+    if (_previewEndMicros && (statusByte & 0xF0) == 0x90 && data2 > 0) event.data2 = _previewVelocity(data2);
+    event.port = track.port;
+    event.track = trackIndex;
+    if (_latePolicy == MidiLatePolicy::DROP_NOTES && !_chasing && _dropLateNote(event)) return;
+    _dispatchEvent(event);
+}
+
+// Single delivery point for channel messages: active note state, callbacks, then the port sink
+void ESP32MidiPlayer::_dispatchEvent(const MidiEvent& event) {
+    if (_chasing) { // Seeking: remember state, sound nothing
+        _recordChase(event);
+        return;
+    }
+    uint8_t channel = event.channel();
+    uint8_t data1 = event.data1;
+    uint8_t data2 = event.data2;
+    uint8_t trackIndex = event.track;
+
     // --- Call appropriate callback (if registered) ---
-    switch (command) {
+    switch (event.command()) {
         case 0x80: // Note Off
              _log(MidiLogLevel::DEBUG, "CALL T%d: NoteOff Ch=%u Note=%u Vel=%u", trackIndex, channel + 1, data1, data2);
+            if (_activeNotes) _trackActiveNote(channel, data1, 0);
             if (_noteOffCallback) _noteOffCallback(channel, data1, data2);
             break;
         case 0x90: // Note On
+            if (_activeNotes) _trackActiveNote(channel, data1, data2);
             if (data2 == 0) { // Velocity 0 is Note Off
                  _log(MidiLogLevel::DEBUG, "CALL T%d: NoteOff (Vel 0) Ch=%u Note=%u Vel=%u", trackIndex, channel + 1, data1, data2);
                 if (_noteOffCallback) _noteOffCallback(channel, data1, 0);
@@ -742,6 +3171,7 @@ void ESP32MidiPlayer::_handleMidiEvent(uint8_t trackIndex, uint8_t statusByte, u
             break;
         case 0xB0: // Control Change
              _log(MidiLogLevel::DEBUG, "CALL T%d: ControlChange Ch=%u CC=%u Val=%u", trackIndex, channel + 1, data1, data2);
+            if (_activeNotes && (data1 == 120 || data1 == 123)) _clearActiveNotes(channel); // All Sound/Notes Off
             if (_controlChangeCallback) _controlChangeCallback(channel, data1, data2);
             break;
         case 0xC0: // Program Change
@@ -763,6 +3193,31 @@ void ESP32MidiPlayer::_handleMidiEvent(uint8_t trackIndex, uint8_t statusByte, u
             }
             break;
     }
+
+    // --- Routing matrix: every sink routed for this track/channel (constant time lookup) ---
+    size_t slot = ((trackIndex == MIDI_INPUT_TRACK) ? _tracks.size() : trackIndex) * 16 + channel;
+    RouteMask routes = (slot < _routeTable.size()) ? _routeTable[slot] : 0;
+    if (routes) {
+        for (uint8_t index = 0; routes; ++index, routes >>= 1) {
+            if (!(routes & 1)) continue;
+            if (!_routeBatches) {
+                _routeSinks[index]->onMidiEvent(event);
+                continue;
+            }
+            RouteBatch& batch = _routeBatches[index];
+            batch.events[batch.count++] = event;
+            if (batch.count == MIDI_ROUTE_BATCH_SIZE) {
+                _routeSinks[index]->onMidiEventBatch(batch.events, batch.count);
+                batch.count = 0;
+            }
+        }
+        return;
+    }
+
+    // --- Route to the sink of the event's port (constant time) ---
+    MidiEventSink* sink = (event.port < MIDI_MAX_PORTS) ? _portSinks[event.port] : nullptr;
+    if (!sink) sink = _defaultSink;
+    if (sink) sink->onMidiEvent(event);
 }
 
 
@@ -782,7 +3237,7 @@ void ESP32MidiPlayer::_handleMetaEvent(uint8_t trackIndex, uint32_t& trackOffset
                 _tracks[trackIndex].endOfTrackReached = true;
                 _finishedTracks++;
                  _log(MidiLogLevel::INFO, "Track %u reached EndOfTrack (Total finished: %u/%u)", trackIndex, _finishedTracks, _trackCount);
-                if (_endOfTrackCallback) {
+                if (_endOfTrackCallback && !_chasing) {
                     _endOfTrackCallback(trackIndex);
                 }
             } else {
@@ -807,10 +3262,11 @@ void ESP32MidiPlayer::_handleMetaEvent(uint8_t trackIndex, uint32_t& trackOffset
                      if (newTempo == 0) {
                          _log(MidiLogLevel::WARN, "Track %u requested Tempo of 0 us/qn (invalid). Ignoring change.", trackIndex);
                      } else {
-                         _microsecondsPerQuarterNote = newTempo;
+                         _fileTempo = newTempo;
+                         _updateTempo(); // Automation may override it
                           double bpm = 60000000.0 / _microsecondsPerQuarterNote;
                          _log(MidiLogLevel::DEBUG, "Tempo changed to %u us/qn (%.2f BPM)", _microsecondsPerQuarterNote, bpm);
-                         if (_tempoChangeCallback) {
+                         if (_tempoChangeCallback && !_chasing) {
                              _tempoChangeCallback(_microsecondsPerQuarterNote);
                          }
                          _tempoWarningLogged = false; // Reset warning flag if tempo becomes valid again
@@ -846,7 +3302,12 @@ void ESP32MidiPlayer::_handleMetaEvent(uint8_t trackIndex, uint32_t& trackOffset
                      uint16_t denominator = (1 << denominator_pow2);
                       _log(MidiLogLevel::DEBUG, "Time Signature: %u/%u, Clocks/Met: %u, 32nds/QN: %u", numerator, denominator, clocks_per_metronome, num_32nd_notes_per_beat);
 
-                     if (_timeSignatureCallback) {
+                     // Format 2 has no load-time meter map; patterns add their signatures as they play
+                     if (_format == 2 && _tracks[trackIndex].nextEventTick >= _meterMap.back().tick) {
+                         _appendMeter(_tracks[trackIndex].nextEventTick, numerator, denominator_pow2);
+                     }
+
+                     if (_timeSignatureCallback && !_chasing) {
                          // Pass the raw denominator power value as some synths might use it directly
                          _timeSignatureCallback(numerator, denominator_pow2, clocks_per_metronome, num_32nd_notes_per_beat);
                      }
@@ -861,6 +3322,27 @@ void ESP32MidiPlayer::_handleMetaEvent(uint8_t trackIndex, uint32_t& trackOffset
             }
             break;
 
+        case META_CHANNEL_PREFIX: // 0x20 Following meta/SysEx events belong to this channel
+        case META_PORT_PREFIX:    // 0x21 MIDI port (output cable) of this track's channel messages
+            if (length == 1) {
+                uint8_t value = _readUint8(trackOffset);
+                if (!_midiFile) return;
+                if (metaType == META_PORT_PREFIX) {
+                    _tracks[trackIndex].port = value;
+                    _log(MidiLogLevel::DEBUG, "Track %u routed to MIDI port %u", trackIndex, value);
+                    if (value >= MIDI_MAX_PORTS) {
+                        _log(MidiLogLevel::WARN, "Track %u uses port %u beyond MIDI_MAX_PORTS (%u); it goes to the default sink.", trackIndex, value, MIDI_MAX_PORTS);
+                    }
+                } else {
+                    _tracks[trackIndex].channelPrefix = value & 0x0F;
+                    _log(MidiLogLevel::DEBUG, "Track %u channel prefix %u", trackIndex, value & 0x0F);
+                }
+            } else {
+                _log(MidiLogLevel::WARN, "Invalid prefix meta event 0x%02X length %u on track %u. Skipping.", metaType, length, trackIndex);
+                trackOffset += length;
+            }
+            break;
+
         // Add cases for other common meta events if needed (Text, Copyright, Track Name, etc.)
          case META_TRACK_NAME: // 0x03 Sequence/Track Name
             {
@@ -887,14 +3369,9 @@ void ESP32MidiPlayer::_handleMetaEvent(uint8_t trackIndex, uint32_t& trackOffset
             // Unknown or unhandled meta event, just skip over its data
              _log(MidiLogLevel::DEBUG, "Skipping unhandled Meta Event Type 0x%02X, Length %u on track %u", metaType, length, trackIndex);
             trackOffset += length;
-            // Sanity check seek position
-             if (trackOffset > _midiFile.size()) {
-                  _log(MidiLogLevel::ERROR, "Error skipping meta event 0x%02X: Offset %u exceeds file size %u.", metaType, trackOffset, _midiFile.size());
-                  stop();
-                  return;
-             }
-             if (_midiFile && !_midiFile.seek(trackOffset)) { // Ensure file pointer is updated
-                  _log(MidiLogLevel::ERROR, "Failed to seek past meta event 0x%02X data.", metaType);
+            // Sanity check new position
+             if (trackOffset > _dataSize) {
+                  _log(MidiLogLevel::ERROR, "Error skipping meta event 0x%02X: Offset %u exceeds file size %u.", metaType, trackOffset, _dataSize);
                   stop();
                   return;
              }
@@ -933,14 +3410,9 @@ void ESP32MidiPlayer::_handleSysexEvent(uint8_t trackIndex, uint8_t type, uint32
 
     trackOffset += length; // Skip SysEx data
 
-     // Sanity check seek position
-     if (trackOffset > _midiFile.size()) {
-          _log(MidiLogLevel::ERROR, "Error skipping SysEx event 0x%02X: Offset %u exceeds file size %u.", type, trackOffset, _midiFile.size());
-          stop();
-          return;
-     }
-     if (_midiFile && !_midiFile.seek(trackOffset)) { // Ensure file pointer is updated
-          _log(MidiLogLevel::ERROR, "Failed to seek past SysEx event 0x%02X data.", type);
+     // Sanity check new position
+     if (trackOffset > _dataSize) {
+          _log(MidiLogLevel::ERROR, "Error skipping SysEx event 0x%02X: Offset %u exceeds file size %u.", type, trackOffset, _dataSize);
           stop();
           return;
      }
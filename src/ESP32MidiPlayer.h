@@ -5,6 +5,44 @@
 #include <FS.h>
 #include <vector>
 #include <cstdarg> // For va_list
+#include <atomic>  // For cross-core snapshots
+#if defined(__linux__) && !defined(ESP32)
+#include <thread>  // Prefetch worker on host builds
+#endif
+
+// --- Output Routing Configuration ---
+#ifndef MIDI_MAX_PORTS
+#define MIDI_MAX_PORTS 16          // Ports in the routing table (16 channels each)
+#endif
+#ifndef MIDI_MAX_ROUTE_SINKS
+#define MIDI_MAX_ROUTE_SINKS 8     // Distinct sinks in the track/channel routing matrix (1-32)
+#endif
+#ifndef MIDI_ROUTE_BATCH_SIZE
+#define MIDI_ROUTE_BATCH_SIZE 16   // Events buffered per routed sink before a batch is forced out
+#endif
+
+// --- Read-Ahead Buffer Configuration ---
+// Override with build flags (e.g. -DMIDI_READ_BUFFER_SIZE=512) to trade RAM for fewer flash reads.
+#ifndef MIDI_READ_BUFFER_COUNT
+#define MIDI_READ_BUFFER_COUNT 4   // Buffer windows kept in RAM (roughly one per track read concurrently)
+#endif
+#ifndef MIDI_READ_BUFFER_SIZE
+#define MIDI_READ_BUFFER_SIZE 256  // Bytes per window for uncompressed files (compressed files use their block size)
+#endif
+#ifndef MIDI_DISCOVERY_CHUNKS_PER_TICK
+#define MIDI_DISCOVERY_CHUNKS_PER_TICK 4 // Chunk headers tick() looks up per call while the track table is incomplete
+#endif
+#ifndef MIDI_MAX_QUANTIZED_ACTIONS
+#define MIDI_MAX_QUANTIZED_ACTIONS 8 // Pending scheduleQuantizedAction() calls
+#endif
+#ifndef MIDI_MAX_QUEUED_PATTERNS
+#define MIDI_MAX_QUEUED_PATTERNS 16 // Format 2 patterns waiting in queuePattern()
+#endif
+#ifndef MIDI_INPUT_QUEUE_SIZE
+#define MIDI_INPUT_QUEUE_SIZE 64   // Live input messages queued between sendInput() and tick() (power of two)
+#endif
+#define MIDI_INPUT_TRACK 0xFE      // Track index of live input events (MidiEvent::track, addRoute())
+#define MIDI_MAX_TRACKS 254        // MidiEvent::track is 8-bit and 0xFE/0xFF are reserved: larger files are rejected
 
 // --- Log Level Definition ---
 enum class MidiLogLevel {
@@ -30,6 +68,53 @@ typedef void (*EndOfTrackCallback)(uint8_t trackIndex); // Called when a track f
 typedef void (*PlaybackCompleteCallback)(); // Called when all tracks finish
 
 
+// --- Event Sink Interface ---
+// A channel message as dispatched by the player, tagged with the MIDI port of its track
+// (set by Port Prefix meta events), so files can address more than 16 channels.
+struct MidiEvent {
+    uint64_t tick = 0;   // Tick the event was scheduled at
+    uint64_t micros = 0; // Song time in microseconds when dispatched
+    uint8_t status = 0;  // Channel message status byte (0x80-0xEF)
+    uint8_t data1 = 0;
+    uint8_t data2 = 0;   // 0 for Program Change / Channel Pressure
+    uint8_t port = 0;    // MIDI port (0 unless the track has a Port Prefix)
+    uint8_t track = 0;   // Source track index
+
+    uint8_t channel() const { return status & 0x0F; }
+    uint8_t command() const { return status & 0xF0; }
+    uint16_t globalChannel() const { return (uint16_t)port * 16 + channel(); } // 0..(16 * ports - 1)
+};
+
+class MidiEventSink {
+public:
+    virtual ~MidiEventSink() {}
+    virtual void onMidiEvent(const MidiEvent& event) = 0;
+    // Called instead of onMidiEvent() when route batching is on; override to send in one go
+    virtual void onMidiEventBatch(const MidiEvent* events, size_t count) {
+        for (size_t i = 0; i < count; ++i) onMidiEvent(events[i]);
+    }
+};
+
+// --- Time Source ---
+// Monotonic microsecond clock the player (and MidiClockSync) schedules against; it must never go
+// backwards. The system source is 64 bits end to end on ESP32 (esp_timer_get_time()), so it does not
+// wrap for hundreds of thousands of years. Substitute one to simulate time or follow an external clock.
+class MidiTimeSource {
+public:
+    virtual ~MidiTimeSource() {}
+    virtual uint64_t nowMicros() = 0;
+};
+
+class MidiSystemTimeSource : public MidiTimeSource {
+public:
+    uint64_t nowMicros() override;
+    static MidiSystemTimeSource& instance();
+private:
+    // Elsewhere the 32-bit micros() is extended, which needs a call at least every ~71 minutes
+    // (any tick(), even while stopped, is enough)
+    std::atomic<uint64_t> _micros{0}; // Latest extended reading
+};
+
 // --- Playback State Enum ---
 enum class PlaybackState {
     STOPPED,
@@ -37,6 +122,122 @@ enum class PlaybackState {
     PAUSED
 };
 
+// --- Note Interval Structure ---
+// One sounding note, paired from Note On/Off at load() time. Times are song microseconds
+// (uint32_t covers ~71 minutes); endMicros is always greater than startMicros.
+struct MidiNoteInterval {
+    uint32_t startMicros = 0;
+    uint32_t endMicros = 0;
+    uint8_t channel = 0;
+    uint8_t note = 0;
+    uint8_t velocity = 0;
+    uint8_t track = 0;
+};
+typedef void (*NoteIntervalCallback)(const MidiNoteInterval& note); // Called for each note matching queryNotes()
+
+// --- Active Note Snapshot ---
+// Key state of all 16 channels as of the end of one tick(). Published double-buffered so
+// readers on another core can use it in place (see beginActiveNotesRead()).
+struct MidiActiveNotes {
+    uint8_t velocity[16][128]; // Note On velocity, 0 while the key is up
+    uint32_t keyBits[16][4];   // Bit (note & 31) of keyBits[channel][note >> 5] is set while the key is down
+    uint16_t channelMask;      // Bit per channel with at least one key down
+    uint32_t tick;             // Playback tick the snapshot was published at
+};
+
+// --- File Container Types ---
+enum class MidiContainer {
+    SMF,        // Plain Standard MIDI File
+    RMID,       // RIFF-wrapped MIDI (.rmi)
+    COMPRESSED  // Block-compressed "MIDZ" container (see extras/midzpack.py), optionally holding RMID
+};
+
+// --- I/O Statistics ---
+// Compare decodeMicros / events against fileBytesRead to weigh decompression cost versus flash I/O saved.
+struct MidiIoStats {
+    uint32_t fileReads = 0;     // Read calls issued to the filesystem
+    uint32_t fileBytesRead = 0; // Bytes transferred from the filesystem
+    uint32_t bufferHits = 0;    // Window lookups served from RAM
+    uint32_t bufferMisses = 0;  // Window lookups that needed a refill
+    uint32_t decodedBytes = 0;  // Bytes produced by the decompressor
+    uint32_t decodeMicros = 0;  // Time spent decompressing
+    uint32_t events = 0;        // Events processed during playback
+    uint32_t prefetchBytes = 0;       // Bytes read ahead by the background prefetcher
+    uint32_t prefetchStarvations = 0; // Reads the prefetcher had not buffered yet (served synchronously)
+};
+
+// --- Idle Handling ---
+enum class MidiIdleMode {
+    DELAY,       // vTaskDelay() (lets the idle task / automatic light sleep run), then a short spin
+    LIGHT_SLEEP  // Explicit esp_light_sleep_start() with a timer wakeup (only if nothing else needs the CPU)
+};
+
+struct MidiIdleStats {
+    uint64_t wallMicros = 0;  // Time covered by tick() calls while playing
+    uint64_t sleptMicros = 0; // Time spent blocked in waitForNextEvent()
+    uint32_t waits = 0;       // waitForNextEvent() calls that blocked
+    // Share of playback time the CPU was awake, in percent (100 for a plain busy loop)
+    float dutyCyclePercent() const {
+        if (wallMicros == 0 || sleptMicros >= wallMicros) return wallMicros ? 0.0f : 100.0f;
+        return 100.0f * (float)(wallMicros - sleptMicros) / (float)wallMicros;
+    }
+};
+
+// --- Late Events ---
+// What tick() does with events that became overdue by more than the late threshold because loop()
+// stalled (WiFi reconnect, flash write, ...)
+enum class MidiLatePolicy {
+    PLAY_ALL,   // Send everything overdue at once (catch up immediately)
+    DROP_NOTES, // Skip overdue Note Ons (and their Note Offs); controllers, programs, tempo etc. still apply
+    SHIFT       // Treat the stall as a pause: move the timeline so playback resumes at the first overdue event
+};
+
+struct MidiLateStats {
+    uint32_t lateTicks = 0;      // tick() calls that found an event overdue by more than the threshold
+    uint32_t maxLateMicros = 0;  // Worst lateness seen
+    uint32_t droppedNotes = 0;   // Note Ons skipped (DROP_NOTES)
+    uint32_t shifts = 0;         // Stalls absorbed by moving the timeline (SHIFT)
+    uint64_t shiftedMicros = 0;  // Total time the timeline was moved by
+};
+
+// --- tick() Work Budget ---
+struct MidiTickStats {
+    uint32_t ticks = 0;            // tick() calls while playing
+    uint32_t maxTickMicros = 0;    // Longest tick() call
+    uint32_t maxEventsPerTick = 0;
+    uint32_t budgetHits = 0;       // Calls that returned with due events left over (see setTickBudget())
+    uint32_t maxBacklogMicros = 0; // Worst lateness of the first left-over event when the budget was hit
+};
+
+// --- Live Input ---
+struct MidiInputStats {
+    uint32_t events = 0;             // Messages merged into the output
+    uint32_t overflows = 0;          // sendInput() calls rejected because the queue was full
+    uint32_t maxLatencyMicros = 0;   // Longest time from sendInput() until its sinks had the message
+    uint64_t totalLatencyMicros = 0;
+    uint32_t averageLatencyMicros() const { return events ? (uint32_t)(totalLatencyMicros / events) : 0; }
+};
+
+// --- MIDI Time Code ---
+enum class MtcFrameRate : uint8_t { // Values are the rate bits of the MTC hours byte
+    FPS_24 = 0,
+    FPS_25 = 1,
+    FPS_2997_DROP = 2, // 29.97 fps drop-frame
+    FPS_30 = 3
+};
+
+typedef void (*MtcQuarterFrameCallback)(uint8_t data); // Data byte to send after status 0xF1
+typedef void (*MtcFullFrameCallback)(const uint8_t* sysex, uint8_t length); // Complete F0 7F 7F 01 01 ... F7 message
+
+// --- Tempo Automation ---
+enum class TempoRampShape {
+    LINEAR,      // Tempo (us/qn) changes by the same amount every tick
+    EXPONENTIAL  // Tempo changes by the same ratio every tick (approximated by 16 linear pieces)
+};
+
+// MIDI clock output: F8 (24 per quarter note), FA start, FB continue, FC stop, F2 song position
+typedef void (*MidiClockCallback)(const uint8_t* message, uint8_t length);
+
 // --- Track Info Structure ---
 struct TrackInfo {
     uint32_t startOffset = 0;
@@ -44,8 +245,64 @@ struct TrackInfo {
     uint64_t nextEventTick = 0; // Use 64-bit for potentially very long files/high tick counts
     uint8_t lastStatusByte = 0;
     bool endOfTrackReached = false;
+    uint32_t endOffset = 0; // Offset just past the last byte of the track chunk
+    uint8_t port = 0;            // From Port Prefix (0x21) meta events
+    uint8_t channelPrefix = 0xFF; // From Channel Prefix (0x20) meta events, 0xFF if none active
+    uint32_t pinnedBlock = UINT32_MAX; // Shared cache block pinned under currentOffset
 };
 
+// --- Lyric Timeline Structures ---
+// Built at load() time from Lyric (0x05) meta events, or from .kar style Text (0x01) events.
+// Times are relative to the start of the song (uint32_t covers ~71 minutes).
+struct MidiLyricSyllable {
+    uint32_t tick = 0;        // Tick the syllable is sung at
+    uint32_t micros = 0;      // Song time of the syllable in microseconds
+    uint16_t line = 0;        // Index of the line containing this syllable
+    uint16_t textOffset = 0;  // Offset of the syllable inside the line text
+    uint8_t length = 0;       // Length of the syllable text in bytes
+};
+
+struct MidiLyricLine {
+    const char* text = "";    // Null-terminated line text (owned by the player, valid until next load/stop)
+    uint32_t startMicros = 0; // Song time of the first syllable
+    uint32_t endMicros = 0;   // Song time of the next line's first syllable (or of the last syllable)
+    uint16_t firstSyllable = 0;
+    uint16_t syllableCount = 0;
+    bool newPage = false;     // Line starts a new page/paragraph ('\\' in .kar files)
+};
+
+// --- Meter Map ---
+// A position as a sequencer shows it: bar and beat count from 1, beats are in units of the
+// time signature's denominator (eighth notes in 6/8), tick is the offset into the beat.
+struct MidiBarBeat {
+    uint32_t bar = 1;
+    uint16_t beat = 1;
+    uint32_t tick = 0;
+};
+
+enum class MidiQuantize {
+    BEAT, // Next beat boundary
+    BAR   // Next downbeat
+};
+typedef void (*QuantizedActionCallback)(uint16_t actionId, uint64_t tick); // Runs inside tick(), ahead of the events at 'tick'
+
+// --- Position Snapshot ---
+// Transport state as of the end of one tick() (or play/pause/stop/seek), published double-buffered
+// so UI and network tasks on any core can poll it without locks and without torn 64-bit values.
+struct MidiPositionSnapshot {
+    PlaybackState state = PlaybackState::STOPPED;
+    uint64_t tick = 0;
+    uint64_t micros = 0;        // Song time at 'tick'
+    uint32_t tempo = 500000;    // Effective tempo in us per quarter note (automation included)
+    float playbackRate = 1.0f;
+    MidiBarBeat barBeat;        // From the meter map (4/4 without one)
+    uint64_t publishedMicros = 0; // Time source reading when published, to extrapolate between updates
+    uint32_t sequence = 0;      // Publication count; unchanged = nothing new since the last read
+};
+
+class MidiBlockCache;
+class MidiSongCache;
+
 class ESP32MidiPlayer {
 public:
     // Constructor - Takes the filesystem to use (e.g., LittleFS)
@@ -65,6 +322,55 @@ public:
     void setEndOfTrackCallback(EndOfTrackCallback callback);
     void setPlaybackCompleteCallback(PlaybackCompleteCallback callback);
 
+    // --- Port Routing ---
+    // Events are delivered to the sink registered for their port, or to the default sink.
+    // The callbacks above still receive every event (channels of all ports collapse onto 0-15).
+    void setPortSink(uint8_t port, MidiEventSink* sink); // port < MIDI_MAX_PORTS
+    void setDefaultSink(MidiEventSink* sink);
+    // Background prefetch: a reader task (FreeRTOS task on ESP32, std::thread on Linux) keeps at least
+    // aheadBytes of every track buffered in front of its parse position, handed over through lock-free
+    // rings, so tick() does not wait for flash. Set before load(); 0 = off. Uncompressed files only.
+    void setPrefetch(uint32_t aheadBytes);
+    void setReadLatencyMicros(uint32_t micros); // Test hook: artificial delay added to every file read
+    // Fast load: load() only locates the first track chunk and tick() finds the remaining ones a few
+    // per call (MIDI_DISCOVERY_CHUNKS_PER_TICK), so playback starts without walking the whole file.
+    // Events a later-found track has at the very start may sound a tick() or two late. Seeking, prefetch
+    // and the load-time indexes complete the table first. Set before load().
+    void setLazyTrackDiscovery(bool enabled);
+    // Shared filesystem block cache (see MidiBlockCache.h); set before load(). nullptr = private reads only.
+    // File reads then show up in the cache's stats rather than in getIoStats().
+    void setBlockCache(MidiBlockCache* cache);
+    // Compiled-song cache (see MidiSongCache.h); set before load(). The load-time indexes of a file
+    // whose content was indexed before are restored instead of rescanning the file. nullptr = off.
+    void setSongCache(MidiSongCache* cache);
+    // Clock playback is scheduled against (see MidiTimeSource); nullptr = MidiSystemTimeSource.
+    // Only change it while stopped. The source is read by every call that touches the transport,
+    // stop() included, so it must stay valid while the player is used; the destructor never reads it.
+    void setTimeSource(MidiTimeSource* source);
+    MidiTimeSource* getTimeSource() const;
+    // Routing matrix: channel messages of 'track' (0xFF = every track) on the channels set in
+    // channelMask (bit 0 = channel 1) go to 'sink'. A track/channel can feed several sinks, and
+    // routed events skip the port and default sinks. Lookup is one table read per event.
+    //   player.addRoute(9, 0x0200, &din);      // Track 9, channel 10 (drums) -> DIN
+    //   player.addRoute(0xFF, 0x0001, &ble);   // Channel 1 of every track -> BLE
+    bool addRoute(uint8_t track, uint16_t channelMask, MidiEventSink* sink);
+    void removeRoutes(MidiEventSink* sink);
+    void clearRoutes();
+    // Routed events of one tick() are collected per sink and handed over by onMidiEventBatch()
+    void setRouteBatching(bool enabled);
+
+    // --- Live Input (play-along / thru) ---
+    // Messages passed to sendInput() (from one task or ISR, e.g. a UART or BLE MIDI receiver) are
+    // merged into the output by tick(): ahead of the due file events and between the events of a
+    // burst, and sent at once even with route batching. They share the active-note tracking,
+    // callbacks and routing as track MIDI_INPUT_TRACK; addRoute(MIDI_INPUT_TRACK, ...) routes live
+    // input on its own, and 0xFF routes include it. MidiEvent::micros is the song time it arrived at.
+    // Keep calling tick() while stopped for plain thru; with waitForNextEvent(), keep maxWait short.
+    void setLiveInputEnabled(bool enabled); // Allocates the queue; don't disable while input can arrive
+    bool sendInput(uint8_t status, uint8_t data1, uint8_t data2 = 0, uint8_t port = 0); // false if full
+    MidiInputStats getInputStats() const;
+    void resetInputStats();
+
     // --- File Handling & Playback Control ---
     bool load(const char* filename); // Load MIDI file header and prepare tracks
     void play();                     // Start playback from the beginning or resume if paused
@@ -72,25 +378,189 @@ public:
     void resume();                   // Resume playback (alias for play() when paused)
     void stop();                     // Stop playback and reset
 
+    // --- Seeking ---
+    // Moves to a position without sounding the skipped notes; program, controller, pitch bend and
+    // pressure state crossed on the way is sent once on arrival (state chase). Works while stopped
+    // (play() then starts there), paused or playing. Forward seeks continue from the current position.
+    bool seekTick(uint64_t tick);
+    bool seekMicros(uint64_t micros);
+    // Seek index: enable before load() to keep the chased state every intervalMicros of song time,
+    // so seeks continue from the nearest checkpoint instead of parsing from the start.
+    void setSeekIndexEnabled(bool enabled, uint32_t intervalMicros = 5000000);
+    uint32_t getSeekCheckpointCount() const;
+    // Song browser preview: loads the file, seeks to startMicros (state chased) and plays for
+    // durationMicros. Note On velocities fade in over the first fadeMicros and out over the last.
+    // Ends like the song would (playback complete callback, then stop()).
+    bool preview(const char* filename, uint64_t startMicros, uint32_t durationMicros, uint32_t fadeMicros = 1000000);
+    // Late-event policy, applied once an event is more than maxLateMicros overdue. Default: PLAY_ALL.
+    void setLatePolicy(MidiLatePolicy policy, uint32_t maxLateMicros = 20000);
+    MidiLateStats getLateStats() const;
+    void resetLateStats();
+    // Speed multiplier applied to the tick clock (1.0 = as written, 0.1 - 10.0)
+    void setPlaybackRate(float rate);
+    float getPlaybackRate() const;
+
+    // --- MIDI Time Code ---
+    void setMtcFrameRate(MtcFrameRate rate);
+    void setMtcOffsetMicros(uint64_t micros); // Timecode at song position 0 (e.g. 3600000000 for 01:00:00:00)
+    // Generator: quarter frames follow the playback position; a full frame is sent on start and after seeks
+    void setMtcQuarterFrameCallback(MtcQuarterFrameCallback callback);
+    void setMtcFullFrameCallback(MtcFullFrameCallback callback);
+
+    // --- Tempo Automation ---
+    // Overrides the file's tempo events along the tick axis (accelerando, ritardando, rehearsal tempo).
+    // Ramps are evaluated per tick with integer math in the tick clock, so getTempo(), seeking,
+    // getCurrentMicros(), MTC and MIDI clock output all follow them. load() clears the automation.
+    void setTempoOverride(uint32_t microsPerQuarterNote); // From the current tick on (0 = follow the file again)
+    void scheduleTempoOverride(uint64_t tick, uint32_t microsPerQuarterNote); // 0 = back to the file tempo
+    // Goes from startTempo at startTick to endTempo at endTick, then holds endTempo. Ramps longer than
+    // 2^32 ticks are ignored.
+    void scheduleTempoRamp(uint64_t startTick, uint64_t endTick, uint32_t startTempo, uint32_t endTempo,
+                           TempoRampShape shape = TempoRampShape::LINEAR);
+    void clearTempoAutomation();
+
+    // --- MIDI Clock Output ---
+    // 24 pulses per quarter note derived from the tick clock (tempo automation included), plus
+    // start/continue/stop and a song position pointer on seeks. Pulses due since the last tick() are
+    // all sent, none are dropped, so a receiver never loses count.
+    void setMidiClockCallback(MidiClockCallback callback);
+    // Chase: feed incoming MTC; the player locates, starts, trims its rate and pauses when timecode stops
+    void setMtcFollowEnabled(bool enabled);
+    void receiveMtcQuarterFrame(uint8_t data);
+    void receiveMtcFullFrame(const uint8_t* sysex, uint8_t length);
+
     // --- Main Loop Update ---
     // This MUST be called frequently in the main loop()
     void tick();
+    // Bounds the work of one tick(): once maxMicros have passed or maxEvents were dispatched, tick()
+    // returns and the remaining due events go out on the next call, so a dense passage cannot starve
+    // WiFi or the task watchdog. 0 = no limit (default for both).
+    void setTickBudget(uint32_t maxMicros, uint16_t maxEvents = 0);
+    MidiTickStats getTickStats() const;
+    void resetTickStats();
+
+    // --- Tickless Idle ---
+    // Time until the earliest pending event is due (0 if overdue or live input is queued, UINT32_MAX if not playing).
+    uint32_t getMicrosUntilNextEvent() const;
+    // Blocks until the next event is due, but at most maxWaitMicros. Returns the time slept.
+    //   void loop() { player.tick(); player.waitForNextEvent(10000); handleOtherWork(); }
+    uint32_t waitForNextEvent(uint32_t maxWaitMicros = UINT32_MAX);
+    void setIdleMode(MidiIdleMode mode);
+    MidiIdleStats getIdleStats() const;
+    void resetIdleStats();
 
     // --- Status Queries ---
+    // These read the live members and belong on the task calling tick(); other tasks/cores should use
+    // getPositionSnapshot(), which never blocks the player and never returns a half-written position.
+    void getPositionSnapshot(MidiPositionSnapshot& snapshot) const;
     PlaybackState getState() const;
     bool isPlaying() const;
     bool isPaused() const;
     uint32_t getCurrentTick() const; // Get the current playback position in MIDI ticks
-    uint32_t getTempo() const; // Get current tempo in Microseconds Per Quarter Note
+    uint32_t getTempo() const; // Get current tempo in Microseconds Per Quarter Note (including automation)
+    uint32_t getFileTempo() const; // Tempo set by the file's own tempo events
+    uint64_t getCurrentMicros() const; // Get the current playback position in song microseconds (interpolated between ticks)
+    // Tick <-> song microsecond conversions through the file's tempo map. The map is only built at
+    // load() when one of the load-time indexes (lyric, note, meter or seek) was enabled before it,
+    // and never for format 2; otherwise these assume 120 BPM throughout and ignore tempo events.
+    uint64_t tickToMicros(uint64_t tick) const;
+    uint64_t microsToTick(uint64_t micros) const;
+    MidiContainer getContainer() const; // Container format of the loaded file
+    MidiIoStats getIoStats() const;
+    void resetIoStats();
+
+    // --- Lyric Timeline ---
+    // Enable before load() to build the lyric timeline. Queries only touch RAM, never the file.
+    void setLyricIndexEnabled(bool enabled);
+    uint16_t getLyricLineCount() const;
+    uint16_t getLyricSyllableCount() const;
+    bool getLyricLine(uint16_t index, MidiLyricLine& line) const;
+    bool getLyricSyllable(uint16_t index, MidiLyricSyllable& syllable) const;
+    int32_t findLyricSyllable(uint64_t micros) const; // Last syllable at or before micros, -1 if none
+    // Fills 'lines' with the line being sung at 'micros' followed by the next lines. Returns count.
+    uint16_t getLyricLinesAt(uint64_t micros, MidiLyricLine* lines, uint16_t maxLines) const;
+    // Same as above at the current position plus lookaheadMicros (e.g. 2500000 for a display 2.5s ahead).
+    uint16_t getLyricLines(MidiLyricLine* lines, uint16_t maxLines, uint32_t lookaheadMicros = 0) const;
+
+    // --- Active Note Snapshot (render threads) ---
+    // Enable to track per-channel key state; a snapshot is published once per tick() when keys change.
+    // Allocates ~7 KB. Only disable while no reader holds a snapshot.
+    void setActiveNoteTrackingEnabled(bool enabled);
+    // Lock-free, copy-free read from any core:
+    //   uint32_t token;
+    //   const MidiActiveNotes* keys = player.beginActiveNotesRead(token);
+    //   ... read keys ...
+    //   if (!player.endActiveNotesRead(token)) { /* overwritten while reading, retry */ }
+    // Returns nullptr if tracking is disabled.
+    const MidiActiveNotes* beginActiveNotesRead(uint32_t& token) const;
+    bool endActiveNotesRead(uint32_t token) const;
+
+    // --- Note Interval Index (piano roll / LED visualization) ---
+    // Enable before load() to pair every Note On/Off into a time-sorted interval array.
+    void setNoteIndexEnabled(bool enabled);
+    uint32_t getNoteIntervalCount() const;
+    bool getNoteInterval(uint32_t index, MidiNoteInterval& note) const;
+    // Calls 'callback' for every note sounding within [startMicros, endMicros), in start order.
+    // O(log n + k), RAM only, so it is safe to call while playing. Returns the number of notes reported.
+    uint32_t queryNotes(uint64_t startMicros, uint64_t endMicros, NoteIntervalCallback callback) const;
+
+    // --- Meter Map & Quantized Actions ---
+    // Enable before load() to index the file's time signatures; without it (and before the first
+    // signature) the song counts as 4/4. A signature change always starts a new bar. Lookups are O(log n).
+    void setMeterMapEnabled(bool enabled);
+    MidiBarBeat tickToBarBeat(uint64_t tick) const;
+    uint64_t barBeatToTick(uint32_t bar, uint16_t beat = 1, uint32_t tick = 0) const;
+    MidiBarBeat getCurrentBarBeat() const;
+    void getTimeSignatureAt(uint64_t tick, uint8_t& numerator, uint8_t& denominator) const;
+    // Calls 'action' on the next beat or bar boundary after the current position, from tick() and in
+    // order with the events: everything before the boundary has been sent, nothing at it yet. The action
+    // may seek (loop switch), pause or stop; play() a jingle from it and it starts on the beat.
+    //   player.scheduleQuantizedAction(MidiQuantize::BAR, onBar, ACTION_STOP);
+    // Returns the boundary tick, or UINT64_MAX when MIDI_MAX_QUANTIZED_ACTIONS are already pending.
+    // stop() and load() drop pending actions.
+    uint64_t scheduleQuantizedAction(MidiQuantize quantize, QuantizedActionCallback action, uint16_t actionId = 0);
+    void cancelQuantizedActions(); // Pending switchPattern() calls too
+
+    // --- Format 2 Patterns ---
+    // A format 2 file holds independent patterns (one per track) played one at a time on a single
+    // timeline. Playback starts with the first queued pattern (pattern 0 if none). When a pattern ends,
+    // the next queued one starts at that tick; with an empty queue the pattern repeats if looping,
+    // otherwise the next track follows, so a plain format 2 file plays its patterns in order.
+    // Patterns restart from the track offsets located at load(), so switching never scans the file.
+    // Time signatures enter the meter map as the patterns play. The other load-time indexes and
+    // seeking need a shared timeline and are not available for format 2.
+    uint16_t getPatternCount() const;    // Tracks of a format 2 file, 0 otherwise
+    int32_t getCurrentPattern() const;   // -1 unless a format 2 file is loaded
+    bool queuePattern(uint16_t pattern); // Plays after the current pattern and the ones queued before
+    void clearPatternQueue();
+    void setPatternLoop(bool enabled);   // Repeat the current pattern while nothing is queued
+    // Cuts the current pattern on the next beat or bar boundary (All Notes Off) and starts 'pattern'
+    // there, through the quantized action queue. Returns the boundary tick, or UINT64_MAX.
+    uint64_t switchPattern(uint16_t pattern, MidiQuantize quantize = MidiQuantize::BAR);
 
 private:
     // --- Private Helper Methods ---
     void _resetPlaybackState();
     bool _parseFileHeader();
     bool _prepareTracks();
+    bool _discoverTracks(uint16_t count); // Locates the next 'count' MTrk chunks
+    bool _openContainer(); // Detects SMF/RMID/compressed files and sets up the read-ahead buffer
     uint32_t _readVariableLengthQuantity(uint32_t& offset); // Reads from currentOffset of a track
-    uint32_t _readBytes(uint32_t offset, uint8_t* buffer, uint32_t length); // Reads from file
-    uint32_t _peekBytes(uint32_t offset, uint8_t* buffer, uint32_t length); // Peeks from file
+    uint32_t _readBytes(uint32_t offset, uint8_t* buffer, uint32_t length); // Reads SMF data (through the buffer)
+    uint32_t _peekBytes(uint32_t offset, uint8_t* buffer, uint32_t length); // Same as _readBytes (reads are offset based)
+    uint32_t _readSource(uint32_t sourceOffset, uint8_t* buffer, uint32_t length); // Reads (decompressed) file bytes
+    const uint8_t* _fetchWindow(uint32_t sourceOffset, uint32_t& available); // Buffer window holding sourceOffset
+    uint32_t _readRaw(uint32_t fileOffset, uint8_t* buffer, uint32_t length); // Reads raw bytes from the file
+    void _updateTrackPin(TrackInfo& track); // Pins the shared cache block under the track's read position
+    bool _startPrefetch();
+    void _stopPrefetch();
+    static void _prefetchTask(void* player);
+    void _prefetchLoop();
+    bool _prefetchRead(uint32_t offset, uint8_t* buffer, uint32_t length); // true if served from a ring
+    void _resetPrefetchRing(size_t trackIndex, uint32_t offset);
+    void _syncPrefetchRings();
+    void _releaseTrackPins();
+    bool _decodeBlock(uint32_t blockIndex, uint8_t* output, uint32_t outputLength);
     uint8_t _readUint8(uint32_t& offset);
     uint16_t _readUint16BE(uint32_t& offset); // Read Big Endian Short
     uint32_t _readUint32BE(uint32_t& offset); // Read Big Endian Long
@@ -98,11 +568,101 @@ private:
     int _findTrackWithNextEvent() const; // Returns index of track with earliest nextEventTick, or -1
     // Updated signature:
     void _handleMidiEvent(uint8_t trackIndex, uint8_t statusByte, uint32_t& trackOffset, bool runningStatusUsed, uint8_t data1_val);
+    void _dispatchEvent(const MidiEvent& event); // Active notes, callbacks and sinks for one channel message
+    void _compileRoutes(); // Rebuilds _routeTable from _routeRules for the loaded track count
+    void _flushRouteBatches();
+    void _drainInput(); // Dispatches what sendInput() queued
     void _handleMetaEvent(uint8_t trackIndex, uint32_t& trackOffset);
     void _handleSysexEvent(uint8_t trackIndex, uint8_t type, uint32_t& trackOffset);
     void _advanceTickTime();
+    uint64_t _dueMicros(uint64_t tick) const; // Wall time at which 'tick' is due (tick >= _currentTick)
+    void _handleLateness(uint64_t now);
+    bool _dropLateNote(const MidiEvent& event); // DROP_NOTES: true if the event must not sound
+    void _rewindTracks(); // Back to the start of every track, first delta read
+    void _finishPlayback();
+    bool _seek(uint64_t target, bool targetIsMicros);
+    bool _chaseTo(uint64_t target, bool targetIsMicros, uint64_t& tick, uint64_t& position, uint32_t& remainder);
+    bool _buildSeekIndex();
+    void _saveCheckpoint(uint32_t boundaryMicros, uint64_t tick, uint64_t position, uint32_t remainder);
+    bool _restoreCheckpoint(uint64_t target, bool targetIsMicros, uint64_t current, bool rewinding);
+    uint8_t _previewVelocity(uint8_t velocity) const;
+    void _recordChase(const MidiEvent& event);
+    void _emitChaseState(uint64_t tick);
+    void _silenceOutput(); // All Notes Off on every channel that may be sounding
+    void _serviceMtcOutput();
+    void _resyncMtcOutput();
+    void _sendMtcQuarterFrame(uint64_t index);
+    void _followMtc(uint64_t timecodeMicros);
+    void _insertTempoPoint(uint64_t tick, uint32_t tempo, bool ramp);
+    uint32_t _tempoSegment(uint64_t tick, uint64_t& segmentEnd, bool& ramp) const; // Tempo at tick and where it stops being constant/linear
+    uint64_t _rampUnits(uint64_t tick, uint64_t count) const; // _tempoUnits() for ticks on one linear ramp
+    uint64_t _tempoUnits(uint64_t fromTick, uint64_t toTick) const; // Sum of tempos over [from, to), in us * division
+    uint64_t _walkTempo(uint64_t fromTick, uint64_t maxUnits, uint64_t& usedUnits) const; // Ticks that fit in maxUnits
+    void _updateTempo(); // Effective tempo at _currentTick
+    void _sendMidiClock(uint8_t status);
+    void _sendSongPosition();
+    void _resyncMidiClock();
+    void _trackActiveNote(uint8_t channel, uint8_t note, uint8_t velocity); // velocity 0 = key up
+    void _clearActiveNotes(uint8_t channel);
+    void _publishActiveNotes();
+    void _runQuantizedAction(); // Pops and calls the earliest pending action
+    uint64_t _scheduleQuantized(MidiQuantize quantize, QuantizedActionCallback action, uint16_t id);
+    bool _startPattern(uint16_t pattern, uint64_t tick, bool cut); // Format 2: make 'pattern' the playing track
+    bool _nextPattern(uint64_t tick); // Format 2: the current pattern ended at 'tick'; false = song over
+    void _publishPosition();
+
+    // Load-time index helpers
+    struct TempoMapEntry {
+        uint64_t tick;
+        uint64_t micros;
+        uint32_t tempo;
+    };
+    struct LyricLineInfo {
+        uint32_t textOffset;     // Offset of the line text in _lyricPool
+        uint16_t firstSyllable;
+        uint16_t syllableCount;
+        bool newPage;
+    };
+    struct LoadScanEvent {       // Raw event collected while scanning tracks
+        uint32_t tick;
+        uint32_t value;          // Tempo, or offset of the text in LoadScanState::text
+        uint8_t type;            // Meta type
+        uint8_t length;          // Text length
+        uint16_t track;
+    };
+    struct MeterMapEntry {
+        uint64_t tick;
+        uint32_t bar;            // 0-based number of the bar starting at tick
+        uint8_t numerator;
+        uint8_t denominatorPow2;
+    };
+    struct LoadScanState {
+        std::vector<LoadScanEvent> tempos;
+        std::vector<LoadScanEvent> meters; // value = numerator | denominator power of two << 8
+        std::vector<LoadScanEvent> texts;
+        std::vector<char> text;
+        std::vector<int32_t> openHead;   // Per channel/note: oldest unpaired Note On (index into _noteIntervals)
+        std::vector<int32_t> openTail;   // Per channel/note: newest unpaired Note On
+        std::vector<int32_t> nextOpen;   // Per interval: next unpaired Note On of the same key
+        bool hasLyricEvents = false;
+        bool hasKaraokeMarker = false;
+    };
+    bool _buildLoadIndexes();
+    bool _scanTrack(uint16_t trackIndex, LoadScanState& scan);
+    void _indexNote(LoadScanState& scan, uint16_t trackIndex, uint32_t tick, uint8_t channel, uint8_t note, uint8_t velocity);
+    void _buildNoteIndex(LoadScanState& scan);
+    void _buildTempoMap(LoadScanState& scan);
+    void _buildMeterMap(LoadScanState& scan);
+    void _appendMeter(uint64_t tick, uint8_t numerator, uint8_t denominatorPow2); // At or after the last entry
+    const MeterMapEntry& _meterAt(uint64_t tick) const;
+    uint32_t _ticksPerBeat(const MeterMapEntry& meter) const;
+    void _buildLyricTimeline(LoadScanState& scan);
+    void _saveIndexes(std::vector<uint8_t>& artifact) const;
+    bool _restoreIndexes(const std::vector<uint8_t>& artifact);
+    void _fillLyricLine(uint16_t index, MidiLyricLine& line) const;
     // Updated signature:
     void _log(MidiLogLevel level, const char* format, ...); // Internal logging helper
+    uint64_t _now() const { return _timeSource->nowMicros(); }
 
     // --- Member Variables ---
     FS& _fs;                     // Filesystem reference
@@ -110,6 +670,7 @@ private:
     String _filename = "";       // Current filename
     PlaybackState _state = PlaybackState::STOPPED;
     MidiLogLevel _currentLogLevel = MidiLogLevel::INFO; // Default log level
+    MidiTimeSource* _timeSource = &MidiSystemTimeSource::instance();
 
     // MIDI Header Info
     uint16_t _format = 0;
@@ -121,11 +682,42 @@ private:
     uint64_t _currentTick = 0;
     uint64_t _playbackStartMicros = 0;
     uint64_t _lastEventMicros = 0;
+    uint32_t _lastEventRemainder = 0; // Fraction of a microsecond past _lastEventMicros, in 1/division us
     uint64_t _pauseStartMicros = 0; // To calculate paused duration
+    uint64_t _positionMicros = 0;   // Song time consumed by the tick clock
+    uint32_t _positionRemainder = 0;  // Same for _positionMicros
+
+    // Load-time indexes
+    bool _lyricIndexEnabled = false;
+    std::vector<TempoMapEntry> _tempoMap;      // Sorted by tick, always holds at least the default tempo
+    std::vector<MidiLyricSyllable> _lyricSyllables;
+    std::vector<LyricLineInfo> _lyricLines;
+    std::vector<char> _lyricPool;              // Null-terminated line texts
+    bool _noteIndexEnabled = false;
+    std::vector<MidiNoteInterval> _noteIntervals; // Sorted by startMicros
+    std::vector<uint32_t> _noteMaxEnd;         // Running maximum of endMicros (non-decreasing), for queries
+    bool _meterMapEnabled = false;
+    std::vector<MeterMapEntry> _meterMap;      // Sorted by tick, always holds at least 4/4 at tick 0
+
+    // Quantized actions, sorted by tick
+    struct QuantizedAction {
+        uint64_t tick;
+        QuantizedActionCallback action; // nullptr = switch to pattern 'id'
+        uint16_t id;
+    };
+    QuantizedAction _quantizedActions[MIDI_MAX_QUANTIZED_ACTIONS];
+    uint8_t _quantizedActionCount = 0;
+
+    // Format 2 patterns
+    int32_t _currentPattern = -1;
+    uint64_t _patternStartTick = 0;
+    uint16_t _patternQueue[MIDI_MAX_QUEUED_PATTERNS];
+    uint8_t _patternQueueCount = 0;
+    bool _patternLoop = false;
 
     // Track Data
     std::vector<TrackInfo> _tracks;
-    uint8_t _finishedTracks = 0; // Count of tracks that reached EOT
+    uint16_t _finishedTracks = 0; // Count of tracks that reached EOT
 
     // Callbacks
     LogCallback _logCallback = nullptr;
@@ -139,11 +731,196 @@ private:
     EndOfTrackCallback _endOfTrackCallback = nullptr;
     PlaybackCompleteCallback _playbackCompleteCallback = nullptr;
 
-    // Internal buffer (optional)
-    // uint8_t _readBuffer[64];
-    // uint32_t _bufferOffset = 0;
-    // uint32_t _bufferSize = 0;
-    // uint32_t _bufferFilePos = 0;
+    // Seeking & rate
+    struct ChannelChase {
+        uint8_t cc[128] = {};
+        uint32_t ccSeen[4] = {}; // Bit per controller
+        bool resetControllers = false; // Reset All Controllers was crossed
+        uint8_t program = 0xFF;  // 0xFF = not seen
+        uint8_t pressure = 0xFF;
+        uint8_t bendLsb = 0xFF;
+        uint8_t bendMsb = 0;
+        uint8_t track = 0;
+    };
+    std::vector<ChannelChase> _chase; // Indexed by port * 16 + channel while seeking
+
+    // Seek index: state after chasing everything before boundaryMicros
+    struct SeekCheckpoint {
+        uint32_t boundaryMicros;
+        uint32_t tick;            // Last event tick chased
+        uint32_t micros;          // Song time of that tick
+        uint32_t fileTempo;
+        uint32_t chaseOffset;     // Packed chase state in _seekChasePool
+        uint16_t finishedTracks;
+        uint16_t remainder;       // Of micros, in 1/division us
+    };
+    struct SeekTrackState {       // _trackCount entries per checkpoint
+        uint32_t offset;
+        uint32_t nextEventTick;
+        uint8_t lastStatusByte;
+        uint8_t port;
+        uint8_t channelPrefix;
+        bool ended;
+    };
+    bool _seekIndexEnabled = false;
+    uint32_t _seekIndexInterval = 5000000;
+    std::vector<SeekCheckpoint> _seekCheckpoints;
+    std::vector<SeekTrackState> _seekTrackStates;
+    std::vector<uint8_t> _seekChasePool;
+
+    // Late events
+    MidiLatePolicy _latePolicy = MidiLatePolicy::PLAY_ALL;
+    uint32_t _maxLateMicros = 20000;
+    MidiLateStats _lateStats;
+
+    // tick() work budget
+    uint32_t _tickBudgetMicros = 0;
+    uint16_t _tickBudgetEvents = 0;
+    MidiTickStats _tickStats;
+    bool _dropLateNotes = false;     // Set by tick() while overdue Note Ons are being skipped
+    uint64_t _lateDropTick = 0;      // Events at or before this tick are overdue
+    uint32_t _droppedKeys[16][4] = {}; // Keys whose Note On was skipped, so their Note Off is skipped too
+
+    // Preview playback (0 = not previewing)
+    uint64_t _previewStartMicros = 0;
+    uint64_t _previewEndMicros = 0;
+    uint32_t _previewFadeMicros = 0;
+    bool _chasing = false;
+    bool _tracksPrimed = false;       // Track positions valid while STOPPED (set by a seek before play())
+    bool _lazyTrackDiscovery = false;
+    uint16_t _tracksFound = 0;        // Tracks whose chunk has been located; the rest count as not started
+    uint32_t _nextChunkOffset = 0;    // Where the search for the next chunk continues
+    double _playbackRate = 1.0;
+
+    // MIDI Time Code
+    MtcFrameRate _mtcRate = MtcFrameRate::FPS_25;
+    uint64_t _mtcOffsetMicros = 0;
+    MtcQuarterFrameCallback _mtcQuarterFrameCallback = nullptr;
+    MtcFullFrameCallback _mtcFullFrameCallback = nullptr;
+    uint64_t _mtcNextQuarterFrame = 0; // Index of the next quarter frame to send
+    bool _mtcFollow = false;
+    uint8_t _mtcRxNibbles[8] = {};
+    uint8_t _mtcRxMask = 0;
+    uint64_t _mtcRxLastMicros = 0;
+    bool _mtcRxRunning = false;
+
+    // Tempo automation: points sorted by tick. tempo 0 = the file's tempo; ramp = linear from the previous point
+    struct TempoPoint {
+        uint64_t tick;
+        uint32_t tempo;
+        bool ramp;
+    };
+    std::vector<TempoPoint> _tempoPoints;
+    uint32_t _fileTempo = 500000;
+
+    // MIDI clock output
+    MidiClockCallback _midiClockCallback = nullptr;
+    uint64_t _clockNextPulse = 0; // Pulse n is due at tick n * division / 24
+
+    // Tickless idle
+    MidiIdleMode _idleMode = MidiIdleMode::DELAY;
+    MidiIdleStats _idleStats;
+    uint64_t _lastTickCallMicros = 0;
+
+    // Output routing
+    MidiEventSink* _portSinks[MIDI_MAX_PORTS] = {};
+    MidiEventSink* _defaultSink = nullptr;
+    struct RouteRule {
+        uint8_t track;        // 0xFF = every track
+        uint16_t channelMask;
+        uint8_t sink;         // Index into _routeSinks
+    };
+    struct RouteBatch {
+        MidiEvent events[MIDI_ROUTE_BATCH_SIZE];
+        uint8_t count;
+    };
+    // Smallest mask with one bit per route sink
+    static_assert(MIDI_MAX_ROUTE_SINKS >= 1 && MIDI_MAX_ROUTE_SINKS <= 32, "MIDI_MAX_ROUTE_SINKS must be 1..32");
+#if MIDI_MAX_ROUTE_SINKS <= 8
+    typedef uint8_t RouteMask;
+#elif MIDI_MAX_ROUTE_SINKS <= 16
+    typedef uint16_t RouteMask;
+#else
+    typedef uint32_t RouteMask;
+#endif
+    std::vector<RouteRule> _routeRules;
+    MidiEventSink* _routeSinks[MIDI_MAX_ROUTE_SINKS] = {};
+    std::vector<RouteMask> _routeTable;   // [track * 16 + channel] = bitmask of _routeSinks; last row = live input
+    RouteBatch* _routeBatches = nullptr;  // One per route sink while batching is enabled
+
+    // Live input: single-producer/single-consumer queue, sendInput() owns 'head', tick() owns 'tail'
+    struct InputMessage {
+        uint64_t arrivalMicros;
+        uint8_t status;
+        uint8_t data1;
+        uint8_t data2;
+        uint8_t port;
+    };
+    InputMessage* _inputQueue = nullptr;
+    std::atomic<uint32_t> _inputHead{0};
+    std::atomic<uint32_t> _inputTail{0};
+    std::atomic<uint32_t> _inputOverflows{0}; // Counted by sendInput(), folded into getInputStats()
+    MidiInputStats _inputStats;
+
+    // Active note tracking: [0] is the live state, [1] and [2] the published buffers
+    MidiActiveNotes* _activeNotes = nullptr;
+    uint16_t _activeNotesDirty[2] = {0, 0}; // Channels each published buffer is missing changes for
+    bool _activeNotesChanged = false;
+    std::atomic<uint32_t> _activeNotesSeq[2];   // Seqlock per published buffer (odd while being written)
+    std::atomic<uint8_t> _activeNotesFront{0};  // Index of the newest published buffer
+
+    // Position snapshot, same double-buffered seqlock scheme as the active notes
+    MidiPositionSnapshot _positionSnapshots[2];
+    std::atomic<uint32_t> _positionSeq[2];
+    std::atomic<uint8_t> _positionFront{0};
+    uint32_t _positionPublishCount = 0;
+
+    // Container & read-ahead buffer
+    struct ReadWindow {
+        uint32_t start = 0;   // Source offset of the first buffered byte
+        uint32_t length = 0;  // Valid bytes (0 = empty)
+        uint32_t lastUse = 0; // For least-recently-used replacement
+    };
+    MidiContainer _container = MidiContainer::SMF;
+    uint32_t _sourceSize = 0;  // Size of the (decompressed) file contents
+    uint32_t _dataOffset = 0;  // Offset of the SMF data inside the source (RIFF 'data' chunk)
+    uint32_t _dataSize = 0;    // Size of the SMF data
+    uint32_t _windowSize = MIDI_READ_BUFFER_SIZE;
+    ReadWindow _windows[MIDI_READ_BUFFER_COUNT];
+    std::vector<uint8_t> _windowData;
+    uint32_t _windowUseCounter = 0;
+    uint8_t _lzWindowBits = 0;      // Compressed container parameters
+    uint8_t _lzLookaheadBits = 0;
+    uint32_t _blockCount = 0;
+    std::vector<uint8_t> _compressedBlock; // Scratch for one compressed block
+    MidiIoStats _ioStats;
+    MidiBlockCache* _blockCache = nullptr;
+    MidiSongCache* _songCache = nullptr;
+    uint32_t _readLatencyMicros = 0;
+
+    // Background prefetch: one single-producer/single-consumer ring per track. The reader task
+    // owns 'head', tick() owns 'tail'; a reset is requested by bumping 'requestGeneration' and
+    // the ring is only used again once the task has acknowledged it.
+    struct PrefetchRing {
+        uint8_t* data = nullptr;
+        uint32_t capacity = 0;             // Power of two
+        uint32_t base = 0;                 // SMF offset of stream position 0 (written by the task on reset)
+        uint32_t requestBase = 0;          // Offset to restart at (written by tick() before a request)
+        std::atomic<uint32_t> head{0};     // Bytes produced
+        std::atomic<uint32_t> tail{0};     // Bytes consumed
+        std::atomic<uint32_t> requestGeneration{0};
+        std::atomic<uint32_t> ackGeneration{0};
+    };
+    uint32_t _prefetchAhead = 0;
+    PrefetchRing* _prefetchRings = nullptr;
+    File _prefetchFile;                    // Own handle, so the task never shares a file position with tick()
+    std::atomic<bool> _prefetchRunning{false};
+    std::atomic<bool> _prefetchActive{false};
+    std::atomic<uint32_t> _prefetchBytes{0}; // Counted by the task, folded into getIoStats()
+#if defined(__linux__) && !defined(ESP32)
+    std::thread _prefetchThread;
+#endif
+    uint32_t _cacheFileId = 0;
 };
 
 #endif // ESP32_MIDI_PLAYER_H
\ No newline at end of file
@@ -0,0 +1,124 @@
+#include "MidiBlockCache.h"
+
+MidiBlockCache::MidiBlockCache(uint32_t blockSize, uint16_t blockCount)
+    : _blockSize(blockSize ? blockSize : 4096), _blocks(blockCount ? blockCount : 1) {
+    _data.assign((size_t)_blockSize * _blocks.size(), 0);
+}
+
+uint32_t MidiBlockCache::read(fs::File& file, uint32_t fileId, uint32_t offset, uint8_t* buffer, uint32_t length) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    uint32_t fileSize = file.size();
+    if (offset >= fileSize) return 0;
+    if (length > fileSize - offset) length = fileSize - offset;
+
+    uint32_t copied = 0;
+    while (copied < length) {
+        uint32_t position = offset + copied;
+        uint32_t blockIndex = position / _blockSize;
+        uint32_t blockStart = blockIndex * _blockSize;
+        uint32_t inBlock = position - blockStart;
+        uint32_t chunk = _blockSize - inBlock;
+        if (chunk > length - copied) chunk = length - copied;
+
+        int slot = _find(fileId, blockIndex);
+        if (slot >= 0) {
+            _stats.hits++;
+        } else {
+            slot = _victim();
+            if (slot < 0) {
+                // Everything is pinned: serve this piece straight from the file
+                _stats.bypasses++;
+                if (!file.seek(position)) break;
+                uint32_t got = file.read(buffer + copied, chunk);
+                _stats.fileReads++;
+                _stats.fileBytesRead += got;
+                copied += got;
+                if (got != chunk) break;
+                continue;
+            }
+            Block& block = _blocks[slot];
+            if (block.length > 0) _stats.evictions++;
+            block.length = 0;
+            uint32_t blockLength = (fileSize - blockStart < _blockSize) ? fileSize - blockStart : _blockSize;
+            if (!file.seek(blockStart)) break;
+            uint32_t got = file.read(&_data[(size_t)slot * _blockSize], blockLength);
+            _stats.fileReads++;
+            _stats.fileBytesRead += got;
+            _stats.misses++;
+            if (got != blockLength) break;
+            block.fileId = fileId;
+            block.index = blockIndex;
+            block.length = blockLength;
+        }
+
+        Block& block = _blocks[slot];
+        block.lastUse = ++_useCounter;
+        if (inBlock >= block.length) break;
+        if (chunk > block.length - inBlock) chunk = block.length - inBlock;
+        memcpy(buffer + copied, &_data[(size_t)slot * _blockSize + inBlock], chunk);
+        copied += chunk;
+    }
+    return copied;
+}
+
+bool MidiBlockCache::pin(uint32_t fileId, uint32_t blockIndex) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    int slot = _find(fileId, blockIndex);
+    if (slot < 0) return false;
+    _blocks[slot].pins++;
+    return true;
+}
+
+void MidiBlockCache::unpin(uint32_t fileId, uint32_t blockIndex) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    int slot = _find(fileId, blockIndex);
+    if (slot >= 0 && _blocks[slot].pins > 0) _blocks[slot].pins--;
+}
+
+void MidiBlockCache::invalidate(uint32_t fileId) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (Block& block : _blocks) {
+        if (block.length > 0 && block.fileId == fileId) block = Block();
+    }
+}
+
+uint32_t MidiBlockCache::getBlockSize() const { return _blockSize; }
+uint16_t MidiBlockCache::getBlockCount() const { return (uint16_t)_blocks.size(); }
+
+MidiBlockCacheStats MidiBlockCache::getStats() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+}
+
+void MidiBlockCache::resetStats() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stats = MidiBlockCacheStats();
+}
+
+uint32_t MidiBlockCache::fileIdFor(const char* path, uint32_t size) {
+    uint32_t hash = 2166136261UL;
+    for (const char* c = path; c && *c; ++c) {
+        hash ^= (uint8_t)*c;
+        hash *= 16777619UL;
+    }
+    return hash ^ (size * 2654435761UL);
+}
+
+int MidiBlockCache::_find(uint32_t fileId, uint32_t blockIndex) const {
+    for (size_t i = 0; i < _blocks.size(); ++i) {
+        const Block& block = _blocks[i];
+        if (block.length > 0 && block.fileId == fileId && block.index == blockIndex) return (int)i;
+    }
+    return -1;
+}
+
+int MidiBlockCache::_victim() const {
+    int victim = -1;
+    for (size_t i = 0; i < _blocks.size(); ++i) {
+        const Block& block = _blocks[i];
+        if (block.pins > 0) continue;
+        if (block.length == 0) return (int)i; // Empty slots first
+        if (victim < 0 || block.lastUse < _blocks[victim].lastUse) victim = (int)i;
+    }
+    return victim;
+}
@@ -0,0 +1,68 @@
+#ifndef MidiBlockCache_H
+#define MidiBlockCache_H
+
+#include <Arduino.h>
+#include <FS.h>
+#include <vector>
+#include <mutex>
+
+struct MidiBlockCacheStats {
+    uint32_t hits = 0;       // Reads served from a cached block
+    uint32_t misses = 0;     // Blocks loaded from the filesystem
+    uint32_t evictions = 0;  // Valid blocks dropped to make room
+    uint32_t bypasses = 0;   // Reads done uncached because every block was pinned
+    uint32_t fileReads = 0;  // Read calls issued to the filesystem
+    uint32_t fileBytesRead = 0;
+    float hitRatio() const { return (hits + misses) ? (float)hits / (float)(hits + misses) : 0.0f; }
+};
+
+// LRU cache of whole filesystem blocks, shared by any number of players (and their tracks).
+// Misses read one aligned block, so flash sees few large reads instead of many tiny ones.
+// Blocks under a track's read position can be pinned to keep them resident. All calls are
+// serialized with a mutex, so players on different cores may share one cache.
+//
+//   MidiBlockCache cache(4096, 8);    // LittleFS block size on ESP32, 32 KB of RAM
+//   playerA.setBlockCache(&cache);
+//   playerB.setBlockCache(&cache);
+class MidiBlockCache {
+public:
+    // blockSize should match the filesystem block / flash sector size (4096 for LittleFS on ESP32)
+    MidiBlockCache(uint32_t blockSize = 4096, uint16_t blockCount = 8);
+
+    // Copies [offset, offset + length) of 'file' into buffer, loading missing blocks. Returns bytes copied.
+    // fileId tells files apart (see fileIdFor()); the file's own position is moved on misses.
+    uint32_t read(fs::File& file, uint32_t fileId, uint32_t offset, uint8_t* buffer, uint32_t length);
+
+    // Pinned blocks are never evicted. Pins are counted; only resident blocks can be pinned.
+    bool pin(uint32_t fileId, uint32_t blockIndex);
+    void unpin(uint32_t fileId, uint32_t blockIndex);
+    void invalidate(uint32_t fileId); // Drops a file's blocks (e.g. after rewriting it)
+
+    uint32_t getBlockSize() const;
+    uint16_t getBlockCount() const;
+    MidiBlockCacheStats getStats() const;
+    void resetStats();
+
+    static uint32_t fileIdFor(const char* path, uint32_t size); // FNV-1a of the path, mixed with the size
+
+private:
+    struct Block {
+        uint32_t fileId = 0;
+        uint32_t index = 0;
+        uint32_t length = 0;  // 0 = empty
+        uint32_t lastUse = 0;
+        uint16_t pins = 0;
+    };
+
+    int _find(uint32_t fileId, uint32_t blockIndex) const; // Slot or -1
+    int _victim() const;                                    // Least recently used unpinned slot or -1
+
+    uint32_t _blockSize;
+    std::vector<Block> _blocks;
+    std::vector<uint8_t> _data;
+    uint32_t _useCounter = 0;
+    MidiBlockCacheStats _stats;
+    mutable std::mutex _mutex;
+};
+
+#endif
@@ -0,0 +1,248 @@
+#include "MidiClockSync.h"
+
+// --- Packet Layout (little-endian, PACKET_SIZE bytes) ---
+//   0  'M' 'S'
+//   2  type (1 = request, 2 = response)
+//   3  leader playback state (responses)
+//   4  sequence number
+//   8  t0: follower clock when the request was sent
+//   16 t1: leader clock when the request arrived (responses)
+//   24 t2: leader clock when the response was sent (responses)
+//   32 leader song position at t2, microseconds (responses)
+//   40 leader playback rate in millionths (responses)
+const uint8_t SYNC_MAGIC_0 = 'M';
+const uint8_t SYNC_MAGIC_1 = 'S';
+const uint8_t SYNC_REQUEST = 1;
+const uint8_t SYNC_RESPONSE = 2;
+
+// --- Steering ---
+const uint32_t SYNC_RELOCATE_MICROS = 20000;   // Further off than this is located (seek) instead of trimmed
+const uint32_t SYNC_CATCHUP_MICROS = 1000000;  // Smaller errors are trimmed out over roughly this long
+const double SYNC_MAX_RATE_TRIM = 0.01;        // Largest rate correction (+/- 1%)
+const double SYNC_MAX_SKEW = 0.0005;           // Crystal skew beyond +/- 500 ppm is treated as noise
+const uint32_t SYNC_MIN_SKEW_SPAN_MICROS = 2000000; // Anchors must cover this long before the skew is fitted
+const uint8_t SYNC_LOCK_SAMPLES = 4;
+const uint32_t SYNC_LOCK_TIMEOUT_POLLS = 8;    // Lock is lost after this many poll intervals without a response
+
+static void _writeLE32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; ++i) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static void _writeLE64(uint8_t* p, uint64_t v) {
+    for (int i = 0; i < 8; ++i) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint32_t _readLE32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t _readLE64(const uint8_t* p) {
+    return (uint64_t)_readLE32(p) | ((uint64_t)_readLE32(p + 4) << 32);
+}
+
+MidiClockSync::MidiClockSync(ESP32MidiPlayer& player) : _player(player) {}
+
+void MidiClockSync::beginLeader(SyncSendCallback send) {
+    end();
+    _role = MidiSyncRole::LEADER;
+    _send = send;
+}
+
+void MidiClockSync::beginFollower(SyncSendCallback send, uint32_t pollIntervalMicros) {
+    end();
+    _role = MidiSyncRole::FOLLOWER;
+    _send = send;
+    _pollInterval = pollIntervalMicros ? pollIntervalMicros : 1;
+}
+
+void MidiClockSync::end() {
+    if (_role == MidiSyncRole::FOLLOWER) _player.setPlaybackRate(1.0f);
+    _role = MidiSyncRole::NONE;
+    _send = nullptr;
+    _recentCount = 0;
+    _recentNext = 0;
+    _sinceAnchor = 0;
+    _anchorCount = 0;
+    _anchorNext = 0;
+    _skew = 0.0;
+    _lastRequestMicros = 0;
+    _lastResponseMicros = 0;
+    _stats = MidiSyncStats();
+}
+
+MidiSyncRole MidiClockSync::getRole() const { return _role; }
+MidiSyncStats MidiClockSync::getStats() const { return _stats; }
+
+// Same time base as the player, so song positions and timestamps line up
+uint64_t MidiClockSync::_now() { return _player.getTimeSource()->nowMicros(); }
+
+void MidiClockSync::receive(const uint8_t* packet, size_t length) {
+    uint64_t receivedMicros = _now();
+    if (!packet || length < PACKET_SIZE || packet[0] != SYNC_MAGIC_0 || packet[1] != SYNC_MAGIC_1) return;
+    if (packet[2] == SYNC_REQUEST && _role == MidiSyncRole::LEADER) {
+        _handleRequest(packet, receivedMicros);
+    } else if (packet[2] == SYNC_RESPONSE && _role == MidiSyncRole::FOLLOWER) {
+        _handleResponse(packet, receivedMicros);
+    }
+}
+
+void MidiClockSync::_handleRequest(const uint8_t* request, uint64_t receivedMicros) {
+    uint8_t packet[PACKET_SIZE];
+    memcpy(packet, request, 16); // Magic, sequence and t0 are echoed
+    packet[2] = SYNC_RESPONSE;
+    packet[3] = (uint8_t)_player.getState();
+    _writeLE64(packet + 16, receivedMicros);
+    _writeLE32(packet + 40, (uint32_t)(_player.getPlaybackRate() * 1000000.0f + 0.5f));
+    // Position and t2 are taken together, as late as possible
+    uint64_t songMicros = _player.getCurrentMicros();
+    uint64_t sentMicros = _now();
+    _writeLE64(packet + 24, sentMicros);
+    _writeLE64(packet + 32, songMicros);
+    _stats.requests++;
+    if (_send) _send(packet, PACKET_SIZE);
+}
+
+void MidiClockSync::_handleResponse(const uint8_t* packet, uint64_t receivedMicros) {
+    uint64_t t0 = _readLE64(packet + 8);
+    uint64_t t1 = _readLE64(packet + 16);
+    uint64_t t2 = _readLE64(packet + 24);
+    if (_readLE32(packet + 4) != _sequence || t0 > receivedMicros || t2 < t1) return; // Stale or bogus
+    uint64_t t3 = receivedMicros;
+
+    // Round trip minus the leader's turnaround; the offset assumes a symmetric path
+    uint64_t roundTrip = t3 - t0;
+    uint64_t turnaround = t2 - t1;
+    Sample& sample = _recent[_recentNext];
+    sample.delay = (uint32_t)(roundTrip > turnaround ? roundTrip - turnaround : 0);
+    sample.offset = ((int64_t)(t1 - t0) - (int64_t)(t3 - t2)) / 2;
+    sample.localMicros = t0 + roundTrip / 2;
+    _recentNext = (_recentNext + 1) % MIDI_SYNC_FILTER;
+    if (_recentCount < MIDI_SYNC_FILTER) _recentCount++;
+    if (++_sinceAnchor >= MIDI_SYNC_FILTER) {
+        _sinceAnchor = 0;
+        _anchors[_anchorNext] = _fastestRecent();
+        _anchorNext = (_anchorNext + 1) % MIDI_SYNC_SAMPLES;
+        if (_anchorCount < MIDI_SYNC_SAMPLES) _anchorCount++;
+    }
+
+    _leaderState = (PlaybackState)packet[3];
+    _leaderSentMicros = t2;
+    _leaderSongMicros = _readLE64(packet + 32);
+    _leaderRate = _readLE32(packet + 40) / 1000000.0;
+    _lastResponseMicros = t3;
+    _stats.responses++;
+    _stats.roundTripMicros = sample.delay;
+
+    _estimate();
+    _stats.locked = _recentCount >= SYNC_LOCK_SAMPLES;
+    if (_stats.locked) _steer();
+}
+
+// Queueing only ever adds delay, so the exchange with the smallest delay has the most symmetric
+// path and the most trustworthy offset.
+const MidiClockSync::Sample& MidiClockSync::_fastestRecent() const {
+    uint8_t best = 0;
+    for (uint8_t i = 1; i < _recentCount; ++i) {
+        if (_recent[i].delay < _recent[best].delay) best = i;
+    }
+    return _recent[best];
+}
+
+// Offset: the fastest recent exchange. Skew: least-squares slope through the anchors, which
+// span MIDI_SYNC_SAMPLES filter periods so network jitter averages out.
+void MidiClockSync::_estimate() {
+    const Sample& fastest = _fastestRecent();
+    _fitLocal = fastest.localMicros;
+    _fitOffset = fastest.offset;
+
+    if (_anchorCount >= 3) {
+        // Sums relative to the first anchor keep the doubles small
+        const Sample& first = _anchors[_anchorCount < MIDI_SYNC_SAMPLES ? 0 : _anchorNext];
+        double n = _anchorCount, sumX = 0, sumY = 0, sumXX = 0, sumXY = 0, maxX = 0;
+        for (uint8_t i = 0; i < _anchorCount; ++i) {
+            double x = (double)(int64_t)(_anchors[i].localMicros - first.localMicros);
+            double y = (double)(_anchors[i].offset - first.offset);
+            sumX += x;
+            sumY += y;
+            sumXX += x * x;
+            sumXY += x * y;
+            if (x > maxX) maxX = x;
+        }
+        double meanX = sumX / n;
+        double varX = sumXX / n - meanX * meanX;
+        if (maxX >= SYNC_MIN_SKEW_SPAN_MICROS && varX > 0) {
+            double skew = (sumXY / n - meanX * sumY / n) / varX;
+            if (skew > SYNC_MAX_SKEW) skew = SYNC_MAX_SKEW;
+            if (skew < -SYNC_MAX_SKEW) skew = -SYNC_MAX_SKEW;
+            _skew = skew;
+        }
+    }
+
+    _stats.offsetMicros = _fitOffset;
+    _stats.skewPpm = (float)(_skew * 1000000.0);
+}
+
+int64_t MidiClockSync::_offsetAt(uint64_t localMicros) const {
+    return _fitOffset + (int64_t)(_skew * (double)(int64_t)(localMicros - _fitLocal));
+}
+
+uint64_t MidiClockSync::getLeaderSongMicros() {
+    if (_role != MidiSyncRole::FOLLOWER || _stats.responses == 0) return 0;
+    if (_leaderState != PlaybackState::PLAYING) return _leaderSongMicros;
+    uint64_t now = _now();
+    int64_t elapsed = (int64_t)(now + _offsetAt(now) - _leaderSentMicros); // Leader clock since t2
+    if (elapsed < 0) elapsed = 0;
+    return _leaderSongMicros + (uint64_t)(elapsed * _leaderRate);
+}
+
+// Mirrors the leader's transport and pulls our song position onto the leader's
+void MidiClockSync::_steer() {
+    uint64_t target = getLeaderSongMicros();
+    PlaybackState state = _player.getState();
+
+    if (_leaderState != PlaybackState::PLAYING) {
+        if (state == PlaybackState::PLAYING) _player.pause();
+        if (_player.getCurrentMicros() != target && _player.seekMicros(target)) _stats.relocations++;
+        _stats.errorMicros = 0;
+        return;
+    }
+    if (state != PlaybackState::PLAYING) {
+        if (_player.seekMicros(target)) _stats.relocations++;
+        _player.setPlaybackRate((float)(_leaderRate * (1.0 + _skew)));
+        _player.play();
+        return;
+    }
+
+    int64_t error = (int64_t)target - (int64_t)_player.getCurrentMicros();
+    _stats.errorMicros = (int32_t)error;
+    if (error > (int64_t)SYNC_RELOCATE_MICROS || error < -(int64_t)SYNC_RELOCATE_MICROS) {
+        if (_player.seekMicros(getLeaderSongMicros())) _stats.relocations++;
+        _player.setPlaybackRate((float)(_leaderRate * (1.0 + _skew)));
+        return;
+    }
+    // Follow the leader's clock rate, plus a trim that closes the remaining error
+    double trim = (double)error / SYNC_CATCHUP_MICROS;
+    if (trim > SYNC_MAX_RATE_TRIM) trim = SYNC_MAX_RATE_TRIM;
+    if (trim < -SYNC_MAX_RATE_TRIM) trim = -SYNC_MAX_RATE_TRIM;
+    _player.setPlaybackRate((float)(_leaderRate * (1.0 + _skew) * (1.0 + trim)));
+}
+
+void MidiClockSync::update() {
+    if (_role != MidiSyncRole::FOLLOWER) return;
+    uint64_t now = _now();
+    if (_stats.locked && now - _lastResponseMicros > (uint64_t)_pollInterval * SYNC_LOCK_TIMEOUT_POLLS) {
+        _stats.locked = false; // Leader gone: keep playing on our own clock until it answers again
+        _recentCount = 0;
+        _recentNext = 0;
+    }
+    if (_lastRequestMicros != 0 && now - _lastRequestMicros < _pollInterval) return;
+
+    uint8_t packet[PACKET_SIZE] = {};
+    packet[0] = SYNC_MAGIC_0;
+    packet[1] = SYNC_MAGIC_1;
+    packet[2] = SYNC_REQUEST;
+    _writeLE32(packet + 4, ++_sequence);
+    _lastRequestMicros = _now();
+    _writeLE64(packet + 8, _lastRequestMicros);
+    if (_send) _send(packet, PACKET_SIZE);
+}
@@ -0,0 +1,110 @@
+#ifndef MidiClockSync_H
+#define MidiClockSync_H
+
+#include <Arduino.h>
+#include "ESP32MidiPlayer.h"
+
+// --- Clock Sync Configuration ---
+#ifndef MIDI_SYNC_SAMPLES
+#define MIDI_SYNC_SAMPLES 16       // Filtered offsets kept for skew estimation (one per MIDI_SYNC_FILTER exchanges)
+#endif
+#ifndef MIDI_SYNC_FILTER
+#define MIDI_SYNC_FILTER 8         // Recent exchanges the fastest (least delayed) one is picked from
+#endif
+
+// Leader/follower playback sync between devices playing the same song (e.g. each board plays
+// different tracks). Followers periodically exchange timestamps with the leader (NTP-style),
+// estimate the clock offset and skew, and steer their player to the leader's song position:
+// large errors are located with a seek, small ones trimmed out through setPlaybackRate().
+//
+// The class is transport agnostic: packets go out through a send callback and arriving
+// packets are handed to receive(). Over UDP (see the SyncedPlayback example) the leader replies
+// to whoever sent the request.
+//
+//   MidiClockSync sync(player);
+//   sync.beginFollower(sendPacket);                       // or sync.beginLeader(sendPacket)
+//   void loop() { player.tick(); pollUdp(); sync.update(); }
+//   void onPacket(const uint8_t* data, size_t len) { sync.receive(data, len); }
+
+typedef void (*SyncSendCallback)(const uint8_t* packet, size_t length);
+
+enum class MidiSyncRole {
+    NONE,
+    LEADER,
+    FOLLOWER
+};
+
+struct MidiSyncStats {
+    bool locked = false;           // Enough recent exchanges to trust the estimates
+    int64_t offsetMicros = 0;      // Leader clock minus local clock
+    float skewPpm = 0.0f;          // Leader clock rate relative to ours, parts per million
+    int32_t errorMicros = 0;       // Leader song position minus ours at the last correction
+    uint32_t roundTripMicros = 0;  // Network delay of the last exchange
+    uint32_t requests = 0;
+    uint32_t responses = 0;
+    uint32_t relocations = 0;      // Seeks done to catch up with the leader
+};
+
+class MidiClockSync {
+public:
+    static const size_t PACKET_SIZE = 44;
+
+    MidiClockSync(ESP32MidiPlayer& player);
+
+    void beginLeader(SyncSendCallback send);
+    // pollIntervalMicros: time between timestamp exchanges
+    void beginFollower(SyncSendCallback send, uint32_t pollIntervalMicros = 250000);
+    void end();
+
+    void receive(const uint8_t* packet, size_t length); // Feed every packet that arrives
+    void update(); // Call frequently (e.g. after player.tick()); sends requests and steers the player
+
+    MidiSyncRole getRole() const;
+    MidiSyncStats getStats() const;
+    uint64_t getLeaderSongMicros(); // Leader song position estimated for now (follower only)
+
+private:
+    struct Sample {
+        uint64_t localMicros; // Midpoint of the exchange, local clock
+        int64_t offset;       // Leader minus local
+        uint32_t delay;
+    };
+
+    uint64_t _now(); // The player's time source
+    void _handleRequest(const uint8_t* packet, uint64_t receivedMicros);
+    void _handleResponse(const uint8_t* packet, uint64_t receivedMicros);
+    const Sample& _fastestRecent() const;
+    void _estimate();
+    void _steer();
+    int64_t _offsetAt(uint64_t localMicros) const;
+
+    ESP32MidiPlayer& _player;
+    MidiSyncRole _role = MidiSyncRole::NONE;
+    SyncSendCallback _send = nullptr;
+    uint32_t _pollInterval = 250000;
+    uint64_t _lastRequestMicros = 0;
+    uint64_t _lastResponseMicros = 0;
+    uint32_t _sequence = 0;
+
+    Sample _recent[MIDI_SYNC_FILTER];   // Last exchanges, the offset comes from the fastest
+    uint8_t _recentCount = 0;
+    uint8_t _recentNext = 0;
+    uint8_t _sinceAnchor = 0;
+    Sample _anchors[MIDI_SYNC_SAMPLES]; // Fastest exchange of each filter period, the skew comes from these
+    uint8_t _anchorCount = 0;
+    uint8_t _anchorNext = 0;
+    // offset(t) = _fitOffset + _skew * (t - _fitLocal)
+    uint64_t _fitLocal = 0;
+    int64_t _fitOffset = 0;
+    double _skew = 0.0;
+
+    // Leader transport from the last response (leader clock)
+    uint64_t _leaderSentMicros = 0;
+    uint64_t _leaderSongMicros = 0;
+    double _leaderRate = 1.0;
+    PlaybackState _leaderState = PlaybackState::STOPPED;
+
+    MidiSyncStats _stats;
+};
+
+#endif
@@ -0,0 +1,150 @@
+#include "MidiRecorder.h"
+
+const uint8_t MAX_ENCODED_EVENT = 7; // 4-byte delta, status, two data bytes
+
+static void _writeBE32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; ++i) p[i] = (uint8_t)(v >> (24 - 8 * i));
+}
+
+MidiRecorder::MidiRecorder(fs::FS& filesystem, uint32_t bufferSize)
+    : _fs(filesystem), _bufferSize(bufferSize < MAX_ENCODED_EVENT ? MAX_ENCODED_EVENT : bufferSize) {
+    _handedOver[0].store(false, std::memory_order_relaxed);
+    _handedOver[1].store(false, std::memory_order_relaxed);
+}
+
+MidiRecorder::~MidiRecorder() {
+    end();
+    delete[] _buffers[0];
+    delete[] _buffers[1];
+}
+
+bool MidiRecorder::begin(const char* path, uint8_t format, uint16_t division, uint32_t tempo) {
+    end();
+    if (format > 1 || division == 0 || division > 0x7FFF || tempo == 0 || tempo > 0xFFFFFF) return false;
+    if (!_buffers[0]) _buffers[0] = new uint8_t[_bufferSize];
+    if (!_buffers[1]) _buffers[1] = new uint8_t[_bufferSize];
+    _file = _fs.open(path, FILE_WRITE);
+    if (!_file) return false;
+
+    _stats = MidiRecorderStats();
+    _fill[0] = _fill[1] = 0;
+    _handedOver[0].store(false, std::memory_order_relaxed);
+    _handedOver[1].store(false, std::memory_order_relaxed);
+    _active = 0;
+    _division = division;
+    _tempo = tempo;
+    _lastTick = 0;
+    _runningStatus = 0;
+
+    const uint8_t header[14] = {'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, format, 0, (uint8_t)(format == 1 ? 2 : 1),
+                                (uint8_t)(division >> 8), (uint8_t)division};
+    const uint8_t tempoEvent[7] = {0x00, 0xFF, 0x51, 0x03, (uint8_t)(tempo >> 16), (uint8_t)(tempo >> 8), (uint8_t)tempo};
+    const uint8_t endOfTrack[4] = {0x00, 0xFF, 0x2F, 0x00};
+    bool ok = _write(header, sizeof(header));
+    if (format == 1) { // Conductor track
+        const uint8_t chunk[8] = {'M', 'T', 'r', 'k', 0, 0, 0, sizeof(tempoEvent) + sizeof(endOfTrack)};
+        ok = ok && _write(chunk, sizeof(chunk)) && _write(tempoEvent, sizeof(tempoEvent)) && _write(endOfTrack, sizeof(endOfTrack));
+    }
+    // Performance track; its length is filled in by end()
+    const uint8_t chunk[8] = {'M', 'T', 'r', 'k', 0, 0, 0, 0};
+    _trackLengthOffset = _stats.bytesWritten + 4;
+    ok = ok && _write(chunk, sizeof(chunk));
+    _trackStart = _stats.bytesWritten;
+    if (format == 0) ok = ok && _write(tempoEvent, sizeof(tempoEvent));
+    if (!ok) {
+        _file.close();
+        return false;
+    }
+    _recording = true;
+    return true;
+}
+
+bool MidiRecorder::record(const MidiEvent& event) {
+    return record(event.micros, event.status, event.data1, event.data2);
+}
+
+bool MidiRecorder::record(uint64_t micros, uint8_t status, uint8_t data1, uint8_t data2) {
+    if (!_recording || status < 0x80 || status >= 0xF0) return false;
+
+    // Absolute ticks, so rounding never accumulates across deltas
+    uint64_t tick = (micros * _division + _tempo / 2) / _tempo;
+    if (tick < _lastTick) tick = _lastTick;
+    if (tick - _lastTick > 0x0FFFFFFF) tick = _lastTick + 0x0FFFFFFF; // Largest delta a VLQ can hold
+
+    uint8_t message[MAX_ENCODED_EVENT];
+    uint8_t length = 0;
+    uint32_t delta = (uint32_t)(tick - _lastTick);
+    for (int shift = 21; shift > 0; shift -= 7) {
+        if (delta >> shift) message[length++] = (uint8_t)(0x80 | ((delta >> shift) & 0x7F));
+    }
+    message[length++] = (uint8_t)(delta & 0x7F);
+    if (status != _runningStatus) message[length++] = status;
+    message[length++] = data1 & 0x7F;
+    uint8_t command = status & 0xF0;
+    if (command != 0xC0 && command != 0xD0) message[length++] = data2 & 0x7F;
+
+    if (!_append(message, length)) {
+        _stats.droppedEvents++; // Running status and tick stay as they were, so the stream remains valid
+        return false;
+    }
+    _runningStatus = status;
+    _lastTick = tick;
+    _stats.events++;
+    return true;
+}
+
+bool MidiRecorder::_append(const uint8_t* data, uint32_t length) {
+    if (_fill[_active] + length > _bufferSize) {
+        uint8_t other = _active ^ 1;
+        if (_handedOver[other].load(std::memory_order_acquire)) return false; // update() has not caught up
+        _handedOver[_active].store(true, std::memory_order_release);
+        _active = other;
+        _fill[_active] = 0;
+    }
+    memcpy(_buffers[_active] + _fill[_active], data, length);
+    _fill[_active] += length;
+    return true;
+}
+
+void MidiRecorder::update() {
+    // At most one buffer is handed over at a time, so file order is kept
+    for (uint8_t i = 0; i < 2; ++i) {
+        if (!_handedOver[i].load(std::memory_order_acquire)) continue;
+        _writeBuffer(i);
+        _handedOver[i].store(false, std::memory_order_release);
+    }
+}
+
+bool MidiRecorder::end() {
+    if (!_recording) return false;
+    _recording = false;
+    update(); // The handed-over buffer is older than the active one
+    const uint8_t endOfTrack[4] = {0x00, 0xFF, 0x2F, 0x00};
+    bool ok = _writeBuffer(_active) && _write(endOfTrack, sizeof(endOfTrack));
+    uint8_t length[4];
+    _writeBE32(length, _stats.bytesWritten - _trackStart);
+    ok = ok && _file.seek(_trackLengthOffset) && _file.write(length, 4) == 4;
+    _file.close();
+    return ok;
+}
+
+bool MidiRecorder::_writeBuffer(uint8_t index) {
+    if (_fill[index] == 0) return true;
+    uint32_t start = micros();
+    bool ok = _write(_buffers[index], _fill[index]);
+    uint32_t elapsed = micros() - start;
+    if (elapsed > _stats.maxWriteMicros) _stats.maxWriteMicros = elapsed;
+    _stats.flushes++;
+    _fill[index] = 0;
+    return ok;
+}
+
+bool MidiRecorder::_write(const uint8_t* data, uint32_t length) {
+    uint32_t written = _file.write(data, length);
+    _stats.bytesWritten += written;
+    return written == length;
+}
+
+bool MidiRecorder::isRecording() const { return _recording; }
+uint64_t MidiRecorder::getTickCount() const { return _lastTick; }
+MidiRecorderStats MidiRecorder::getStats() const { return _stats; }
@@ -0,0 +1,70 @@
+#ifndef MidiRecorder_H
+#define MidiRecorder_H
+
+#include <Arduino.h>
+#include <FS.h>
+#include <atomic>
+#include "ESP32MidiPlayer.h"
+
+struct MidiRecorderStats {
+    uint32_t events = 0;         // Events encoded
+    uint32_t droppedEvents = 0;  // Events lost because both buffers were waiting for update()
+    uint32_t bytesWritten = 0;   // Bytes written to the file (headers included)
+    uint32_t flushes = 0;        // Buffer writes done by update()/end()
+    uint32_t maxWriteMicros = 0; // Longest single buffer write
+};
+
+// Records timestamped channel messages into a Standard MIDI File. Timestamps (microseconds) are
+// turned into ticks with a fixed division and tempo, and events are encoded with VLQ deltas and
+// running status into one of two RAM buffers. A full buffer is handed over and written by update()
+// (from loop() or a lower priority task) while recording continues into the other one, so the
+// event path never waits for flash. Format 0 holds everything in one track; format 1 adds a
+// conductor track (tempo) in front of the performance track.
+//
+//   MidiRecorder recorder(LittleFS);
+//   recorder.begin("/take1.mid", 1, 480, 500000);
+//   recorder.record(micros() - takeStart, 0x90, 60, 100);  // Live input ...
+//   player.addRoute(0xFF, 0xFFFF, &recorder);              // ... and/or whatever a player sends
+//   void loop() { player.tick(); recorder.update(); }
+//   recorder.end();
+class MidiRecorder : public MidiEventSink {
+public:
+    // bufferSize: bytes per buffer (two are allocated by begin())
+    MidiRecorder(fs::FS& filesystem, uint32_t bufferSize = 1024);
+    ~MidiRecorder();
+
+    bool begin(const char* path, uint8_t format = 0, uint16_t division = 480, uint32_t tempo = 500000);
+    // Timestamps should not go backwards; an earlier one is recorded at the previous event's tick
+    bool record(uint64_t micros, uint8_t status, uint8_t data1, uint8_t data2 = 0);
+    bool record(const MidiEvent& event); // Uses event.micros (song time when the player sent it)
+    void onMidiEvent(const MidiEvent& event) override { record(event); }
+    void update(); // Writes a handed-over buffer; never called concurrently with end()
+    bool end();    // Writes the rest, End of Track and the chunk length, then closes the file
+
+    bool isRecording() const;
+    uint64_t getTickCount() const; // Tick of the last recorded event
+    MidiRecorderStats getStats() const;
+
+private:
+    bool _append(const uint8_t* data, uint32_t length); // Encoded bytes into the active buffer
+    bool _writeBuffer(uint8_t index);
+    bool _write(const uint8_t* data, uint32_t length);
+
+    fs::FS& _fs;
+    fs::File _file;
+    uint32_t _bufferSize;
+    uint8_t* _buffers[2] = {nullptr, nullptr};
+    uint32_t _fill[2] = {0, 0};
+    std::atomic<bool> _handedOver[2];  // Set by record(), cleared by update() once written
+    uint8_t _active = 0;
+    bool _recording = false;
+    uint16_t _division = 480;
+    uint32_t _tempo = 500000;
+    uint64_t _lastTick = 0;
+    uint8_t _runningStatus = 0;
+    uint32_t _trackLengthOffset = 0; // File offset of the performance track's length field
+    uint32_t _trackStart = 0;        // File offset of its first event
+    MidiRecorderStats _stats;
+};
+
+#endif
@@ -0,0 +1,223 @@
+#include "MidiSongCache.h"
+
+// --- Cache File Layout (little-endian) ---
+//   0  'M' 'S' 'C' FORMAT_VERSION
+//   4  content checksum
+//   8  kind
+//   12 payload length
+//   16 payload CRC-32
+//   20 last use stamp (rewritten on hits, for LRU eviction)
+//   24 payload
+const uint32_t SONG_CACHE_HEADER_SIZE = 24;
+const uint32_t SONG_CACHE_USE_OFFSET = 20;
+
+// --- Sampled Checksum ---
+const uint32_t CHECKSUM_EDGE_BYTES = 4096;  // Hashed at both ends (headers, track table, last events)
+const uint32_t CHECKSUM_SAMPLES = 16;       // Evenly spaced samples in between
+const uint32_t CHECKSUM_SAMPLE_BYTES = 256;
+
+static void _writeLE32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; ++i) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint32_t _readLE32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+MidiSongCache::MidiSongCache(fs::FS& filesystem, const char* directory, uint32_t maxBytes)
+    : _fs(filesystem), _directory(directory ? directory : "/.midicache"), _maxBytes(maxBytes) {
+    if (_directory.endsWith("/")) _directory.remove(_directory.length() - 1);
+}
+
+void MidiSongCache::setFullChecksum(bool enabled) { _fullChecksum = enabled; }
+
+// CRC-32 (IEEE), nibble table: 64 bytes of flash instead of 1 KB
+uint32_t MidiSongCache::crc32(const uint8_t* data, size_t length, uint32_t crc) {
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+    crc = ~crc;
+    for (size_t i = 0; i < length; ++i) {
+        crc = table[(crc ^ data[i]) & 0x0F] ^ (crc >> 4);
+        crc = table[(crc ^ (data[i] >> 4)) & 0x0F] ^ (crc >> 4);
+    }
+    return ~crc;
+}
+
+uint32_t MidiSongCache::checksum(fs::File& source) {
+    uint32_t start = micros();
+    uint32_t size = source.size();
+    uint8_t buffer[512];
+    _writeLE32(buffer, size);
+    uint32_t crc = crc32(buffer, 4);
+
+    auto hashRange = [&](uint32_t offset, uint32_t length) {
+        if (!source.seek(offset)) return;
+        while (length > 0) {
+            uint32_t chunk = length < sizeof(buffer) ? length : sizeof(buffer);
+            uint32_t got = source.read(buffer, chunk);
+            if (got == 0) return;
+            crc = crc32(buffer, got, crc);
+            length -= got;
+        }
+    };
+
+    uint32_t sampled = 2 * CHECKSUM_EDGE_BYTES + CHECKSUM_SAMPLES * CHECKSUM_SAMPLE_BYTES;
+    if (_fullChecksum || size <= sampled) {
+        hashRange(0, size);
+    } else {
+        hashRange(0, CHECKSUM_EDGE_BYTES);
+        uint32_t span = size - 2 * CHECKSUM_EDGE_BYTES - CHECKSUM_SAMPLE_BYTES;
+        for (uint32_t i = 1; i <= CHECKSUM_SAMPLES; ++i) {
+            hashRange(CHECKSUM_EDGE_BYTES + (uint32_t)((uint64_t)span * i / (CHECKSUM_SAMPLES + 1)), CHECKSUM_SAMPLE_BYTES);
+        }
+        hashRange(size - CHECKSUM_EDGE_BYTES, CHECKSUM_EDGE_BYTES);
+    }
+    _stats.checksumMicros = micros() - start;
+    return crc;
+}
+
+String MidiSongCache::_pathFor(uint32_t checksum, uint32_t kind) const {
+    char name[24];
+    snprintf(name, sizeof(name), "/%08lx%08lx.msc", (unsigned long)checksum, (unsigned long)kind);
+    return _directory + name;
+}
+
+bool MidiSongCache::_readHeader(fs::File& file, uint8_t* header) {
+    if (!file.seek(0) || file.read(header, SONG_CACHE_HEADER_SIZE) != SONG_CACHE_HEADER_SIZE) return false;
+    return header[0] == 'M' && header[1] == 'S' && header[2] == 'C' && header[3] == FORMAT_VERSION;
+}
+
+bool MidiSongCache::get(uint32_t checksum, uint32_t kind, std::vector<uint8_t>& artifact) {
+    String path = _pathFor(checksum, kind);
+    if (!_fs.exists(path)) {
+        _stats.misses++;
+        return false;
+    }
+    fs::File file = _fs.open(path, FILE_READ);
+    uint8_t header[SONG_CACHE_HEADER_SIZE];
+    bool valid = file && _readHeader(file, header) && _readLE32(header + 4) == checksum &&
+                 _readLE32(header + 8) == kind && _readLE32(header + 12) == file.size() - SONG_CACHE_HEADER_SIZE;
+    if (valid) {
+        artifact.resize(_readLE32(header + 12));
+        valid = file.read(artifact.data(), artifact.size()) == artifact.size() &&
+                crc32(artifact.data(), artifact.size()) == _readLE32(header + 16);
+    }
+    if (file) file.close();
+    if (!valid) {
+        // Written by an older version or cut short (e.g. power lost mid-write): rebuild it
+        artifact.clear();
+        _fs.remove(path);
+        _stats.stale++;
+        _stats.misses++;
+        return false;
+    }
+
+    file = _fs.open(path, "r+");
+    if (file) {
+        uint8_t stamp[4];
+        _writeLE32(stamp, _nextUse());
+        if (file.seek(SONG_CACHE_USE_OFFSET)) file.write(stamp, 4);
+        file.close();
+    }
+    _stats.hits++;
+    return true;
+}
+
+bool MidiSongCache::put(uint32_t checksum, uint32_t kind, const uint8_t* data, uint32_t length) {
+    uint32_t total = SONG_CACHE_HEADER_SIZE + length;
+    if (total > _maxBytes) return false;
+    if (!_fs.exists(_directory) && !_fs.mkdir(_directory)) return false;
+
+    String path = _pathFor(checksum, kind);
+    if (_fs.exists(path)) _fs.remove(path); // Replaced below; don't count it against the budget
+    _makeRoom(total);
+
+    uint8_t header[SONG_CACHE_HEADER_SIZE];
+    header[0] = 'M';
+    header[1] = 'S';
+    header[2] = 'C';
+    header[3] = FORMAT_VERSION;
+    _writeLE32(header + 4, checksum);
+    _writeLE32(header + 8, kind);
+    _writeLE32(header + 12, length);
+    _writeLE32(header + 16, crc32(data, length));
+    _writeLE32(header + 20, _nextUse());
+
+    // Written under a temporary name, so a cut-off write never looks like a valid entry
+    String temporary = _directory + "/pending.tmp";
+    fs::File file = _fs.open(temporary, FILE_WRITE);
+    if (!file) return false;
+    bool written = file.write(header, SONG_CACHE_HEADER_SIZE) == SONG_CACHE_HEADER_SIZE &&
+                   file.write(data, length) == length;
+    file.close();
+    if (!written || !_fs.rename(temporary, path)) {
+        _fs.remove(temporary);
+        return false;
+    }
+    _stats.writes++;
+    return true;
+}
+
+bool MidiSongCache::_listEntries(std::vector<Entry>& entries) {
+    fs::File directory = _fs.open(_directory, FILE_READ);
+    if (!directory || !directory.isDirectory()) return false;
+    for (fs::File file = directory.openNextFile(); file; file = directory.openNextFile()) {
+        String name = file.name();
+        if (!file.isDirectory() && name.endsWith(".msc")) {
+            uint8_t header[SONG_CACHE_HEADER_SIZE];
+            uint32_t lastUse = _readHeader(file, header) ? _readLE32(header + SONG_CACHE_USE_OFFSET) : 0;
+            entries.push_back({_directory + "/" + name, (uint32_t)file.size(), lastUse});
+        }
+        file.close();
+    }
+    directory.close();
+    return true;
+}
+
+void MidiSongCache::_makeRoom(uint32_t incoming) {
+    std::vector<Entry> entries;
+    if (!_listEntries(entries)) return;
+    uint32_t used = 0;
+    for (const Entry& entry : entries) used += entry.size;
+    while (used + incoming > _maxBytes && !entries.empty()) {
+        size_t oldest = 0;
+        for (size_t i = 1; i < entries.size(); ++i) {
+            if (entries[i].lastUse < entries[oldest].lastUse) oldest = i;
+        }
+        _fs.remove(entries[oldest].path);
+        used -= entries[oldest].size;
+        entries.erase(entries.begin() + oldest);
+        _stats.evictions++;
+    }
+}
+
+// Use stamps continue from the newest entry on the filesystem, so LRU order survives reboots
+uint32_t MidiSongCache::_nextUse() {
+    if (!_useCounterLoaded) {
+        std::vector<Entry> entries;
+        _listEntries(entries);
+        for (const Entry& entry : entries) {
+            if (entry.lastUse > _useCounter) _useCounter = entry.lastUse;
+        }
+        _useCounterLoaded = true;
+    }
+    return ++_useCounter;
+}
+
+void MidiSongCache::clear() {
+    std::vector<Entry> entries;
+    _listEntries(entries);
+    for (const Entry& entry : entries) _fs.remove(entry.path);
+}
+
+uint32_t MidiSongCache::getUsedBytes() {
+    std::vector<Entry> entries;
+    _listEntries(entries);
+    uint32_t used = 0;
+    for (const Entry& entry : entries) used += entry.size;
+    return used;
+}
+
+MidiSongCacheStats MidiSongCache::getStats() const { return _stats; }
+void MidiSongCache::resetStats() { _stats = MidiSongCacheStats(); }
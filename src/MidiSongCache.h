@@ -0,0 +1,76 @@
+#ifndef MidiSongCache_H
+#define MidiSongCache_H
+
+#include <Arduino.h>
+#include <FS.h>
+#include <vector>
+
+struct MidiSongCacheStats {
+    uint32_t hits = 0;           // Artifacts served from the cache
+    uint32_t misses = 0;         // No artifact for this content (or it was stale/corrupt)
+    uint32_t stale = 0;          // Entries dropped because their version or payload check failed
+    uint32_t writes = 0;         // Artifacts stored
+    uint32_t evictions = 0;      // Entries removed to stay under the size limit
+    uint32_t checksumMicros = 0; // Time the last checksum() took
+};
+
+// Cache of artifacts derived from song files (load-time indexes, tempo maps, ...), stored as
+// files under one directory. Entries are keyed by a CRC-32 of the file *content*, so a file
+// replaced under the same name (e.g. over the air) only picks up the old song's artifacts in
+// the unlikely event of a CRC collision, plus a caller-chosen 'kind' that changes whenever the
+// artifact layout or options change. The least recently used entries are removed to keep the
+// directory under maxBytes.
+//
+//   MidiSongCache songCache(LittleFS, "/.midicache", 256 * 1024);
+//   player.setSongCache(&songCache);      // load() restores its indexes instead of rescanning
+//
+// Trade-off: by default the checksum reads every byte of the file on each load(), which is as
+// much flash I/O as the index scan it replaces; a hit only saves the parsing and index building.
+// That is the safe choice. setFullChecksum(false) only hashes the size, the first and last 4 KB
+// and 16 samples in between: a few reads regardless of file size, so a hit costs far less than a
+// rebuild, but an edit that keeps the size and falls outside those bytes (e.g. a changed
+// velocity mid-song) reuses the stale artifacts. Use it when files are only ever replaced whole.
+class MidiSongCache {
+public:
+    static const uint8_t FORMAT_VERSION = 1; // Layout of the cache files themselves
+
+    MidiSongCache(fs::FS& filesystem, const char* directory = "/.midicache", uint32_t maxBytes = 256 * 1024);
+
+    void setFullChecksum(bool enabled);
+    uint32_t checksum(fs::File& source); // Content key of 'source' (moves its position)
+
+    // Copies the artifact for (checksum, kind) into 'artifact'. Corrupt or outdated entries are removed.
+    bool get(uint32_t checksum, uint32_t kind, std::vector<uint8_t>& artifact);
+    // Stores an artifact, evicting old entries first. Artifacts larger than maxBytes are not kept.
+    bool put(uint32_t checksum, uint32_t kind, const uint8_t* data, uint32_t length);
+    void clear(); // Removes every entry
+
+    uint32_t getUsedBytes();
+    MidiSongCacheStats getStats() const;
+    void resetStats();
+
+    static uint32_t crc32(const uint8_t* data, size_t length, uint32_t crc = 0);
+
+private:
+    struct Entry {
+        String path;
+        uint32_t size;
+        uint32_t lastUse;
+    };
+
+    String _pathFor(uint32_t checksum, uint32_t kind) const;
+    bool _readHeader(fs::File& file, uint8_t* header);
+    bool _listEntries(std::vector<Entry>& entries);
+    void _makeRoom(uint32_t incoming);
+    uint32_t _nextUse();
+
+    fs::FS& _fs;
+    String _directory;
+    uint32_t _maxBytes;
+    bool _fullChecksum = true;
+    uint32_t _useCounter = 0;
+    bool _useCounterLoaded = false;
+    MidiSongCacheStats _stats;
+};
+
+#endif
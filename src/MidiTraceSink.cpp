@@ -0,0 +1,109 @@
+#include "MidiTraceSink.h"
+
+// --- Trace File Layout (little-endian) ---
+//   0  'M' 'T' 'R' 'C'
+//   4  FORMAT_VERSION
+//   5  flags (bit 0: records carry the clock time)
+//   6  reserved (0)
+//   8  event count (written by end(); 0 if the trace was cut short)
+//   12 records:
+//        zig-zag VLQ tick delta, zig-zag VLQ song time delta (us),
+//        [zig-zag VLQ clock time delta (us)], status, data1, [data2], track, port
+//   Deltas are against the previous record (0 for the first); data2 is left out for
+//   Program Change and Channel Pressure.
+const uint32_t TRACE_HEADER_SIZE = 12;
+const uint32_t TRACE_COUNT_OFFSET = 8;
+const uint8_t TRACE_FLAG_CLOCK = 0x01;
+const uint8_t MAX_TRACE_RECORD = 3 * 10 + 5; // Three 64-bit VLQs, message, track, port
+
+static void _writeLE32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; ++i) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+// Seeks and rate changes can move time backwards, so deltas are signed
+static uint8_t _putDelta(uint8_t* p, uint64_t value, uint64_t previous) {
+    int64_t delta = (int64_t)(value - previous);
+    uint64_t zigzag = ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);
+    uint8_t length = 0;
+    while (zigzag >= 0x80) {
+        p[length++] = (uint8_t)(0x80 | (zigzag & 0x7F));
+        zigzag >>= 7;
+    }
+    p[length++] = (uint8_t)zigzag;
+    return length;
+}
+
+MidiTraceSink::MidiTraceSink(fs::FS& filesystem, uint32_t bufferSize)
+    : _fs(filesystem), _bufferSize(bufferSize < MAX_TRACE_RECORD ? MAX_TRACE_RECORD : bufferSize) {}
+
+MidiTraceSink::~MidiTraceSink() {
+    end();
+    delete[] _buffer;
+}
+
+bool MidiTraceSink::begin(const char* path, MidiTimeSource* clock) {
+    end();
+    if (!_buffer) _buffer = new uint8_t[_bufferSize];
+    _file = _fs.open(path, FILE_WRITE);
+    if (!_file) return false;
+
+    _stats = MidiTraceStats();
+    _clock = clock;
+    _fill = 0;
+    _lastTick = _lastMicros = _lastClock = 0;
+
+    uint8_t header[TRACE_HEADER_SIZE] = {'M', 'T', 'R', 'C', FORMAT_VERSION, (uint8_t)(clock ? TRACE_FLAG_CLOCK : 0)};
+    _stats.bytesWritten = _file.write(header, TRACE_HEADER_SIZE);
+    if (_stats.bytesWritten != TRACE_HEADER_SIZE) {
+        _file.close();
+        return false;
+    }
+    _tracing = true;
+    return true;
+}
+
+void MidiTraceSink::onMidiEvent(const MidiEvent& event) {
+    if (!_tracing) return;
+    if (_fill + MAX_TRACE_RECORD > _bufferSize) _flush();
+
+    uint8_t* p = _buffer + _fill;
+    uint8_t length = _putDelta(p, event.tick, _lastTick);
+    length += _putDelta(p + length, event.micros, _lastMicros);
+    _lastTick = event.tick;
+    _lastMicros = event.micros;
+    if (_clock) {
+        uint64_t now = _clock->nowMicros();
+        length += _putDelta(p + length, now, _lastClock);
+        _lastClock = now;
+    }
+    p[length++] = event.status;
+    p[length++] = event.data1;
+    uint8_t command = event.status & 0xF0;
+    if (command != 0xC0 && command != 0xD0) p[length++] = event.data2;
+    p[length++] = event.track;
+    p[length++] = event.port;
+    _fill += length;
+    _stats.events++;
+}
+
+void MidiTraceSink::_flush() {
+    if (_fill == 0) return;
+    uint32_t written = _file.write(_buffer, _fill);
+    _stats.bytesWritten += written;
+    if (written != _fill) _stats.writeErrors++;
+    _fill = 0;
+}
+
+bool MidiTraceSink::end() {
+    if (!_tracing) return false;
+    _tracing = false;
+    _flush();
+    uint8_t count[4];
+    _writeLE32(count, _stats.events);
+    bool ok = _stats.writeErrors == 0 && _file.seek(TRACE_COUNT_OFFSET) && _file.write(count, 4) == 4;
+    _file.close();
+    return ok;
+}
+
+bool MidiTraceSink::isTracing() const { return _tracing; }
+MidiTraceStats MidiTraceSink::getStats() const { return _stats; }
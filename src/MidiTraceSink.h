@@ -0,0 +1,58 @@
+#ifndef MidiTraceSink_H
+#define MidiTraceSink_H
+
+#include <Arduino.h>
+#include <FS.h>
+#include "ESP32MidiPlayer.h"
+
+struct MidiTraceStats {
+    uint32_t events = 0;       // Events traced
+    uint32_t bytesWritten = 0; // Bytes written to the file (header included)
+    uint32_t writeErrors = 0;  // Buffer writes that came up short
+};
+
+// Records every event it receives (tick, song time, optionally the clock time it arrived at, the
+// message, track and port) into a compact binary trace, to compare the output of two builds with
+// extras/miditrace.py. Times are stored as zig-zag VLQ deltas, so a typical event takes about
+// 10 bytes. Events are buffered in RAM and the buffer is written to the file when full, inside
+// the event path: trace on a virtual clock (see the CorpusCheck example) or give it a large buffer.
+//
+//   MidiTraceSink trace(LittleFS);
+//   trace.begin("/golden.trc", &virtualClock);
+//   player.addRoute(0xFF, 0xFFFF, &trace);  // Or setDefaultSink(&trace)
+//   ... play the song ...
+//   trace.end();
+//
+//   python3 extras/miditrace.py diff golden.trc candidate.trc
+class MidiTraceSink : public MidiEventSink {
+public:
+    static const uint8_t FORMAT_VERSION = 1;
+
+    MidiTraceSink(fs::FS& filesystem, uint32_t bufferSize = 4096);
+    ~MidiTraceSink();
+
+    // clock: when given, the time each event reached the sink is traced as well
+    bool begin(const char* path, MidiTimeSource* clock = nullptr);
+    void onMidiEvent(const MidiEvent& event) override;
+    bool end(); // Writes the rest and the event count, then closes the file
+
+    bool isTracing() const;
+    MidiTraceStats getStats() const;
+
+private:
+    void _flush();
+
+    fs::FS& _fs;
+    fs::File _file;
+    uint32_t _bufferSize;
+    uint8_t* _buffer = nullptr;
+    uint32_t _fill = 0;
+    bool _tracing = false;
+    MidiTimeSource* _clock = nullptr;
+    uint64_t _lastTick = 0;
+    uint64_t _lastMicros = 0;
+    uint64_t _lastClock = 0;
+    MidiTraceStats _stats;
+};
+
+#endif
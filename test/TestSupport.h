@@ -0,0 +1,130 @@
+#ifndef TEST_SUPPORT_H
+#define TEST_SUPPORT_H
+
+// Shared pieces of the host tests: a failure counter, a virtual time source and a small
+// Standard MIDI File writer for fixtures
+
+#include "ESP32MidiPlayer.h"
+#include <stdio.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+static int testFailures = 0;
+
+#define CHECK(condition)                                                          \
+    do {                                                                          \
+        if (!(condition)) {                                                       \
+            printf("%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition);  \
+            testFailures++;                                                       \
+        }                                                                         \
+    } while (0)
+
+#define CHECK_EQ(actual, expected)                                                                 \
+    do {                                                                                           \
+        unsigned long long _actual = (unsigned long long)(actual);                                 \
+        unsigned long long _expected = (unsigned long long)(expected);                             \
+        if (_actual != _expected) {                                                                \
+            printf("%s:%d: CHECK_EQ failed: %s == %llu, expected %s == %llu\n", __FILE__, __LINE__, \
+                   #actual, _actual, #expected, _expected);                                        \
+            testFailures++;                                                                        \
+        }                                                                                          \
+    } while (0)
+
+static inline int testResult(const char* name) {
+    printf("%s: %s\n", name, testFailures ? "FAILED" : "passed");
+    return testFailures ? 1 : 0;
+}
+
+// Time only moves when the test says so
+class VirtualClock : public MidiTimeSource {
+public:
+    uint64_t now = 0;
+    uint64_t nowMicros() override { return now; }
+};
+
+// Collects what a player dispatches
+struct CapturedEvent {
+    uint64_t tick;
+    uint64_t micros;
+    uint8_t status, data1, data2, track;
+};
+
+class CaptureSink : public MidiEventSink {
+public:
+    std::vector<CapturedEvent> events;
+    void onMidiEvent(const MidiEvent& event) override {
+        events.push_back({event.tick, event.micros, event.status, event.data1, event.data2, event.track});
+    }
+};
+
+// Plays a loaded file to the end as fast as possible, jumping the clock to each due event
+static inline void playToEnd(ESP32MidiPlayer& player, VirtualClock& clock) {
+    player.play();
+    while (player.isPlaying()) {
+        player.tick();
+        uint32_t wait = player.getMicrosUntilNextEvent();
+        clock.now += wait ? wait : 1;
+    }
+}
+
+// Builds one MTrk chunk from absolute-tick events (kept in insertion order for equal ticks)
+class SmfTrack {
+public:
+    void event(uint32_t tick, std::vector<uint8_t> bytes) { _events.push_back({tick, bytes}); }
+    void tempo(uint32_t tick, uint32_t microsPerQuarter) {
+        event(tick, {0xFF, 0x51, 0x03, (uint8_t)(microsPerQuarter >> 16), (uint8_t)(microsPerQuarter >> 8), (uint8_t)microsPerQuarter});
+    }
+    void note(uint32_t tick, uint32_t length, uint8_t channel, uint8_t key, uint8_t velocity) {
+        event(tick, {(uint8_t)(0x90 | channel), key, velocity});
+        event(tick + length, {(uint8_t)(0x80 | channel), key, 0});
+    }
+
+    std::vector<uint8_t> chunk() const {
+        std::vector<std::pair<uint32_t, std::vector<uint8_t>>> sorted = _events;
+        std::stable_sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+        std::vector<uint8_t> body;
+        uint32_t last = 0;
+        for (const auto& e : sorted) {
+            _putVlq(body, e.first - last);
+            last = e.first;
+            body.insert(body.end(), e.second.begin(), e.second.end());
+        }
+        body.insert(body.end(), {0x00, 0xFF, 0x2F, 0x00});
+        std::vector<uint8_t> out = {'M', 'T', 'r', 'k'};
+        for (int shift = 24; shift >= 0; shift -= 8) out.push_back((uint8_t)(body.size() >> shift));
+        out.insert(out.end(), body.begin(), body.end());
+        return out;
+    }
+
+private:
+    static void _putVlq(std::vector<uint8_t>& out, uint32_t value) {
+        uint8_t bytes[5];
+        int count = 0;
+        do {
+            bytes[count++] = value & 0x7F;
+            value >>= 7;
+        } while (value);
+        while (count > 1) out.push_back(0x80 | bytes[--count]);
+        out.push_back(bytes[0]);
+    }
+
+    std::vector<std::pair<uint32_t, std::vector<uint8_t>>> _events;
+};
+
+static inline bool writeSmf(fs::FS& filesystem, const char* path, uint16_t format, uint16_t division,
+                            const std::vector<SmfTrack>& tracks) {
+    std::vector<uint8_t> data = {'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, (uint8_t)format,
+                                 (uint8_t)(tracks.size() >> 8), (uint8_t)tracks.size(), (uint8_t)(division >> 8), (uint8_t)division};
+    for (const SmfTrack& track : tracks) {
+        std::vector<uint8_t> chunk = track.chunk();
+        data.insert(data.end(), chunk.begin(), chunk.end());
+    }
+    fs::File file = filesystem.open(path, FILE_WRITE);
+    if (!file) return false;
+    bool ok = file.write(data.data(), data.size()) == data.size();
+    file.close();
+    return ok;
+}
+
+#endif
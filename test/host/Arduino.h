@@ -0,0 +1,56 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+// Just enough of the Arduino core to build the library on Linux for the host tests
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <string>
+
+unsigned long micros();
+unsigned long millis();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+inline void yield() {}
+
+// --- Host Clock Controls ---
+// micros() is a steady clock by default. A test can switch it to a manual clock (which delay()
+// advances instead of sleeping), e.g. to run past the 32-bit wrap, or make it drift like a real
+// crystal. Only the low 32 bits are returned, as on the boards.
+void hostSetManualClock(bool enabled, uint64_t micros = 0);
+void hostAdvanceClock(uint64_t micros);
+uint64_t hostClockMicros(); // Full 64-bit value behind micros()
+void hostSetClockDriftPpm(double ppm);
+
+class String {
+public:
+    String() {}
+    String(const char* s) : _s(s ? s : "") {}
+    String(const std::string& s) : _s(s) {}
+    String& operator=(const char* s) { _s = s ? s : ""; return *this; }
+    String& operator+=(const char* s) { _s += s; return *this; }
+    String& operator+=(const String& s) { _s += s._s; return *this; }
+    String operator+(const char* s) const { return String(_s + s); }
+    String operator+(const String& s) const { return String(_s + s._s); }
+    bool operator==(const char* s) const { return _s == s; }
+    bool operator==(const String& s) const { return _s == s._s; }
+    bool operator!=(const String& s) const { return _s != s._s; }
+    const char* c_str() const { return _s.c_str(); }
+    unsigned int length() const { return _s.size(); }
+    bool isEmpty() const { return _s.empty(); }
+    bool endsWith(const char* s) const {
+        size_t n = strlen(s);
+        return _s.size() >= n && _s.compare(_s.size() - n, n, s) == 0;
+    }
+    bool endsWith(const String& s) const { return endsWith(s.c_str()); }
+    void remove(unsigned int index) { if (index < _s.size()) _s.erase(index); }
+
+private:
+    std::string _s;
+};
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef HOST_FS_H
+#define HOST_FS_H
+
+// fs::FS / fs::File on top of stdio. Paths are relative to a root directory on the host
+// (the test's working directory by default).
+
+#include <Arduino.h>
+#include <string>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+namespace fs {
+
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+class FS;
+
+class File {
+public:
+    File() {}
+    File(FS* owner, FILE* file, const std::string& path) : _owner(owner), _file(file), _path(path) {}
+    File(FS* owner, void* directory, const std::string& path) : _owner(owner), _directory(directory), _path(path) {}
+
+    size_t read(uint8_t* buffer, size_t length);
+    int read();
+    size_t write(const uint8_t* buffer, size_t length);
+    size_t write(uint8_t byte) { return write(&byte, 1); }
+    bool seek(uint32_t position, SeekMode mode = SeekSet);
+    size_t position() const;
+    size_t size() const;
+    void flush();
+    void close();
+    operator bool() const { return _file != nullptr || _directory != nullptr; }
+    const char* name() const;
+    const char* path() const { return _path.c_str(); }
+    bool isDirectory() const { return _directory != nullptr; }
+    File openNextFile();
+    time_t getLastWrite() { return 0; }
+
+private:
+    FS* _owner = nullptr;
+    FILE* _file = nullptr;
+    void* _directory = nullptr; // DIR*
+    std::string _path;
+};
+
+class FS {
+public:
+    explicit FS(const char* root = ".") : _root(root) {}
+
+    File open(const char* path, const char* mode = FILE_READ, bool create = false);
+    File open(const String& path, const char* mode = FILE_READ, bool create = false) { return open(path.c_str(), mode, create); }
+    bool exists(const char* path);
+    bool exists(const String& path) { return exists(path.c_str()); }
+    bool remove(const char* path);
+    bool remove(const String& path) { return remove(path.c_str()); }
+    bool rename(const char* from, const char* to);
+    bool rename(const String& from, const String& to) { return rename(from.c_str(), to.c_str()); }
+    bool mkdir(const char* path);
+    bool mkdir(const String& path) { return mkdir(path.c_str()); }
+
+    std::string hostPath(const char* path) const { return _root + (path[0] == '/' ? "" : "/") + path; }
+
+private:
+    std::string _root;
+};
+
+} // namespace fs
+
+using fs::FS;
+using fs::File;
+using fs::SeekMode;
+using fs::SeekSet;
+using fs::SeekCur;
+using fs::SeekEnd;
+
+#endif
@@ -0,0 +1,116 @@
+#include <Arduino.h>
+#include <FS.h>
+#include <chrono>
+#include <thread>
+#include <dirent.h>
+#include <sys/stat.h>
+
+// --- Clock ---
+static bool _manualClock = false;
+static uint64_t _manualMicros = 0;
+static double _driftPpm = 0;
+
+static uint64_t _steadyMicros() {
+    using namespace std::chrono;
+    static const steady_clock::time_point origin = steady_clock::now();
+    uint64_t raw = duration_cast<microseconds>(steady_clock::now() - origin).count();
+    return raw + (int64_t)(raw * _driftPpm / 1e6);
+}
+
+void hostSetManualClock(bool enabled, uint64_t micros) {
+    _manualClock = enabled;
+    _manualMicros = micros;
+}
+
+void hostAdvanceClock(uint64_t micros) { _manualMicros += micros; }
+uint64_t hostClockMicros() { return _manualClock ? _manualMicros : _steadyMicros(); }
+void hostSetClockDriftPpm(double ppm) { _driftPpm = ppm; }
+
+unsigned long micros() { return (uint32_t)hostClockMicros(); }
+unsigned long millis() { return (uint32_t)(hostClockMicros() / 1000); }
+
+void delay(unsigned long ms) {
+    if (_manualClock) _manualMicros += (uint64_t)ms * 1000;
+    else std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(unsigned int us) {
+    if (_manualClock) _manualMicros += us;
+    else std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+// --- Filesystem ---
+namespace fs {
+
+size_t File::read(uint8_t* buffer, size_t length) { return _file ? fread(buffer, 1, length, _file) : 0; }
+
+int File::read() {
+    uint8_t byte;
+    return read(&byte, 1) == 1 ? byte : -1;
+}
+
+size_t File::write(const uint8_t* buffer, size_t length) { return _file ? fwrite(buffer, 1, length, _file) : 0; }
+
+bool File::seek(uint32_t position, SeekMode mode) {
+    int whence = mode == SeekSet ? SEEK_SET : mode == SeekCur ? SEEK_CUR : SEEK_END;
+    return _file && fseek(_file, position, whence) == 0;
+}
+
+size_t File::position() const { return _file ? ftell(_file) : 0; }
+
+size_t File::size() const {
+    if (!_file) return 0;
+    long position = ftell(_file);
+    fseek(_file, 0, SEEK_END);
+    long size = ftell(_file);
+    fseek(_file, position, SEEK_SET);
+    return size;
+}
+
+void File::flush() {
+    if (_file) fflush(_file);
+}
+
+void File::close() {
+    if (_file) fclose(_file);
+    if (_directory) closedir((DIR*)_directory);
+    _file = nullptr;
+    _directory = nullptr;
+}
+
+const char* File::name() const {
+    size_t slash = _path.rfind('/');
+    return _path.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+}
+
+File File::openNextFile() {
+    if (!_directory) return File();
+    while (struct dirent* entry = readdir((DIR*)_directory)) {
+        if (entry->d_name[0] == '.') continue;
+        return _owner->open((_path + "/" + entry->d_name).c_str());
+    }
+    return File();
+}
+
+File FS::open(const char* path, const char* mode, bool) {
+    std::string full = hostPath(path);
+    struct stat info;
+    if (stat(full.c_str(), &info) == 0 && S_ISDIR(info.st_mode)) {
+        DIR* directory = opendir(full.c_str());
+        return directory ? File(this, (void*)directory, path) : File();
+    }
+    const char* hostMode = strcmp(mode, "r") == 0 ? "rb" : strcmp(mode, "w") == 0 ? "w+b" : strcmp(mode, "r+") == 0 ? "r+b" : "a+b";
+    FILE* file = fopen(full.c_str(), hostMode);
+    return file ? File(this, file, path) : File();
+}
+
+bool FS::exists(const char* path) {
+    struct stat info;
+    return stat(hostPath(path).c_str(), &info) == 0;
+}
+
+bool FS::remove(const char* path) { return ::remove(hostPath(path).c_str()) == 0; }
+bool FS::rename(const char* from, const char* to) { return ::rename(hostPath(from).c_str(), hostPath(to).c_str()) == 0; }
+bool FS::mkdir(const char* path) { return ::mkdir(hostPath(path).c_str(), 0755) == 0; }
+
+} // namespace fs
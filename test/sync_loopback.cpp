@@ -0,0 +1,187 @@
+// MidiClockSync over UDP on the loopback interface: one leader and several follower processes,
+// each with its own clock origin and simulated crystal drift, play the same song. Every process
+// logs its song position against the shared monotonic clock; afterwards the follower positions
+// are compared with the leader's at the same instants and the inter-device skew is reported in
+// microseconds. Exits non-zero if the settled skew exceeds the limit.
+//
+//   sync_loopback [seconds=12] [followers=2] [maxSkewMicros=3000]
+
+#include "TestSupport.h"
+#include "MidiClockSync.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+const uint32_t LOG_INTERVAL_MICROS = 5000;
+const uint64_t SETTLE_MICROS = 6000000;  // Lock, relocation and skew fit happen before this
+const double DRIFT_PPM[] = {0, 80, -120, 40, -60, 150}; // Leader first
+
+static int udpSocket;
+static sockaddr_in peer;
+
+static void sendPacket(const uint8_t* packet, size_t length) {
+    sendto(udpSocket, packet, length, 0, (sockaddr*)&peer, sizeof(peer));
+}
+
+// Shared by all processes and free of simulated drift: the reference for the skew
+static uint64_t trueMicros() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+static bool writeSong(fs::FS& filesystem) {
+    std::vector<SmfTrack> tracks(1);
+    tracks[0].tempo(0, 500000);
+    for (uint32_t beat = 0; beat < 600; ++beat) tracks[0].note(beat * 480, 240, beat % 16, 60, 100);
+    return writeSmf(filesystem, "/sync.mid", 0, 480, tracks);
+}
+
+// One device; logs "trueMicros songMicros playing" lines
+static int runNode(int index, uint64_t endMicros) {
+    bool leader = index == 0;
+    hostSetClockDriftPpm(DRIFT_PPM[index]);
+    if (!leader) {
+        udpSocket = socket(AF_INET, SOCK_DGRAM, 0);
+        sockaddr_in local{};
+        local.sin_family = AF_INET;
+        local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(udpSocket, (sockaddr*)&local, sizeof(local));
+    }
+    fcntl(udpSocket, F_SETFL, O_NONBLOCK);
+
+    FS filesystem;
+    ESP32MidiPlayer player(filesystem);
+    player.setLogLevel(MidiLogLevel::WARN);
+    if (!player.load("/sync.mid")) return 1;
+    MidiClockSync sync(player);
+    if (leader) {
+        sync.beginLeader(sendPacket);
+        player.play();
+    } else {
+        sync.beginFollower(sendPacket, 100000);
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "node%d.log", index);
+    FILE* log = fopen(name, "w");
+    uint64_t nextLog = trueMicros();
+    while (trueMicros() < endMicros) {
+        player.tick();
+        uint8_t packet[MidiClockSync::PACKET_SIZE * 2];
+        sockaddr_in from;
+        socklen_t fromLength = sizeof(from);
+        ssize_t length;
+        while ((length = recvfrom(udpSocket, packet, sizeof(packet), 0, (sockaddr*)&from, &fromLength)) > 0) {
+            if (leader) peer = from; // Reply to whoever asked
+            sync.receive(packet, length);
+            fromLength = sizeof(from);
+        }
+        sync.update();
+        uint64_t now = trueMicros();
+        if (now >= nextLog) {
+            fprintf(log, "%llu %llu %d\n", (unsigned long long)now, (unsigned long long)player.getCurrentMicros(),
+                    player.isPlaying());
+            nextLog += LOG_INTERVAL_MICROS;
+        }
+        player.waitForNextEvent(1000);
+    }
+    MidiSyncStats stats = sync.getStats();
+    fprintf(log, "# skewPpm %.1f relocations %u responses %u\n", stats.skewPpm, stats.relocations, stats.responses);
+    fclose(log);
+    return 0;
+}
+
+struct Sample {
+    uint64_t at, song;
+    bool playing;
+};
+
+static std::vector<Sample> readLog(int index, std::string& summary) {
+    char name[32];
+    snprintf(name, sizeof(name), "node%d.log", index);
+    std::vector<Sample> samples;
+    FILE* log = fopen(name, "r");
+    if (!log) return samples;
+    char line[128];
+    while (fgets(line, sizeof(line), log)) {
+        unsigned long long at, song;
+        int playing;
+        if (line[0] == '#') summary = line + 2;
+        else if (sscanf(line, "%llu %llu %d", &at, &song, &playing) == 3) samples.push_back({at, song, playing != 0});
+    }
+    fclose(log);
+    if (!summary.empty() && summary.back() == '\n') summary.pop_back();
+    return samples;
+}
+
+int main(int argc, char** argv) {
+    uint64_t seconds = argc > 1 ? atoi(argv[1]) : 12;
+    int followers = argc > 2 ? atoi(argv[2]) : 2;
+    int64_t maxSkew = argc > 3 ? atoi(argv[3]) : 3000;
+    int nodes = followers + 1;
+    if (seconds * 1000000 <= SETTLE_MICROS || followers < 1 || nodes > (int)(sizeof(DRIFT_PPM) / sizeof(DRIFT_PPM[0]))) {
+        printf("usage: sync_loopback [seconds > 6] [followers 1-5] [maxSkewMicros]\n");
+        return 2;
+    }
+
+    FS filesystem;
+    CHECK(writeSong(filesystem));
+    // The leader's socket is bound here, so followers know its port before anyone starts
+    udpSocket = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in local{};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(udpSocket, (sockaddr*)&local, sizeof(local));
+    socklen_t localLength = sizeof(local);
+    getsockname(udpSocket, (sockaddr*)&local, &localLength);
+    peer = local;
+
+    uint64_t start = trueMicros(), end = start + seconds * 1000000;
+    std::vector<pid_t> children;
+    for (int i = 0; i < nodes; ++i) {
+        pid_t child = fork();
+        if (child == 0) _exit(runNode(i, end));
+        children.push_back(child);
+        if (i == 0) close(udpSocket);
+    }
+    for (pid_t child : children) {
+        int status = 0;
+        waitpid(child, &status, 0);
+        CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+
+    std::string summary;
+    std::vector<Sample> leader = readLog(0, summary);
+    CHECK(leader.size() > 100);
+    printf("leader: drift %+.0f ppm, %zu samples\n", DRIFT_PPM[0], leader.size());
+    for (int i = 1; i < nodes; ++i) {
+        std::vector<Sample> follower = readLog(i, summary);
+        // Follower minus leader song position at the same instant (leader interpolated)
+        double sum = 0;
+        int64_t worst = 0;
+        size_t count = 0, cursor = 0;
+        for (const Sample& sample : follower) {
+            if (sample.at < start + SETTLE_MICROS || !sample.playing) continue;
+            while (cursor + 1 < leader.size() && leader[cursor + 1].at < sample.at) cursor++;
+            if (cursor + 1 >= leader.size() || leader[cursor].at > sample.at) continue;
+            const Sample& a = leader[cursor];
+            const Sample& b = leader[cursor + 1];
+            if (!a.playing || !b.playing) continue;
+            double leaderSong = a.song + (double)(b.song - a.song) * (sample.at - a.at) / (b.at - a.at);
+            int64_t skew = (int64_t)((double)sample.song - leaderSong);
+            sum += skew;
+            if (skew > worst || -skew > worst) worst = skew < 0 ? -skew : skew;
+            count++;
+        }
+        printf("follower %d: drift %+.0f ppm, skew after %.0f s: mean %+.0f us, max |%lld| us over %zu samples (%s)\n", i,
+               DRIFT_PPM[i], SETTLE_MICROS / 1e6, count ? sum / count : 0.0, (long long)worst, count, summary.c_str());
+        CHECK(count > 100);
+        CHECK(worst <= maxSkew);
+    }
+    return testResult("sync_loopback");
+}
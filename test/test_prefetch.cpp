@@ -0,0 +1,87 @@
+// Background prefetch on the host thread backend: with every file read slowed down by
+// setReadLatencyMicros(), a song played through the prefetch rings must produce exactly the
+// events of a plain synchronous playback, without a single starvation, also across a seek.
+
+#include "TestSupport.h"
+#include <chrono>
+#include <thread>
+
+const uint32_t READ_LATENCY_MICROS = 1000; // Per read (the seek's chase pays it too), as on a busy SPI flash
+const uint32_t STEP_MICROS = 40000;         // Song time per tick()
+const uint32_t REAL_STEP_MICROS = 1000;     // Real time per tick(), for the prefetch thread to run
+
+// Eight tracks of dense notes and controllers: about 100 KB, each track long enough to wrap its ring
+static bool writeSong(fs::FS& filesystem) {
+    std::vector<SmfTrack> tracks(8);
+    tracks[0].tempo(0, 400000);
+    uint32_t seed = 7;
+    for (uint8_t t = 1; t < tracks.size(); ++t) {
+        for (uint32_t tick = 0; tick < 240 * 480; tick += 60) {
+            seed = seed * 1103515245 + 12345;
+            tracks[t].note(tick, 30 + (seed >> 20) % 30, t, 36 + (seed >> 8) % 60, 1 + (seed >> 16) % 127);
+            if ((seed >> 4) % 4 == 0) tracks[t].event(tick + 15, {(uint8_t)(0xB0 | t), 1, (uint8_t)((seed >> 12) % 128)});
+        }
+    }
+    return writeSmf(filesystem, "/dense.mid", 1, 480, tracks);
+}
+
+// seekAtMicros: 0 for no seek, else seek forward by 40 s (more than a ring holds) once the clock passes it
+static std::vector<CapturedEvent> play(fs::FS& filesystem, uint32_t prefetchBytes, uint64_t seekAtMicros,
+                                       MidiIoStats& stats) {
+    VirtualClock clock; // Outlives the player, whose destructor still reads the time
+    CaptureSink sink;
+    ESP32MidiPlayer player(filesystem);
+    player.setTimeSource(&clock);
+    player.setDefaultSink(&sink);
+    player.setLogLevel(MidiLogLevel::WARN);
+    player.setPrefetch(prefetchBytes);
+    player.setReadLatencyMicros(prefetchBytes ? READ_LATENCY_MICROS : 0);
+    CHECK(player.load("/dense.mid"));
+    player.play();
+    if (prefetchBytes) std::this_thread::sleep_for(std::chrono::milliseconds(50)); // play() restarted the rings
+    bool seeked = false;
+    while (player.isPlaying()) {
+        // Real time for the prefetch thread to stay ahead
+        if (prefetchBytes) std::this_thread::sleep_for(std::chrono::microseconds(REAL_STEP_MICROS));
+        player.tick();
+        clock.now += STEP_MICROS;
+        if (seekAtMicros && !seeked && clock.now >= seekAtMicros) {
+            CHECK(player.seekMicros(player.getCurrentMicros() + 40000000));
+            seeked = true;
+            if (prefetchBytes) std::this_thread::sleep_for(std::chrono::milliseconds(20)); // Rings restart at the new position
+        }
+    }
+    stats = player.getIoStats();
+    return sink.events;
+}
+
+static void compare(fs::FS& filesystem, uint64_t seekAtMicros) {
+    MidiIoStats plainStats, prefetchStats;
+    std::vector<CapturedEvent> plain = play(filesystem, 0, seekAtMicros, plainStats);
+    std::vector<CapturedEvent> prefetched = play(filesystem, 2048, seekAtMicros, prefetchStats);
+    printf("%s: %zu events plain, %zu prefetched; %u file reads, %u bytes prefetched, %u starvations\n",
+           seekAtMicros ? "with seek" : "straight through", plain.size(), prefetched.size(), prefetchStats.fileReads,
+           prefetchStats.prefetchBytes, prefetchStats.prefetchStarvations);
+    CHECK(plain.size() > 10000);
+    CHECK_EQ(prefetched.size(), plain.size());
+    size_t mismatches = 0;
+    for (size_t i = 0; i < plain.size() && i < prefetched.size(); ++i) {
+        const CapturedEvent& a = plain[i];
+        const CapturedEvent& b = prefetched[i];
+        if (a.tick != b.tick || a.micros != b.micros || a.status != b.status || a.data1 != b.data1 ||
+            a.data2 != b.data2 || a.track != b.track) {
+            mismatches++;
+        }
+    }
+    CHECK_EQ(mismatches, 0);
+    CHECK_EQ(prefetchStats.prefetchStarvations, 0);
+    CHECK(prefetchStats.prefetchBytes > 50000); // The thread really did the reading
+}
+
+int main() {
+    FS filesystem;
+    CHECK(writeSong(filesystem));
+    compare(filesystem, 0);
+    compare(filesystem, 20000000);
+    return testResult("test_prefetch");
+}
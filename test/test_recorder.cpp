@@ -0,0 +1,107 @@
+// MidiRecorder round trip: events recorded into a file come back from ESP32MidiPlayer with the
+// same status, data and tick, through buffer handovers, and a recorder whose update() never runs
+// drops events cleanly while still writing a valid file.
+
+#include "TestSupport.h"
+#include "MidiRecorder.h"
+
+const uint16_t DIVISION = 960;
+const uint32_t TEMPO = 500000;
+
+struct RecordedEvent {
+    uint64_t micros;
+    uint8_t status, data1, data2;
+};
+
+// A deterministic mix of every channel message type, including long gaps and same-time events
+static std::vector<RecordedEvent> makeEvents(size_t count) {
+    static const uint8_t commands[] = {0x90, 0x80, 0xB0, 0xC0, 0xD0, 0xE0, 0xA0};
+    std::vector<RecordedEvent> events;
+    uint32_t seed = 12345;
+    auto next = [&seed]() { return (seed = seed * 1103515245 + 12345) >> 8; };
+    uint64_t micros = 0;
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t roll = next() % 100;
+        micros += roll < 20 ? 0 : roll < 95 ? next() % 40000 : next() % 5000000;
+        uint8_t command = commands[next() % sizeof(commands)];
+        uint8_t data2 = (command == 0xC0 || command == 0xD0) ? 0 : (uint8_t)(next() % 127 + 1);
+        events.push_back({micros, (uint8_t)(command | (next() % 16)), (uint8_t)(next() % 128), data2});
+    }
+    return events;
+}
+
+static uint64_t expectedTick(uint64_t micros) { return (micros * DIVISION + TEMPO / 2) / TEMPO; }
+
+static std::vector<CapturedEvent> playBack(fs::FS& filesystem, const char* path) {
+    VirtualClock clock; // Outlives the player, whose destructor still reads the time
+    CaptureSink sink;
+    ESP32MidiPlayer player(filesystem);
+    player.setTimeSource(&clock);
+    player.setDefaultSink(&sink);
+    player.setLogLevel(MidiLogLevel::WARN);
+    CHECK(player.load(path));
+    playToEnd(player, clock);
+    return sink.events;
+}
+
+static void checkSame(const std::vector<RecordedEvent>& recorded, const std::vector<CapturedEvent>& played) {
+    CHECK_EQ(played.size(), recorded.size());
+    size_t mismatches = 0;
+    for (size_t i = 0; i < recorded.size() && i < played.size(); ++i) {
+        const RecordedEvent& r = recorded[i];
+        const CapturedEvent& p = played[i];
+        if (p.status != r.status || p.data1 != r.data1 || p.data2 != r.data2 || p.tick != expectedTick(r.micros)) {
+            if (mismatches++ < 5) {
+                printf("  event %zu: recorded %02x %d %d tick %llu, played %02x %d %d tick %llu\n", i, r.status, r.data1,
+                       r.data2, (unsigned long long)expectedTick(r.micros), p.status, p.data1, p.data2,
+                       (unsigned long long)p.tick);
+            }
+        }
+    }
+    CHECK_EQ(mismatches, 0);
+}
+
+static void roundTrip(fs::FS& filesystem, uint8_t format, uint32_t bufferSize) {
+    printf("format %d, %u byte buffers\n", format, bufferSize);
+    std::vector<RecordedEvent> events = makeEvents(2000);
+    MidiRecorder recorder(filesystem, bufferSize);
+    CHECK(recorder.begin("/take.mid", format, DIVISION, TEMPO));
+    for (const RecordedEvent& e : events) {
+        CHECK(recorder.record(e.micros, e.status, e.data1, e.data2));
+        recorder.update();
+    }
+    CHECK(recorder.end());
+    MidiRecorderStats stats = recorder.getStats();
+    CHECK_EQ(stats.events, events.size());
+    CHECK_EQ(stats.droppedEvents, 0);
+    if (bufferSize < 1024) CHECK(stats.flushes > 100); // Many handovers
+    checkSame(events, playBack(filesystem, "/take.mid"));
+}
+
+// Without update() both buffers fill up: later events are dropped, the file stays playable
+static void dropsWithoutUpdate(fs::FS& filesystem) {
+    printf("no update()\n");
+    std::vector<RecordedEvent> events = makeEvents(500);
+    std::vector<RecordedEvent> accepted;
+    MidiRecorder recorder(filesystem, 64);
+    CHECK(recorder.begin("/dropped.mid", 0, DIVISION, TEMPO));
+    for (const RecordedEvent& e : events) {
+        if (recorder.record(e.micros, e.status, e.data1, e.data2)) accepted.push_back(e);
+    }
+    CHECK(recorder.end());
+    MidiRecorderStats stats = recorder.getStats();
+    CHECK(stats.droppedEvents > 0);
+    CHECK_EQ(stats.events, accepted.size());
+    CHECK_EQ(stats.events + stats.droppedEvents, events.size());
+    checkSame(accepted, playBack(filesystem, "/dropped.mid"));
+}
+
+int main() {
+    FS filesystem;
+    for (uint8_t format = 0; format < 2; ++format) {
+        roundTrip(filesystem, format, 16);
+        roundTrip(filesystem, format, 1024);
+    }
+    dropsWithoutUpdate(filesystem);
+    return testResult("test_recorder");
+}
@@ -0,0 +1,117 @@
+// Long-uptime simulation: plays a song back to back for hours across the 32-bit micros() wrap
+// (default time source) and for days on a 64-bit source far past 2^32 us, in fixed tick() steps.
+// Every event must go out within one step of its exact song time (no drift, no burst of
+// overdue events after a wrap) and every pass of the song must take the same time. Due times
+// are floored to whole microseconds here, so an event can be up to one full step late.
+
+#include "TestSupport.h"
+
+const uint16_t DIVISION = 480;
+const uint32_t BEATS = 48;
+
+// Tempo changes at beats 16 and 32; tempo (us per quarter) from each tick on
+static const uint32_t TEMPO_CHANGES[][2] = {{0, 500000}, {16 * DIVISION, 250000}, {32 * DIVISION, 750000}};
+
+// Song time of a tick, straight from the tempo map
+static uint64_t songMicros(uint64_t tick) {
+    uint64_t units = 0; // us * division
+    for (size_t i = 0; i < 3; ++i) {
+        uint64_t start = TEMPO_CHANGES[i][0];
+        uint64_t end = i + 1 < 3 ? TEMPO_CHANGES[i + 1][0] : UINT64_MAX;
+        if (tick <= start) break;
+        units += ((tick < end ? tick : end) - start) * TEMPO_CHANGES[i][1];
+    }
+    return units / DIVISION;
+}
+
+static bool writeSong(fs::FS& filesystem) {
+    std::vector<SmfTrack> tracks(2);
+    for (const auto& change : TEMPO_CHANGES) tracks[0].tempo(change[0], change[1]);
+    for (uint32_t tick = 0; tick < BEATS * DIVISION; tick += DIVISION / 4) {
+        tracks[1].note(tick, DIVISION / 4, 0, 60 + (tick / (DIVISION / 4)) % 12, 100); // Off and next on share a tick
+    }
+    return writeSmf(filesystem, "/song.mid", 1, DIVISION, tracks);
+}
+
+class TimingSink : public MidiEventSink {
+public:
+    uint64_t now = 0;   // Clock time of the current tick() call
+    uint64_t start = 0; // Clock time the current pass started
+    uint32_t events = 0, eventsThisTick = 0, maxEventsPerTick = 0, wrongSongTime = 0;
+    int64_t minLateness = INT64_MAX, maxLateness = INT64_MIN;
+
+    void onMidiEvent(const MidiEvent& event) override {
+        events++;
+        eventsThisTick++;
+        // event.micros is the song position it went out at: between its due time and the clock
+        uint64_t due = songMicros(event.tick);
+        if (event.micros < due || event.micros > now - start) wrongSongTime++;
+        int64_t lateness = (int64_t)(now - start) - (int64_t)due;
+        if (lateness < minLateness) minLateness = lateness;
+        if (lateness > maxLateness) maxLateness = lateness;
+    }
+};
+
+// now(): the clock the player uses; advance(step): moves it
+template <typename Now, typename Advance>
+static void simulate(const char* name, fs::FS& filesystem, MidiTimeSource* source, Now now, Advance advance,
+                     uint64_t duration, uint32_t step) {
+    ESP32MidiPlayer player(filesystem);
+    TimingSink sink;
+    player.setTimeSource(source);
+    player.setDefaultSink(&sink);
+    CHECK(player.load("/song.mid"));
+
+    const uint64_t songLength = songMicros((uint64_t)BEATS * DIVISION);
+    uint64_t first = now(), passes = 0;
+    int64_t minLength = INT64_MAX, maxLength = INT64_MIN;
+    sink.start = now();
+    player.play();
+    while (now() - first < duration) {
+        advance(step);
+        sink.now = now();
+        sink.eventsThisTick = 0;
+        player.tick();
+        if (sink.eventsThisTick > sink.maxEventsPerTick) sink.maxEventsPerTick = sink.eventsThisTick;
+        if (!player.isPlaying()) {
+            int64_t length = (int64_t)(sink.now - sink.start);
+            if (length < minLength) minLength = length;
+            if (length > maxLength) maxLength = length;
+            passes++;
+            CHECK(player.load("/song.mid"));
+            sink.start = now();
+            player.play();
+        }
+    }
+
+    printf("%s: %.1f hours, %llu passes, %u events, max %u events per tick, lateness %lld..%lld us, "
+           "pass length %lld..%lld us (song %llu us)\n",
+           name, duration / 3.6e9, (unsigned long long)passes, sink.events, sink.maxEventsPerTick,
+           (long long)sink.minLateness, (long long)sink.maxLateness, (long long)minLength, (long long)maxLength,
+           (unsigned long long)songLength);
+    CHECK(passes > 100);
+    CHECK_EQ(sink.wrongSongTime, 0);
+    CHECK(sink.minLateness >= 0);
+    CHECK(sink.maxLateness <= (int64_t)step);
+    CHECK(sink.maxEventsPerTick <= 2); // A Note Off and the next Note On at most
+    CHECK(minLength >= (int64_t)songLength && maxLength <= (int64_t)(songLength + step));
+}
+
+int main() {
+    FS filesystem;
+    CHECK(writeSong(filesystem));
+
+    // Default source: extends the 32-bit micros(), which wraps about every 71.6 minutes
+    const uint64_t wrap = 1ULL << 32;
+    hostSetManualClock(true, wrap - 20000000);
+    simulate("system time source", filesystem, nullptr, [] { return hostClockMicros(); },
+             [](uint32_t step) { hostAdvanceClock(step); }, 10ULL * 3600 * 1000000, 5000);
+    CHECK(hostClockMicros() / wrap >= 8); // Eight wraps or more were crossed
+
+    // A 64-bit source days into uptime
+    VirtualClock clock;
+    clock.now = (1ULL << 40) - 7000000;
+    simulate("64-bit time source", filesystem, &clock, [&clock] { return clock.now; },
+             [&clock](uint32_t step) { clock.now += step; }, 3ULL * 24 * 3600 * 1000000, 20000);
+    return testResult("test_time_wrap");
+}